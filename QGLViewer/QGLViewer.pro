@@ -78,6 +78,7 @@ contains( DEFINES, NO_VECTORIAL_RENDER ) {
 	VRender/ParserGL.cpp \
 	VRender/Primitive.cpp \
 	VRender/PrimitivePositioning.cpp \
+	VRender/ScreenGrid.cpp \
 	VRender/TopologicalSortMethod.cpp \
 	VRender/VisibilityOptimizer.cpp \
 	VRender/Vector2.cpp \
@@ -94,6 +95,7 @@ contains( DEFINES, NO_VECTORIAL_RENDER ) {
 	VRender/ParserGL.h \
 	VRender/Primitive.h \
 	VRender/PrimitivePositioning.h \
+	VRender/ScreenGrid.h \
 	VRender/SortMethod.h \
 	VRender/Types.h \
 	VRender/Vector2.h \
@@ -101,6 +103,12 @@ contains( DEFINES, NO_VECTORIAL_RENDER ) {
 	VRender/VRender.h
 
   HEADERS *= $${VRENDER_HEADERS}
+
+  # Visibility optimization and topological sort process screen space cells in parallel
+  !msvc {
+	QMAKE_CXXFLAGS *= -fopenmp
+	LIBS *= -fopenmp
+  }
 }
 
 
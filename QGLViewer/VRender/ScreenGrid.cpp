@@ -0,0 +1,138 @@
+/*
+ This file is part of the VRender library.
+ Copyright (C) 2005 Cyril Soler (Cyril.Soler@imag.fr)
+ Version 1.0.0, released on June 27, 2005.
+
+ http://artis.imag.fr/Members/Cyril.Soler/VRender
+
+ VRender is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ VRender is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with VRender; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+/****************************************************************************
+
+ Copyright (C) 2002-2014 Gilles Debunne. All rights reserved.
+
+ This file is part of the QGLViewer library version 2.7.2.
+
+ http://www.libqglviewer.com - contact@libqglviewer.com
+
+ This file may be used under the terms of the GNU General Public License 
+ versions 2.0 or 3.0 as published by the Free Software Foundation and
+ appearing in the LICENSE file included in the packaging of this file.
+ In addition, as a special exception, Gilles Debunne gives you certain 
+ additional rights, described in the file GPL_EXCEPTION in this package.
+
+ libQGLViewer uses dual licensing. Commercial/proprietary software must
+ purchase a libQGLViewer Commercial License.
+
+ This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+ WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+
+*****************************************************************************/
+
+#include <math.h>
+#include <algorithm>
+
+#include "Primitive.h"
+#include "ScreenGrid.h"
+
+using namespace vrender ;
+using namespace std ;
+
+ScreenGrid::ScreenGrid(const vector<PtrPrimitive>& primitives,size_t primitives_per_cell)
+	: _boxes(primitives.size()), _i0(primitives.size(),0), _j0(primitives.size(),0)
+{
+	static const int MAX_RESOLUTION = 512 ;
+
+	// 0 - compute the screen space boxes, and the box of the whole set.
+
+	AxisAlignedBox_xy BBox ;
+	size_t nb = 0 ;
+
+	for(size_t i=0;i<primitives.size();++i)
+		if(primitives[i] != nullptr)
+		{
+			AxisAlignedBox_xyz b = primitives[i]->bbox() ;
+			_boxes[i] = AxisAlignedBox_xy(Vector2(b.mini()),Vector2(b.maxi())) ;
+			BBox.include(_boxes[i]) ;
+			++nb ;
+		}
+
+	// 1 - choose a square resolution giving about primitives_per_cell primitives per cell.
+
+	int res = int(ceil(sqrt(nb/double(max(primitives_per_cell,size_t(1)))))) ;
+	_nx = _ny = max(1,min(res,MAX_RESOLUTION)) ;
+
+	if(nb > 0)
+	{
+		_xmin = BBox.mini().x() ;
+		_ymin = BBox.mini().y() ;
+		_dx = (BBox.maxi().x() - _xmin)/_nx ;
+		_dy = (BBox.maxi().y() - _ymin)/_ny ;
+	}
+	else
+		_xmin = _ymin = 0.0 ;
+
+	if(!(_dx > 0.0)) _dx = 1.0 ;
+	if(!(_dy > 0.0)) _dy = 1.0 ;
+
+	// 2 - bucket primitives. Indices are pushed in increasing order.
+
+	_cells.resize(size_t(_nx)*_ny) ;
+
+	for(size_t i=0;i<primitives.size();++i)
+		if(primitives[i] != nullptr)
+		{
+			int i1,j1 ;
+			cellRange(_boxes[i].mini().x(),_boxes[i].maxi().x(),_xmin,_dx,_nx,_i0[i],i1) ;
+			cellRange(_boxes[i].mini().y(),_boxes[i].maxi().y(),_ymin,_dy,_ny,_j0[i],j1) ;
+
+			for(int ci=_i0[i];ci<=i1;++ci)
+				for(int cj=_j0[i];cj<=j1;++cj)
+					_cells[size_t(ci)*_ny+cj].push_back(i) ;
+		}
+}
+
+void ScreenGrid::cellRange(double mini,double maxi,double origin,double step,int n,int& i0,int& i1) const
+{
+	i0 = max(0,min(n-1,int(floor((mini-origin)/step)))) ;
+	i1 = max(0,min(n-1,int(floor((maxi-origin)/step)))) ;
+}
+
+AxisAlignedBox_xy ScreenGrid::cellBox(size_t c) const
+{
+	int i = int(c / _ny) ;
+	int j = int(c % _ny) ;
+
+	// Border cells are extended, so that they entirely contain the primitives clamped into them.
+
+	double x0 = (i == 0    )?_xmin-_dx:_xmin+i*_dx ;
+	double x1 = (i == _nx-1)?_xmin+(i+2)*_dx:_xmin+(i+1)*_dx ;
+	double y0 = (j == 0    )?_ymin-_dy:_ymin+j*_dy ;
+	double y1 = (j == _ny-1)?_ymin+(j+2)*_dy:_ymin+(j+1)*_dy ;
+
+	return AxisAlignedBox_xy(Vector2(x0,y0),Vector2(x1,y1)) ;
+}
+
+bool ScreenGrid::overlap(size_t i,size_t j) const
+{
+	return	_boxes[i].mini().x() <= _boxes[j].maxi().x() && _boxes[j].mini().x() <= _boxes[i].maxi().x()
+			&& _boxes[i].mini().y() <= _boxes[j].maxi().y() && _boxes[j].mini().y() <= _boxes[i].maxi().y() ;
+}
+
+size_t ScreenGrid::pairOwner(size_t i,size_t j) const
+{
+	return size_t(max(_i0[i],_i0[j]))*_ny + max(_j0[i],_j0[j]) ;
+}
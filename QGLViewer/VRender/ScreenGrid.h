@@ -0,0 +1,85 @@
+/*
+ This file is part of the VRender library.
+ Copyright (C) 2005 Cyril Soler (Cyril.Soler@imag.fr)
+ Version 1.0.0, released on June 27, 2005.
+
+ http://artis.imag.fr/Members/Cyril.Soler/VRender
+
+ VRender is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ VRender is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with VRender; if not, write to the Free Software Foundation, Inc.,
+ 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+*/
+
+/****************************************************************************
+
+ Copyright (C) 2002-2014 Gilles Debunne. All rights reserved.
+
+ This file is part of the QGLViewer library version 2.7.2.
+
+ http://www.libqglviewer.com - contact@libqglviewer.com
+
+ This file may be used under the terms of the GNU General Public License 
+ versions 2.0 or 3.0 as published by the Free Software Foundation and
+ appearing in the LICENSE file included in the packaging of this file.
+ In addition, as a special exception, Gilles Debunne gives you certain 
+ additional rights, described in the file GPL_EXCEPTION in this package.
+
+ libQGLViewer uses dual licensing. Commercial/proprietary software must
+ purchase a libQGLViewer Commercial License.
+
+ This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+ WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+
+*****************************************************************************/
+
+#ifndef _VRENDER_SCREENGRID_H
+#define _VRENDER_SCREENGRID_H
+
+#include <vector>
+#include "Types.h"
+#include "AxisAlignedBox.h"
+#include "Vector2.h"
+
+namespace vrender
+{
+	// Uniform grid over the screen space (xy) bounding boxes of a set of
+	// primitives. Each cell lists, in increasing order, the indices of the
+	// primitives whose box meets it. Cells can then be processed independently.
+
+	class ScreenGrid
+	{
+		public:
+			ScreenGrid(const std::vector<PtrPrimitive>& primitives,size_t primitives_per_cell = 8) ;
+
+			size_t nbCells() const { return _cells.size() ; }
+			const std::vector<size_t>& cell(size_t c) const { return _cells[c] ; }
+			AxisAlignedBox_xy cellBox(size_t c) const ;
+
+			// Index of the cell that owns the pair (i,j): the one holding the lower corner
+			// of the intersection of their boxes. Each overlapping pair has exactly one owner.
+
+			size_t pairOwner(size_t i,size_t j) const ;
+			bool overlap(size_t i,size_t j) const ;
+
+		private:
+			void cellRange(double mini,double maxi,double origin,double step,int n,int& i0,int& i1) const ;
+
+			double _xmin,_ymin,_dx,_dy ;
+			int _nx,_ny ;
+			std::vector<AxisAlignedBox_xy> _boxes ;
+			std::vector<int> _i0,_j0 ;
+			std::vector< std::vector<size_t> > _cells ;
+	};
+}
+
+#endif
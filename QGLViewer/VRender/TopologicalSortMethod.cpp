@@ -44,12 +44,14 @@
 
 #include <assert.h>
 #include <climits>
+#include <exception>
 
 #include "VRender.h"
 #include "Primitive.h"
 #include "PrimitivePositioning.h"
 #include "AxisAlignedBox.h"
 #include "SortMethod.h"
+#include "ScreenGrid.h"
 #include "Vector2.h"
 
 using namespace std ;
@@ -64,11 +66,6 @@ class TopologicalSortUtils
 	public:
 		static void buildPrecedenceGraph(vector<PtrPrimitive>& primitive_tab, vector< vector<size_t> >& precedence_graph) ;
 
-		static void recursFindNeighbors(	const vector<PtrPrimitive>& primitive_tab,
-													const vector<size_t>& pindices,
-													vector< vector<size_t> >& precedence_graph,
-													const AxisAlignedBox_xy&,int) ;
-
 		static void checkAndAddEdgeToGraph(size_t a,size_t b,vector< vector<size_t> >& precedence_graph) ;
 		static void suppressPrecedence(size_t a,size_t b,vector< vector<size_t> >& precedence_graph) ;
 
@@ -162,97 +159,57 @@ void TopologicalSortUtils::buildPrecedenceGraph(vector<PtrPrimitive>& primitive_
 																vector< vector<size_t> >& precedence_graph)
 {
 	// The precedence graph is constructed by first conservatively determining which
-	// primitives can possibly intersect using a quadtree. Candidate pairs of
+	// primitives can possibly intersect using a screen space grid. Candidate pairs of
 	// primitives are then carefully checked to compute their exact relative positionning.
 	//
-	// Because of the conservativeness of the quadtree, some pairs of primitives may be checked
-	// multiple times for intersection. Using a buffer of already computed results may proove
-	// very efficient.
-
-	// 0 - compute bounding box of the set of primitives.
-
-	AxisAlignedBox_xy BBox ;
-
-	for(size_t i=0;i<primitive_tab.size();++i)
-	{
-		BBox.include(Vector2(primitive_tab[i]->bbox().mini().x(),primitive_tab[i]->bbox().mini().y())) ;
-		BBox.include(Vector2(primitive_tab[i]->bbox().maxi().x(),primitive_tab[i]->bbox().maxi().y())) ;
-	}
+	// A pair meeting several cells is only checked in the cell owning it, so each pair is
+	// computed once. Cells are independent and processed in parallel.
 
-	// 1 - recursively find pairs.
+	ScreenGrid grid(primitive_tab) ;
 
-	vector<size_t> pindices(primitive_tab.size()) ;
-	for(size_t j=0;j<pindices.size();++j)
-		pindices[j] = j ;
+	long nb_cells = long(grid.nbCells()) ;
+	vector< vector< pair<size_t,size_t> > > edges(nb_cells) ;
 
-	recursFindNeighbors(primitive_tab, pindices, precedence_graph, BBox,0) ;
-}
-
-void TopologicalSortUtils::recursFindNeighbors(const vector<PtrPrimitive>& primitive_tab,
-																const vector<size_t>& pindices,
-																vector< vector<size_t> >& precedence_graph,
-																const AxisAlignedBox_xy& bbox,
-																int depth)
-{
-	static const size_t MAX_PRIMITIVES_IN_CELL = 5 ;
+	// An exception must not leave the parallel region: the first one is kept and
+	// thrown again after it, as the sequential version would have done.
 
-	// Refinment: first decide which sub-cell each primitive meets, then call
-	// algorithm recursively.
+	exception_ptr error ;
 
-	if(primitive_tab.size() > MAX_PRIMITIVES_IN_CELL)
+#pragma omp parallel for schedule(dynamic)
+	for(long c=0;c<nb_cells;++c)
 	{
-		vector<size_t> p_indices_min_min ;
-		vector<size_t> p_indices_min_max ;
-		vector<size_t> p_indices_max_min ;
-		vector<size_t> p_indices_max_max ;
+		try
+		{
+			const vector<size_t>& pindices = grid.cell(c) ;
 
-		double xmin = bbox.mini().x() ;
-		double ymin = bbox.mini().y() ;
-		double xmax = bbox.maxi().x() ;
-		double ymax = bbox.maxi().y() ;
+			for(size_t i=0;i<pindices.size();++i)
+				for(size_t j=i+1;j<pindices.size();++j)
+					if(grid.overlap(pindices[i],pindices[j]) && grid.pairOwner(pindices[i],pindices[j]) == size_t(c))
+					{
+						// Compute the position of j as regard to i
 
-		double xMean = 0.5*(xmin+xmax) ;
-		double yMean = 0.5*(ymin+ymax) ;
+						int prp = PrimitivePositioning::computeRelativePosition(	primitive_tab[pindices[i]], primitive_tab[pindices[j]]) ;
 
-		for(size_t i=0;i<pindices.size();++i)
-		{
-			bool left  = primitive_tab[pindices[i]]->bbox().mini().x() <= xMean ;
-			bool right = primitive_tab[pindices[i]]->bbox().maxi().x() >= xMean ;
-			bool down  = primitive_tab[pindices[i]]->bbox().mini().y() <= yMean ;
-			bool up    = primitive_tab[pindices[i]]->bbox().maxi().y() >= yMean ;
-
-			if(left  && down) p_indices_min_min.push_back(pindices[i]) ;
-			if(right && down) p_indices_max_min.push_back(pindices[i]) ;
-			if(left  && up  ) p_indices_min_max.push_back(pindices[i]) ;
-			if(right && up  ) p_indices_max_max.push_back(pindices[i]) ;
+						if(prp & PrimitivePositioning::Upper) edges[c].push_back(make_pair(pindices[j],pindices[i])) ;
+						if(prp & PrimitivePositioning::Lower) edges[c].push_back(make_pair(pindices[i],pindices[j])) ;
+					}
 		}
-
-		// checks if refining is not too much stupid
-
-		if(p_indices_min_min.size() < pindices.size() && p_indices_max_min.size() < pindices.size()
-				&& p_indices_min_max.size() < pindices.size() && p_indices_max_max.size() < pindices.size())
+		catch(...)
 		{
-			recursFindNeighbors(primitive_tab,p_indices_min_min,precedence_graph,AxisAlignedBox_xy(Vector2(xmin,xMean),Vector2(ymin,yMean)),depth+1) ;
-			recursFindNeighbors(primitive_tab,p_indices_min_max,precedence_graph,AxisAlignedBox_xy(Vector2(xmin,xMean),Vector2(yMean,ymax)),depth+1) ;
-			recursFindNeighbors(primitive_tab,p_indices_max_min,precedence_graph,AxisAlignedBox_xy(Vector2(xMean,xmax),Vector2(ymin,yMean)),depth+1) ;
-			recursFindNeighbors(primitive_tab,p_indices_max_max,precedence_graph,AxisAlignedBox_xy(Vector2(xMean,xmax),Vector2(yMean,ymax)),depth+1) ;
-			return ;
+#pragma omp critical(vrender_precedence_error)
+			if(!error)
+				error = current_exception() ;
 		}
 	}
 
-	// No refinment either because it could not be possible, or because the number of primitives is below
-	// the predefined limit.
-
-	for(size_t i=0;i<pindices.size();++i)
-		for(size_t j=i+1;j<pindices.size();++j)
-		{
-			// Compute the position of j as regard to i
+	if(error)
+		rethrow_exception(error) ;
 
-			int prp = PrimitivePositioning::computeRelativePosition(	primitive_tab[pindices[i]], primitive_tab[pindices[j]]) ;
+	// Edges are added in cell order, so that the graph does not depend on the scheduling.
 
-			if(prp & PrimitivePositioning::Upper) checkAndAddEdgeToGraph(pindices[j],pindices[i],precedence_graph) ;
-			if(prp & PrimitivePositioning::Lower) checkAndAddEdgeToGraph(pindices[i],pindices[j],precedence_graph) ;
-		}
+	for(size_t c=0;c<edges.size();++c)
+		for(size_t k=0;k<edges[c].size();++k)
+			checkAndAddEdgeToGraph(edges[c][k].first,edges[c][k].second,precedence_graph) ;
 }
 
 void TopologicalSortUtils::checkAndAddEdgeToGraph(size_t a,size_t b,vector< vector<size_t> >& precedence_graph)
@@ -41,235 +41,204 @@
  WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
 
 *****************************************************************************/
-
 #include <vector>
+#include <algorithm>
 #include "VRender.h"
 #include "Optimizer.h"
 #include "Primitive.h"
+#include "ScreenGrid.h"
 #include "gpc.h"
 #include "math.h"
 
 using namespace vrender ;
 using namespace std ;
 
-#ifdef A_FAIRE
-void VisibilityOptimizer::optimize(vector<PtrPrimitive>& primitives,float& percentage_finished,string& message)
-#else
-void VisibilityOptimizer::optimize(vector<PtrPrimitive>& primitives,VRenderParams& vparams)
-#endif
+// Creates a gpc_polygon corresponding to the primitive, and a slightly reduced one used
+// for the visibility test. Segments are turned into thin quads.
+
+static void buildPolygons(const Primitive *p,gpc_polygon& new_poly,gpc_polygon& new_poly_reduced)
 {
-#ifdef DEBUG_VO
-        cout << "Optimizing visibility." << endl ;
-#endif
-        unsigned long N = primitives.size()/200 + 1 ;
-
-#ifdef DEBUG_EPSRENDER__SHOW1
-//	cout << "Showing viewer." << endl ;
-//	myViewer viewer ;
-//	viewer.show();
-        double minx =  FLT_MAX ;
-        double miny =  FLT_MAX ;
-        double maxx = -FLT_MAX ;
-        double maxy = -FLT_MAX ;
-        for(unsigned int i=0;i<primitives.size();++i)
-                for(int j=0;j<primitives[i]->nbVertices();++j)
+        vector<gpc_vertex> verts ;
+        vector<gpc_vertex> verts_reduced ;
+
+        if(p->nbVertices() == 2)
+        {
+                verts.resize(4) ;
+
+                double deps = 0.001 ;
+                double du = p->vertex(1).y()-p->vertex(0).y() ;
+                double dv = p->vertex(1).x()-p->vertex(0).x() ;
+                double n = sqrt(du*du+dv*dv) ;
+                du *= deps/n ;
+                dv *= deps/n ;
+                verts[0].x = p->vertex(0).x() + du ;
+                verts[0].y = p->vertex(0).y() + dv ;
+                verts[1].x = p->vertex(1).x() + du ;
+                verts[1].y = p->vertex(1).y() + dv ;
+                verts[2].x = p->vertex(1).x() - du ;
+                verts[2].y = p->vertex(1).y() - dv ;
+                verts[3].x = p->vertex(0).x() - du ;
+                verts[3].y = p->vertex(0).y() - dv ;
+
+                verts_reduced = verts ;
+        }
+        else
+        {
+                double mx = 0.0 ;
+                double my = 0.0 ;
+
+                verts.resize(p->nbVertices()) ;
+                verts_reduced.resize(p->nbVertices()) ;
+
+                for(size_t i=0;i<p->nbVertices();++i)
+                {
+                        verts[i].x = p->vertex(i).x() ;
+                        verts[i].y = p->vertex(i).y() ;
+                        mx += p->vertex(i).x() ;
+                        my += p->vertex(i).y() ;
+                }
+                mx /= p->nbVertices() ;
+                my /= p->nbVertices() ;
+
+                for(size_t j=0;j<p->nbVertices();++j)
                 {
-                        if(maxx < primitives[i]->vertex(j).x()) maxx = primitives[i]->vertex(j).x() ;
-                        if(maxy < primitives[i]->vertex(j).y()) maxy = primitives[i]->vertex(j).y() ;
-                        if(minx > primitives[i]->vertex(j).x()) minx = primitives[i]->vertex(j).x() ;
-                        if(miny > primitives[i]->vertex(j).y()) miny = primitives[i]->vertex(j).y() ;
+                        verts_reduced[j].x = mx + (p->vertex(j).x() - mx)*0.999 ;
+                        verts_reduced[j].y = my + (p->vertex(j).y() - my)*0.999 ;
                 }
+        }
 
-        glMatrixMode(GL_PROJECTION) ;
-        glLoadIdentity() ;
-        glOrtho(minx,maxx,miny,maxy,-1,1) ;
-        glMatrixMode(GL_MODELVIEW) ;
-        glLoadIdentity() ;
+        gpc_vertex_list list = { long(verts.size()), &verts[0] } ;
+        gpc_vertex_list list_reduced = { long(verts_reduced.size()), &verts_reduced[0] } ;
 
-        cout << "Window set to " << minx << " " << maxx << " " << miny << " " << maxy << endl ;
-        glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT) ;
-        glLineWidth(3.0) ;
-#endif
+        gpc_add_contour(&new_poly,&list,false) ;
+        gpc_add_contour(&new_poly_reduced,&list_reduced,false) ;
+}
 
-        int nb_culled = 0 ;
+// Walks the primitives of one grid cell front to back, keeping the union of the preceeding
+// ones restricted to the cell. Marks the primitives that are visible in this cell.
 
-        // Ca serait pas mal mieux avec une interface c++...
+static void optimizeCell(const vector<PtrPrimitive>& primitives,const ScreenGrid& grid,size_t c,vector<char>& visible)
+{
+        const vector<size_t>& cell = grid.cell(c) ;
+        AxisAlignedBox_xy box = grid.cellBox(c) ;
+
+        gpc_vertex rect_verts[4] = { { box.mini().x(),box.mini().y() },{ box.maxi().x(),box.mini().y() },
+                                     { box.maxi().x(),box.maxi().y() },{ box.mini().x(),box.maxi().y() } } ;
+        gpc_vertex_list rect_list = { 4, rect_verts } ;
+        gpc_polygon rect = { 0, nullptr, nullptr } ;
+        gpc_add_contour(&rect,&rect_list,false) ;
+
+        gpc_polygon cumulated_union = { 0, nullptr, nullptr } ;
+
+        for(size_t k=cell.size();k-- > 0;)
+        {
+                size_t pindex = cell[k] ;
+                const Primitive *p = primitives[pindex] ;
 
-        gpc_polygon cumulated_union ;
-        cumulated_union.num_contours = 0 ;
-        cumulated_union.hole = nullptr ;
-        cumulated_union.contour = nullptr ;
-        size_t nboptimised = 0 ;
+                if(p->nbVertices() < 2)
+                        continue ;
 
-        for(size_t pindex = primitives.size() - 1; long(pindex) >= 0;--pindex,++nboptimised)
-                if(primitives[pindex] != nullptr)
+                try
                 {
-#ifdef A_FAIRE
-                        percentage_finished = pindex / (float)primitives.size() ;
-#endif
+                        gpc_polygon new_poly = { 0, nullptr, nullptr } ;
+                        gpc_polygon new_poly_reduced = { 0, nullptr, nullptr } ;
+                        gpc_polygon clipped = { 0, nullptr, nullptr } ;
+                        gpc_polygon difference = { 0, nullptr, nullptr } ;
+
+                        // 1 - creates the polygons of the current primitive
+
+                        buildPolygons(p,new_poly,new_poly_reduced) ;
 
-                        if(primitives[pindex]->nbVertices() > 1)
+                        // 2 - computes the difference between the part of this polygon in the cell,
+                        // 	and the union of the preceeding ones.
+
+                        gpc_polygon_clip(GPC_INT,&new_poly_reduced,&rect,&clipped) ;
+                        gpc_polygon_clip(GPC_DIFF,&clipped,&cumulated_union,&difference) ;
+
+                        // 3 - If not void, the primitive is visible in this cell. Let's add it to the
+                        // 	cumulated union.
+
+                        if(difference.num_contours > 0)
                         {
-#ifdef DEBUG_VO
-                                if(pindex%50==0)
+#pragma omp atomic write
+                                visible[pindex] = 1 ;
+
+                                if(p->nbVertices() > 2)
                                 {
-                                        char buff[500] ;
-                                        sprintf(buff,"Left: % 6ld - Culled: % 6ld", pindex,(long)nb_culled) ;
-                                        fprintf(stdout,buff);
+                                        gpc_polygon cumulated_union_tmp = { 0, nullptr, nullptr } ;
 
-                                        for(unsigned int j=0;j<strlen(buff);++j)
-                                                fprintf(stdout,"\b") ;
+                                        gpc_free_polygon(&clipped) ;
+                                        gpc_polygon_clip(GPC_INT,&new_poly,&rect,&clipped) ;
+                                        gpc_polygon_clip(GPC_UNION,&clipped,&cumulated_union,&cumulated_union_tmp) ;
 
-                                        fflush(stdout) ;
+                                        gpc_free_polygon(&cumulated_union) ;
+                                        cumulated_union = cumulated_union_tmp ;
                                 }
+                        }
+
+                        gpc_free_polygon(&new_poly) ;
+                        gpc_free_polygon(&new_poly_reduced) ;
+                        gpc_free_polygon(&clipped) ;
+                        gpc_free_polygon(&difference) ;
+                }
+                catch(exception& )
+                {
+                        // std::cout << "Could not treat primitive " << pindex << ": internal gpc error." << endl ;
+#pragma omp atomic write
+                        visible[pindex] = 1 ;
+                }
+        }
+
+        gpc_free_polygon(&cumulated_union) ;
+        gpc_free_polygon(&rect) ;
+}
+
+#ifdef A_FAIRE
+void VisibilityOptimizer::optimize(vector<PtrPrimitive>& primitives,float& percentage_finished,string& message)
+#else
+void VisibilityOptimizer::optimize(vector<PtrPrimitive>& primitives,VRenderParams& vparams)
+#endif
+{
+#ifdef DEBUG_VO
+        cout << "Optimizing visibility." << endl ;
 #endif
+        // Primitives are bucketed in a screen space grid. A primitive hidden by the preceeding
+        // ones in every cell it meets is not visible. Cells are independent, and processed in
+        // parallel, by batches so as to report progress.
 
-                                try
-                                {
-                                        PtrPrimitive p(primitives[pindex]) ;
-                                        gpc_polygon difference ;
-                                        gpc_polygon new_poly ;
-                                        gpc_polygon new_poly_reduced ;
-                                        new_poly.num_contours = 0 ;
-                                        new_poly.hole = nullptr ;
-                                        new_poly.contour = nullptr ;
-                                        new_poly_reduced.num_contours = 0 ;
-                                        new_poly_reduced.hole = nullptr ;
-                                        new_poly_reduced.contour = nullptr ;
-
-                                        // 1 - creates a gpc_polygon corresponding to the current primitive
-
-                                        gpc_vertex_list *new_poly_verts = new gpc_vertex_list ;
-                                        gpc_vertex_list *new_poly_reduced_verts = new gpc_vertex_list ;
-
-                                        double mx = 0.0 ;
-                                        double my = 0.0 ;
-
-                                        if(p->nbVertices() == 2)
-                                        {
-                                                new_poly_verts->num_vertices = 4 ;
-                                                new_poly_verts->vertex = new gpc_vertex[4] ;
-                                                new_poly_reduced_verts->num_vertices = 4 ;
-                                                new_poly_reduced_verts->vertex = new gpc_vertex[4] ;
-
-                                                double deps = 0.001 ;
-                                                double du = p->vertex(1).y()-p->vertex(0).y() ;
-                                                double dv = p->vertex(1).x()-p->vertex(0).x() ;
-                                                double n = sqrt(du*du+dv*dv) ;
-                                                du *= deps/n ;
-                                                dv *= deps/n ;
-                                                new_poly_verts->vertex[0].x = p->vertex(0).x() + du ;
-                                                new_poly_verts->vertex[0].y = p->vertex(0).y() + dv ;
-                                                new_poly_verts->vertex[1].x = p->vertex(1).x() + du ;
-                                                new_poly_verts->vertex[1].y = p->vertex(1).y() + dv ;
-                                                new_poly_verts->vertex[2].x = p->vertex(1).x() - du ;
-                                                new_poly_verts->vertex[2].y = p->vertex(1).y() - dv ;
-                                                new_poly_verts->vertex[3].x = p->vertex(0).x() - du ;
-                                                new_poly_verts->vertex[3].y = p->vertex(0).y() - dv ;
-
-                                                new_poly_reduced_verts->vertex[0].x = p->vertex(0).x() + du ;
-                                                new_poly_reduced_verts->vertex[0].y = p->vertex(0).y() + dv ;
-                                                new_poly_reduced_verts->vertex[1].x = p->vertex(1).x() + du ;
-                                                new_poly_reduced_verts->vertex[1].y = p->vertex(1).y() + dv ;
-                                                new_poly_reduced_verts->vertex[2].x = p->vertex(1).x() - du ;
-                                                new_poly_reduced_verts->vertex[2].y = p->vertex(1).y() - dv ;
-                                                new_poly_reduced_verts->vertex[3].x = p->vertex(0).x() - du ;
-                                                new_poly_reduced_verts->vertex[3].y = p->vertex(0).y() - dv ;
-                                        }
-                                        else
-                                        {
-                                                new_poly_verts->num_vertices = p->nbVertices() ;
-                                                new_poly_verts->vertex = new gpc_vertex[p->nbVertices()] ;
-
-                                                for(size_t i=0;i<p->nbVertices();++i)
-                                                {
-                                                        new_poly_verts->vertex[i].x = p->vertex(i).x() ;
-                                                        new_poly_verts->vertex[i].y = p->vertex(i).y() ;
-                                                        mx += p->vertex(i).x() ;
-                                                        my += p->vertex(i).y() ;
-                                                }
-                                                mx /= p->nbVertices() ;
-                                                my /= p->nbVertices() ;
-
-                                                new_poly_reduced_verts->num_vertices = p->nbVertices() ;
-                                                new_poly_reduced_verts->vertex = new gpc_vertex[p->nbVertices()] ;
-
-                                                for(size_t j=0;j<p->nbVertices();++j)
-                                                {
-                                                        new_poly_reduced_verts->vertex[j].x = mx + (p->vertex(j).x() - mx)*0.999 ;
-                                                        new_poly_reduced_verts->vertex[j].y = my + (p->vertex(j).y() - my)*0.999 ;
-                                                }
-                                        }
-                                        gpc_add_contour(&new_poly,new_poly_verts,false) ;
-                                        gpc_add_contour(&new_poly_reduced,new_poly_reduced_verts,false) ;
-
-                                        // 2 - computes the difference between this polygon, and the union of the
-                                        // 	preceeding ones.
-
-                                        gpc_polygon_clip(GPC_DIFF,&new_poly_reduced,&cumulated_union,&difference) ;
-
-                                        // 3 - checks the difference. If void, the primitive is not visible: skip it
-                                        // 	and go to next primitive.
-
-                                        if(difference.num_contours == 0)
-                                        {
-                                                ++nb_culled ;
-                                                delete p ;
-                                                primitives[pindex] = nullptr ;
-                                                continue ;
-                                        }
-
-                                        // 4 - The primitive is visible. Let's add it to the cumulated union of
-                                        // 	primitives.
-
-                                        if(p->nbVertices() > 2)
-                                        {
-                                                gpc_polygon cumulated_union_tmp ;
-                                                cumulated_union_tmp.num_contours = 0 ;
-                                                cumulated_union_tmp.hole = nullptr ;
-                                                cumulated_union_tmp.contour = nullptr ;
-
-                                                gpc_polygon_clip(GPC_UNION,&new_poly,&cumulated_union,&cumulated_union_tmp) ;
-
-                                                gpc_free_polygon(&cumulated_union) ;
-                                                cumulated_union = cumulated_union_tmp ;
-                                        }
-
-                                        gpc_free_polygon(&new_poly) ;
-                                        gpc_free_polygon(&new_poly_reduced) ;
-                                        gpc_free_polygon(&difference) ;
-#ifdef DEBUG_EPSRENDER__SHOW1
-                                        glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT) ;
-
-                                        glColor3f(1.0,0.0,0.0) ;
-
-                                        for(unsigned long i=0;i<cumulated_union.num_contours;++i)
-                                        {
-                                                glBegin(GL_LINE_LOOP) ;
-                                                for(unsigned long j=0;j<cumulated_union.contour[i].num_vertices;++j)
-                                                        glVertex2f(cumulated_union.contour[i].vertex[j].x,cumulated_union.contour[i].vertex[j].y) ;
-                                                glEnd() ;
-                                        }
-
-                                        glFlush() ;
-                                        glXSwapBuffers(glXGetCurrentDisplay(),glXGetCurrentDrawable()) ;
+        ScreenGrid grid(primitives) ;
+        vector<char> visible(primitives.size(),0) ;
+
+        long nb_cells = long(grid.nbCells()) ;
+        long batch = max(nb_cells/100,64L) ;
+
+        for(long c0=0;c0<nb_cells;c0+=batch)
+        {
+                long c1 = min(c0+batch,nb_cells) ;
+
+#pragma omp parallel for schedule(dynamic)
+                for(long c=c0;c<c1;++c)
+                        optimizeCell(primitives,grid,size_t(c),visible) ;
+
+#ifdef A_FAIRE
+                percentage_finished = c1 / (float)nb_cells ;
+#else
+                vparams.progress(c1/(float)nb_cells, QGLViewer::tr("Visibility optimization")) ;
 #endif
-                                }
-                                catch(exception& )
-                                {
-                                        ; // std::cout << "Could not treat primitive " << pindex << ": internal gpc error." << endl ;
-                                }
-                        }
+        }
+
+        int nb_culled = 0 ;
 
-                        if(nboptimised%N==0)
-                                vparams.progress(nboptimised/(float)primitives.size(), QGLViewer::tr("Visibility optimization")) ;
+        for(size_t pindex=0;pindex<primitives.size();++pindex)
+                if(primitives[pindex] != nullptr && primitives[pindex]->nbVertices() > 1 && !visible[pindex])
+                {
+                        ++nb_culled ;
+                        delete primitives[pindex] ;
+                        primitives[pindex] = nullptr ;
                 }
 
 #ifdef DEBUG_VO
         cout << nb_culled << " primitives culled over " << primitives.size() << "." << endl ;
 #endif
-
-        gpc_free_polygon(&cumulated_union) ;
 }
 
-
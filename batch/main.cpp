@@ -0,0 +1,371 @@
+/*
+ * File: main.cpp
+ *
+ * Headless batch driver: runs a scene without Qt, OpenGL nor SDL and
+ * writes the requested exports (see help_parse).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "WaterSurface.hpp"
+#include "plotter.hpp"
+#include "settings.hpp"
+#include "error.hpp"
+#include "Profiler.hpp"
+#include "SceneFile.hpp"
+#include "FrameSeries.hpp"
+
+namespace {
+
+  enum phase_t {load_, simu_, export_, nPhases};
+  const char *phase_names[nPhases] = {"load", "simulation", "export"};
+  double phase_time[nPhases] = {0, 0, 0};
+
+  class PhaseTimer {
+  private:
+    phase_t phase;
+    std::chrono::steady_clock::time_point start;
+  public:
+    PhaseTimer(phase_t p): phase(p), start(std::chrono::steady_clock::now()) {}
+    ~PhaseTimer() {
+      phase_time[phase] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+  };
+
+  std::string frameFile(const std::string &prefix, int n, const std::string &ext) {
+    std::stringstream ss;
+    ss<<prefix<<std::setw(4)<<std::setfill('0')<<n<<ext;
+    return ss.str();
+  }
+
+  void help_parse() {
+    std::cout<<"\nUsage: wd_batch [options]\n"<<std::endl;
+    std::cout<<"Options:"<<std::endl;
+    std::cout<<"     -l, -load <file>: load configuration file or binary scene (.wds)"<<std::endl;
+    std::cout<<"     -sources <file>: add the sources of a CSV (x, y, wave length, re, im) or float32 file"<<std::endl;
+    std::cout<<"     -ld, --load-default: load ./conf/default_static.conf"<<std::endl;
+    std::cout<<"     -stop <t>: number of time steps (default 100)"<<std::endl;
+    std::cout<<"     -every <k>: export every k time steps (default 1)"<<std::endl;
+    std::cout<<"     -p, -plot <prefix>: gnuplot height fields <prefix>*.dat and <prefix>_plot.txt"<<std::endl;
+    std::cout<<"     -heights <prefix>: surface grids <prefix>*.txt"<<std::endl;
+    std::cout<<"     -image <prefix>: height maps <prefix>*.png"<<std::endl;
+    std::cout<<"     -mesh <prefix>: surface meshes <prefix>*.obj (or .ply, .wdm with -mesh_format)"<<std::endl;
+    std::cout<<"     -mesh_format <obj|ply|wdm>: format of the meshes"<<std::endl;
+    std::cout<<"     -mitsuba <prefix>: surface meshes <prefix>*.serialized (Mitsuba)"<<std::endl;
+    std::cout<<"     -mitsuba_level <l>: zlib level of the Mitsuba meshes, 0 to store (default 1)"<<std::endl;
+    std::cout<<"     -ampli <prefix>: amplitude, real, imaginary parts and phase after the last step"<<std::endl;
+    std::cout<<"     -ampli_file <file>: magnitude, phase, real and imaginary parts of every wave length after the last step (.npy, or chunked container)"<<std::endl;
+    std::cout<<"     -ampli_level <l>: zlib level of the chunked container, 0 for none (default 1)"<<std::endl;
+    std::cout<<"     -series <file>: heights of the exported steps in one compressed time series (and <file>.idx)"<<std::endl;
+    std::cout<<"     -series_keyframes <k>: one keyframe every k frames of the series (default 32)"<<std::endl;
+    std::cout<<"     -series_append: continue the series if <file> exists"<<std::endl;
+    std::cout<<"     -unpack <file> <first> <last> <prefix>: write frames first to last of a series in <prefix>*.txt, and exit"<<std::endl;
+    std::cout<<"     -stream <file>: stream surface and amplitudes to <file>*.band by row bands"<<std::endl;
+    std::cout<<"     -band_budget <MB>: memory budget of the band pipeline (streaming mode)"<<std::endl;
+    std::cout<<"     -hankel_tab: evaluate the sources by interpolation in a table (see wd_validate for the accuracy)"<<std::endl;
+    std::cout<<"     -profile <file>: profile the run, writes a Chrome trace in <file>.json and a summary"<<std::endl;
+    std::cout<<"     -perf: hardware counters of the profiled zones (Linux)"<<std::endl;
+    std::cout<<"     -perf_raw <hex>: raw event counted as vector operations (default 3cc7, Intel FP_ARITH_INST_RETIRED packed)"<<std::endl;
+    std::cout<<"     -convert <in> <out>: convert a configuration file to a binary scene (.wds) or back, and exit"<<std::endl;
+    std::cout<<"     -scene <file>: write the loaded scene (binary if <file> ends with .wds)"<<std::endl;
+    std::cout<<"     -h, -help: print help\n"<<std::endl;
+    exit(0);
+  }
+
+  void check_args(int argc, int i, int n) {
+    if (argc < i + n + 1) {
+      std::cerr<<"\nERROR: wrong number of arguments\n"<<std::endl;
+      help_parse();
+    }
+  }
+
+}
+
+int main(int argc, char **argv) {
+  WaterSurface surface;
+  int stop_time = 100;
+  int every = 1;
+  bool conf = false;
+  std::string plot_file, heights_file, image_file, mesh_file, ampli_file, mitsuba_file;
+  std::string mesh_ext = ".obj";
+  std::string profile_file;
+  std::string scene_file;
+  std::string ampli_bin_file;
+  int ampli_level = 1;
+  int mitsuba_level = 1;
+  std::string series_file;
+  int series_keyframes = 32;
+  bool series_append = false;
+
+  for (int i = 1;  i < argc; ++i) {
+    std::string s(argv[i]);
+    if (s == "-l" || s == "-load") {
+      check_args(argc, i, 1);
+      std::cout<<"Loading configuration file:"<<" "<<argv[i+1]<<std::endl;
+      surface.setImportConf(argv[i+1]);
+      conf = true;
+      ++i;
+    } else if (s == "-sources") {
+      check_args(argc, i, 1);
+      surface.setImportSources(argv[i+1]);
+      ++i;
+    } else if (s == "-ld" || s == "--load-default") {
+      surface.setImportConf("./conf/default_static.conf");
+      conf = true;
+    } else if (s == "-stop") {
+      check_args(argc, i, 1);
+      stop_time = atoi(argv[i+1]);
+      ++i;
+    } else if (s == "-every") {
+      check_args(argc, i, 1);
+      every = std::max(1, atoi(argv[i+1]));
+      ++i;
+    } else if (s == "-p" || s == "-plot") {
+      check_args(argc, i, 1);
+      plot_file = argv[i+1];
+      ++i;
+    } else if (s == "-heights") {
+      check_args(argc, i, 1);
+      heights_file = argv[i+1];
+      ++i;
+    } else if (s == "-image") {
+      check_args(argc, i, 1);
+      image_file = argv[i+1];
+      ++i;
+    } else if (s == "-mesh") {
+      check_args(argc, i, 1);
+      mesh_file = argv[i+1];
+      ++i;
+    } else if (s == "-mesh_format") {
+      check_args(argc, i, 1);
+      mesh_ext = std::string(".") + argv[i+1];
+      ++i;
+    } else if (s == "-mitsuba") {
+      check_args(argc, i, 1);
+      mitsuba_file = argv[i+1];
+      ++i;
+    } else if (s == "-mitsuba_level") {
+      check_args(argc, i, 1);
+      mitsuba_level = atoi(argv[i+1]);
+      ++i;
+    } else if (s == "-ampli") {
+      check_args(argc, i, 1);
+      ampli_file = argv[i+1];
+      ++i;
+    } else if (s == "-ampli_file") {
+      check_args(argc, i, 1);
+      ampli_bin_file = argv[i+1];
+      ++i;
+    } else if (s == "-ampli_level") {
+      check_args(argc, i, 1);
+      ampli_level = atoi(argv[i+1]);
+      ++i;
+    } else if (s == "-series") {
+      check_args(argc, i, 1);
+      series_file = argv[i+1];
+      ++i;
+    } else if (s == "-series_keyframes") {
+      check_args(argc, i, 1);
+      series_keyframes = atoi(argv[i+1]);
+      ++i;
+    } else if (s == "-series_append") {
+      series_append = true;
+    } else if (s == "-unpack") {
+      check_args(argc, i, 4);
+      try {
+	FrameSeriesReader reader(argv[i+1]);
+	int first = atoi(argv[i+2]), last = std::min(atoi(argv[i+3]), reader.nbFrames() - 1);
+	std::vector<std::vector<float> > frames;
+	reader.readRange(first, last, frames);
+	Grid grid(reader.getNbRows(), reader.getNbCols(), reader.getCellSize());
+	for (int k = first; k <= last; ++k) {
+	  for (int r = 0; r < grid.getNbRows(); ++r) {
+	    for (int c = 0; c < grid.getNbCols(); ++c) {
+	      grid(r, c) = frames[k - first][(size_t)r*grid.getNbCols() + c];
+	    }
+	  }
+	  grid.invalidateNormals();
+	  std::ofstream file(frameFile(argv[i+4], reader.getTime(k), ".txt"));
+	  file<<grid;
+	}
+	std::cout<<argv[i+1]<<": "<<last - first + 1<<" of "<<reader.nbFrames()<<" frames"<<std::endl;
+      } catch (std::exception& e) {
+	std::cerr << "Exception catched : " << e.what() << std::endl;
+	return 1;
+      }
+      return 0;
+    } else if (s == "-stream") {
+      check_args(argc, i, 1);
+      std::cout<<"Streaming in "<<argv[i+1]<<std::endl;
+      surface.setStream(argv[i+1]);
+      ++i;
+    } else if (s == "-band_budget") {
+      check_args(argc, i, 1);
+      settings::band_budget_ = (size_t)atoi(argv[i+1]) << 20;
+      ++i;
+    } else if (s == "-hankel_tab") {
+      settings::hankel_tab_ = true;
+    } else if (s == "-profile") {
+      check_args(argc, i, 1);
+      profile_file = argv[i+1];
+      ++i;
+    } else if (s == "-perf") {
+      Profiler::enableCounters(true);
+    } else if (s == "-perf_raw") {
+      check_args(argc, i, 1);
+      PerfCounters::setRawEvent(strtoull(argv[i+1], NULL, 16));
+      ++i;
+    } else if (s == "-convert") {
+      check_args(argc, i, 2);
+      try {
+	Scene scene = SceneFile::defaults();
+	SceneFile::read(argv[i+1], scene);
+	SceneFile::write(argv[i+2], scene);
+	std::cout<<argv[i+2]<<": "<<scene.nbSources()<<" sources, "
+		 <<scene.wave_lengths.size()<<" wave lengths"<<std::endl;
+      } catch (std::exception& e) {
+	std::cerr << "Exception catched : " << e.what() << std::endl;
+	return 1;
+      }
+      return 0;
+    } else if (s == "-scene") {
+      check_args(argc, i, 1);
+      scene_file = argv[i+1];
+      ++i;
+    } else if (s == "-h" || s == "-help") {
+      help_parse();
+    } else {
+      std::cerr<<"\nERROR: Unknown option "<<s<<"\n"<<std::endl;
+      help_parse();
+    }
+  }
+  if (!conf) {
+    std::cerr<<"\nERROR: no configuration file\n"<<std::endl;
+    help_parse();
+  }
+
+  if (!profile_file.empty()) {
+    Profiler::setThreadName("main");
+    Profiler::enable(true);
+  }
+
+  std::ofstream stream_plot;
+  std::unique_ptr<FrameSeriesWriter> series;
+  try {
+    {
+      PhaseTimer timer(load_);
+      surface.setStopTime(stop_time + 1);
+      // loads the configuration and computes the first time step
+      surface.reset();
+      if (!scene_file.empty()) {
+	surface.exportScene(scene_file);
+      }
+    }
+    if (!plot_file.empty()) {
+      stream_plot.open(plot_file + "_plot.txt");
+      stream_plot<<"set view map\n";
+      stream_plot<<"unset key\n";
+      stream_plot<<"unset tics\n";
+      stream_plot<<"unset border\n";
+      stream_plot<<"unset colorbox\n";
+      stream_plot<<"set terminal png size 600, 600\n";
+    }
+    if (!series_file.empty()) {
+      const Grid &g = surface.getGrid();
+      ERROR(!g.isEmpty(), "The surface is not kept in streaming mode", series_file);
+      series.reset(new FrameSeriesWriter(series_file, g.getNbRows(), g.getNbCols(), g.getCellSize(),
+					 series_keyframes, 1, series_append));
+    }
+
+    for (int n = 0; n <= stop_time; ++n) {
+      Profiler::nextFrame();
+      if (n > 0) {
+	PhaseTimer timer(simu_);
+	surface.update();
+      }
+      if (n % every != 0) {
+	continue;
+      }
+      PhaseTimer timer(export_);
+      if (!plot_file.empty()) {
+	std::string dat = frameFile(plot_file, n, ".dat");
+	surface.drawHeighField(dat);
+	stream_plot<<"set output \""<<frameFile(plot_file + "_2d_", n, ".png")<<"\"\n";
+	stream_plot<<"splot '"<<dat<<"' with pm3d\n";
+      }
+      if (!heights_file.empty()) {
+	surface.exportSurfaceTime(frameFile(heights_file, n, ".txt"));
+      }
+      if (!image_file.empty()) {
+	Plotter::exportHeightMap(frameFile(image_file, n, ".png"), &surface,
+				 settings::n_rows_, settings::n_cols_);
+      }
+      if (!mesh_file.empty()) {
+	surface.exportMesh(frameFile(mesh_file, n, mesh_ext));
+      }
+      if (!mitsuba_file.empty()) {
+	surface.exportMitsuba(frameFile(mitsuba_file, n, ".serialized"), mitsuba_level);
+      }
+      if (series) {
+	series->append(surface.getGrid().data(), n);
+      }
+    }
+
+    if (!ampli_file.empty()) {
+      PhaseTimer timer(export_);
+      surface.exportAmplitude(ampli_file + "_ampli.txt");
+      surface.exportAmplitudeRe(ampli_file + "_re.txt");
+      surface.exportAmplitudeIm(ampli_file + "_im.txt");
+      surface.exportPhase(ampli_file + "_phase.txt");
+    }
+    if (!ampli_bin_file.empty()) {
+      PhaseTimer timer(export_);
+      surface.exportAmplitudes(ampli_bin_file, ampli_level);
+    }
+  } catch (std::exception& e) {
+    std::cerr << "Exception catched : " << e.what() << std::endl;
+    return 1;
+  }
+  if (stream_plot.is_open()) {
+    stream_plot.close();
+  }
+
+  std::cout<<"\nTimings ("<<stop_time<<" steps, "<<settings::n_rows_<<" x "<<settings::n_cols_<<"):"<<std::endl;
+  for (int p = 0; p < nPhases; ++p) {
+    std::cout<<"  "<<std::setw(12)<<std::left<<phase_names[p]<<std::right
+	     <<std::setw(10)<<std::fixed<<std::setprecision(3)<<phase_time[p]<<" s";
+    if (p == simu_ && stop_time > 0) {
+      std::cout<<"  ("<<1e3*phase_time[p]/stop_time<<" ms/step)";
+    }
+    std::cout<<std::endl;
+  }
+  if (!profile_file.empty()) {
+    // closes the last frame
+    Profiler::nextFrame();
+    Profiler::enable(false);
+    Profiler::writeTrace(profile_file + ".json");
+    std::cout<<"\nProfile ("<<profile_file<<".json):"<<std::endl;
+    Profiler::summary(std::cout);
+  }
+  return 0;
+}
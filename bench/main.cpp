@@ -0,0 +1,461 @@
+/*
+ * File: main.cpp
+ *
+ * Benchmarks of the synthesis and solve paths: micro benchmarks of the
+ * source evaluation and of the grid accessors, macro benchmarks of the
+ * surface update, vertex generation, exporters and WaveDraw solve. Every
+ * benchmark is swept over grid size, source count, wave length count and
+ * thread count, one result per line in CSV or JSON (see help_parse).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <omp.h>
+
+#include "WaterSurface.hpp"
+#include "EquivalentSource.hpp"
+#include "Grid.hpp"
+#include "plotter.hpp"
+#include "wavedraw.hpp"
+#include "settings.hpp"
+#include "error.hpp"
+
+namespace {
+
+  struct Config {
+    int grid, sources, wl, threads;
+  };
+
+  typedef std::function<void()> bench_t;
+
+  // results
+  std::ostream *out = NULL;
+  bool json = false;
+  std::string filter;
+  bool run_micro = true, run_macro = true;
+
+  // repetitions: at least min_reps and min_time seconds, at most max_reps
+  int min_reps = 3, max_reps = 1000;
+  double min_time = 0.2;
+
+  // keeps the micro benchmarks from being optimized out
+  volatile FLOAT sink = 0;
+
+  // swallows the output of the library while benchmarking
+  class NullBuffer: public std::streambuf {
+  protected:
+    int overflow(int c) {return c;}
+  };
+
+  void help_parse() {
+    std::cout<<"\nUsage: wd_bench [options]\n"<<std::endl;
+    std::cout<<"Options:"<<std::endl;
+    std::cout<<"     -grid <n,...>: grid sizes n x n (default 200,400)"<<std::endl;
+    std::cout<<"     -sources <n,...>: source counts of the macro benchmarks (default 1,8)"<<std::endl;
+    std::cout<<"     -wl <n,...>: wave length counts of the macro benchmarks (default 1,3)"<<std::endl;
+    std::cout<<"     -threads <n,...>: thread counts (default 1 and the number of cores)"<<std::endl;
+    std::cout<<"     -micro, -macro: only run the micro or the macro benchmarks"<<std::endl;
+    std::cout<<"     -filter <str>: only run the benchmarks whose name contains str"<<std::endl;
+    std::cout<<"     -reps <min> <max>: repetitions of each benchmark (default 3 1000)"<<std::endl;
+    std::cout<<"     -min_time <s>: minimum time spent in each benchmark (default 0.2)"<<std::endl;
+    std::cout<<"     -o <file>: write the results in file (default standard output)"<<std::endl;
+    std::cout<<"     -format <csv|json>: comma separated values or one JSON object per line (default csv)"<<std::endl;
+    std::cout<<"     -dir <dir>: directory of the scenes and exported files (default a temporary directory)"<<std::endl;
+    std::cout<<"     -v, -verbose: keep the output of the simulation"<<std::endl;
+    std::cout<<"     -h, -help: print help\n"<<std::endl;
+    exit(0);
+  }
+
+  void check_args(int argc, int i, int n) {
+    if (argc < i + n + 1) {
+      std::cerr<<"\nERROR: wrong number of arguments\n"<<std::endl;
+      help_parse();
+    }
+  }
+
+  std::vector<int> parseList(const std::string &s) {
+    std::vector<int> l;
+    std::stringstream ss(s);
+    std::string item;
+    while (getline(ss, item, ',')) {
+      int v = atoi(item.c_str());
+      if (v > 0) {
+	l.push_back(v);
+      }
+    }
+    if (l.empty()) {
+      std::cerr<<"\nERROR: invalid list "<<s<<"\n"<<std::endl;
+      help_parse();
+    }
+    return l;
+  }
+
+  void writeHeader() {
+    if (!json) {
+      *out<<"bench,grid,sources,wavelengths,threads,reps,min_ms,median_ms,mean_ms,stddev_ms,items_per_s"<<std::endl;
+    }
+  }
+
+  void writeResult(const std::string &name, const Config &c, std::vector<double> &times, double items) {
+    std::sort(times.begin(), times.end());
+    size_t n = times.size();
+    double median = n % 2 ? times[n/2] : 0.5*(times[n/2 - 1] + times[n/2]);
+    double mean = 0, var = 0;
+    for (double t : times) {
+      mean += t;
+    }
+    mean /= n;
+    for (double t : times) {
+      var += (t - mean)*(t - mean);
+    }
+    double stddev = n > 1 ? std::sqrt(var/(n - 1)) : 0;
+    double rate = median > 0 ? items/median : 0;
+    std::ostream &os = *out;
+    os<<std::setprecision(6);
+    if (json) {
+      os<<"{\"bench\": \""<<name<<"\", \"grid\": "<<c.grid<<", \"sources\": "<<c.sources
+	<<", \"wavelengths\": "<<c.wl<<", \"threads\": "<<c.threads<<", \"reps\": "<<n
+	<<", \"min_ms\": "<<1e3*times[0]<<", \"median_ms\": "<<1e3*median<<", \"mean_ms\": "<<1e3*mean
+	<<", \"stddev_ms\": "<<1e3*stddev<<", \"items_per_s\": "<<rate<<"}"<<std::endl;
+    } else {
+      os<<name<<","<<c.grid<<","<<c.sources<<","<<c.wl<<","<<c.threads<<","<<n<<","
+	<<1e3*times[0]<<","<<1e3*median<<","<<1e3*mean<<","<<1e3*stddev<<","<<rate<<std::endl;
+    }
+  }
+
+  /* Times f (after a warm up run) until it has been repeated min_reps
+     times and min_time seconds have elapsed. <prepare> is called before
+     each run and is not timed. <items> is the work of one run, used for
+     the throughput. */
+  void run(const std::string &name, const Config &c, double items, bench_t f, bench_t prepare = bench_t()) {
+    if (!filter.empty() && name.find(filter) == std::string::npos) {
+      return;
+    }
+    omp_set_num_threads(c.threads);
+    std::vector<double> times;
+    double total = 0;
+    for (int r = -1; r < max_reps && (r < min_reps || total < min_time); ++r) {
+      if (prepare) {
+	prepare();
+      }
+      auto start = std::chrono::steady_clock::now();
+      f();
+      double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      if (r >= 0) {
+	times.push_back(t);
+	total += t;
+      }
+    }
+    writeResult(name, c, times, items);
+  }
+
+  /* Scene of c.sources sources emitting at c.wl wave lengths on a c.grid
+     grid, the sources are placed at random (always the same) */
+  void writeScene(const std::string &file, const Config &c) {
+    std::ofstream os(file);
+    ERROR(os.good(), "Cannot open file "<<file, "");
+    FLOAT cs = 0.05;
+    FLOAT step = 1.5;
+    FLOAT max = c.wl > 1 ? (FLOAT)(std::pow(step, c.wl - 1)*(1 - 1e-3)) : 1;
+    os<<"<gravity> 9.81\n<damping> 0.000\n<ampli> 1\n";
+    os<<"<grid>\n<size> "<<c.grid<<" "<<c.grid<<"\n<cell_size> "<<cs<<"\n</grid>\n";
+    os<<"<wave_lenghts>\n<min> 1\n<max> "<<max<<"\n<step> "<<step<<"\n</wave_lenghts>\n";
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<FLOAT> pos(0.1*c.grid*cs, 0.9*c.grid*cs);
+    os<<"<wave>\n";
+    for (int s = 0; s < c.sources; ++s) {
+      FLOAT x = pos(gen), y = pos(gen);
+      os<<"<source_all>\n<pos> "<<x<<" "<<y<<"\n</source_all>\n";
+    }
+    os<<"</wave>\n";
+  }
+
+  void loadScene(WaterSurface &surface, const Config &c) {
+    writeScene("bench_scene.conf", c);
+    surface.setImportConf("bench_scene.conf");
+    surface.reset();
+  }
+
+  /* Source evaluation and grid accessors at every node of a c.grid grid */
+  void micro(const Config &c) {
+    int n = c.grid;
+    FLOAT cs = 0.05;
+    double items = (double)n*n;
+    EquivalentSource source(1.0);
+    source.setPos(0.5*n*cs + 0.01, 0.5*n*cs + 0.01);
+    source.setAmplitude(COMPLEX(1, 0));
+
+    run("heightc", c, items, [&]() {
+	FLOAT acc = 0;
+#pragma omp parallel for reduction(+:acc)
+	for (int i = 0; i < n; ++i) {
+	  for (int j = 0; j < n; ++j) {
+	    acc += real(source.heightc(cs*i, cs*j, 0));
+	  }
+	}
+	sink = acc;
+      });
+    run("gradHeightc", c, items, [&]() {
+	FLOAT acc = 0;
+#pragma omp parallel for reduction(+:acc)
+	for (int i = 0; i < n; ++i) {
+	  for (int j = 0; j < n; ++j) {
+	    acc += real(source.gradHeightc(cs*i, cs*j, 0)(0));
+	  }
+	}
+	sink = acc;
+      });
+    run("Hankel", c, items, [&]() {
+	FLOAT acc = 0;
+	FLOAT dx = 100.0/items;
+#pragma omp parallel for reduction(+:acc)
+	for (int i = 0; i < n*n; ++i) {
+	  acc += real(settings::Hankel(dx*(i + 1)));
+	}
+	sink = acc;
+      });
+
+    Grid g(n, n, cs);
+    const Grid &cg = g;
+    run("grid_write", c, items, [&]() {
+#pragma omp parallel for
+	for (int i = 0; i < n; ++i) {
+	  for (int j = 0; j < n; ++j) {
+	    g(i, j) = i + j;
+	  }
+	}
+      });
+    run("grid_read", c, items, [&]() {
+	FLOAT acc = 0;
+#pragma omp parallel for reduction(+:acc)
+	for (int i = 0; i < n; ++i) {
+	  for (int j = 0; j < n; ++j) {
+	    acc += cg(i, j);
+	  }
+	}
+	sink = acc;
+      });
+    run("grid_data", c, items, [&]() {
+	FLOAT acc = 0;
+	const FLOAT *d = cg.data();
+#pragma omp parallel for reduction(+:acc)
+	for (int i = 0; i < n*n; ++i) {
+	  acc += d[i];
+	}
+	sink = acc;
+      });
+  }
+
+  /* Surface update, vertex generation and exporters of one scene */
+  void macro(WaterSurface &surface, const Config &c) {
+    double nodes = (double)c.grid*c.grid;
+    double evals = nodes*c.sources*c.wl;
+
+    run("setAmpli", c, evals, [&]() {surface.setAmpli(0.1);});
+    run("updateHeight", c, evals, [&]() {surface.updateHeight();});
+    run("refreshHeight", c, evals, [&]() {surface.refreshHeight();});
+
+    // what Grid::draw uploads: normals of the new heights and mesh vertices
+    Grid g = surface.getGrid();
+    run("vertices", c, nodes, [&]() {
+	g.invalidateNormals();
+	g.computeNormals();
+	std::vector<VEC3> v = g.meshVertices();
+	sink = v[0](2);
+      });
+
+    run("export_obj", c, nodes, [&]() {surface.exportMesh("bench.obj");});
+    run("export_ply", c, nodes, [&]() {surface.exportMesh("bench.ply");});
+    run("export_wdm", c, nodes, [&]() {surface.exportMesh("bench.wdm");});
+    run("export_mitsuba", c, nodes, [&]() {surface.exportMitsuba("bench.serialized");});
+    run("export_png", c, nodes, [&]() {
+	Plotter::exportHeightMap("bench.png", &surface, settings::n_rows_, settings::n_cols_);
+      });
+    run("export_dat", c, nodes, [&]() {surface.drawHeighField("bench.dat");});
+    run("export_bin", c, nodes, [&]() {
+	Plotter::writeBinary("bench.bin", g.data(), g.getNbRows(), g.getNbCols());
+      });
+    run("export_ampli", c, nodes*c.wl, [&]() {surface.exportAmplitude("bench_ampli.txt");});
+    run("export_ampli_npy", c, nodes*c.wl, [&]() {surface.exportAmplitudes("bench_ampli.npy");});
+    run("export_ampli_wda", c, nodes*c.wl, [&]() {surface.exportAmplitudes("bench_ampli.wda");});
+  }
+
+  /* WaveDraw: two constraints solved on a fresh scene without sources,
+     which adds two sources */
+  void wavedraw(WaterSurface &surface, const Config &c) {
+    FLOAT size = c.grid*settings::cell_size_;
+    run("setAmplisFromConstr", c, (double)c.grid*c.grid*2, [&]() {
+	WaveDraw::setAmplisFromConstr(&surface);
+      }, [&]() {
+	loadScene(surface, Config{c.grid, 0, 1, c.threads});
+	surface.addConstPoint(VEC3(0.4*size, 0.5*size, 0.5));
+	surface.addConstPoint(VEC3(0.6*size, 0.5*size, -0.5));
+      });
+  }
+
+}
+
+int main(int argc, char **argv) {
+  std::vector<int> grids = {200, 400};
+  std::vector<int> sources = {1, 8};
+  std::vector<int> wls = {1, 3};
+  std::vector<int> threads = {1};
+  if (omp_get_max_threads() > 1) {
+    threads.push_back(omp_get_max_threads());
+  }
+  std::string out_file, format = "csv", dir;
+  bool verbose = false;
+
+  for (int i = 1;  i < argc; ++i) {
+    std::string s(argv[i]);
+    if (s == "-grid") {
+      check_args(argc, i, 1);
+      grids = parseList(argv[i+1]);
+      ++i;
+    } else if (s == "-sources") {
+      check_args(argc, i, 1);
+      sources = parseList(argv[i+1]);
+      ++i;
+    } else if (s == "-wl") {
+      check_args(argc, i, 1);
+      wls = parseList(argv[i+1]);
+      ++i;
+    } else if (s == "-threads") {
+      check_args(argc, i, 1);
+      threads = parseList(argv[i+1]);
+      ++i;
+    } else if (s == "-micro") {
+      run_macro = false;
+    } else if (s == "-macro") {
+      run_micro = false;
+    } else if (s == "-filter") {
+      check_args(argc, i, 1);
+      filter = argv[i+1];
+      ++i;
+    } else if (s == "-reps") {
+      check_args(argc, i, 2);
+      min_reps = std::max(1, atoi(argv[i+1]));
+      max_reps = std::max(min_reps, atoi(argv[i+2]));
+      i += 2;
+    } else if (s == "-min_time") {
+      check_args(argc, i, 1);
+      min_time = atof(argv[i+1]);
+      ++i;
+    } else if (s == "-o") {
+      check_args(argc, i, 1);
+      out_file = argv[i+1];
+      ++i;
+    } else if (s == "-format") {
+      check_args(argc, i, 1);
+      format = argv[i+1];
+      if (format != "csv" && format != "json") {
+	std::cerr<<"\nERROR: unknown format "<<format<<"\n"<<std::endl;
+	help_parse();
+      }
+      ++i;
+    } else if (s == "-dir") {
+      check_args(argc, i, 1);
+      dir = argv[i+1];
+      ++i;
+    } else if (s == "-v" || s == "-verbose") {
+      verbose = true;
+    } else if (s == "-h" || s == "-help") {
+      help_parse();
+    } else {
+      std::cerr<<"\nERROR: Unknown option "<<s<<"\n"<<std::endl;
+      help_parse();
+    }
+  }
+  json = format == "json";
+
+  namespace fs = std::filesystem;
+  std::ofstream file;
+  std::ostream results(std::cout.rdbuf());
+  out = &results;
+  if (!out_file.empty()) {
+    file.open(fs::absolute(out_file));
+    if (!file.good()) {
+      std::cerr<<"\nERROR: cannot open "<<out_file<<"\n"<<std::endl;
+      return 1;
+    }
+    out = &file;
+  }
+
+  // the scenes and exported files are written in the work directory
+  bool tmp_dir = dir.empty();
+  fs::path work = tmp_dir ? fs::temp_directory_path()/("wd_bench_" + std::to_string(std::random_device()())) : fs::path(dir);
+  fs::path cwd = fs::current_path();
+  fs::create_directories(work);
+  fs::current_path(work);
+
+  NullBuffer null_buffer;
+  std::streambuf *cout_buffer = std::cout.rdbuf();
+  if (!verbose) {
+    std::cout.rdbuf(&null_buffer);
+  }
+
+  int ret = 0;
+  try {
+    settings::doLoadTexture = false;
+    settings::createTabs();
+    writeHeader();
+    if (run_micro) {
+      for (int g : grids) {
+	for (int t : threads) {
+	  micro(Config{g, 1, 1, t});
+	}
+      }
+    }
+    if (run_macro) {
+      WaterSurface surface;
+      surface.setStopTime(1 << 30);
+      for (int g : grids) {
+	for (int s : sources) {
+	  for (int w : wls) {
+	    loadScene(surface, Config{g, s, w, 1});
+	    for (int t : threads) {
+	      macro(surface, Config{g, s, w, t});
+	    }
+	  }
+	}
+	for (int t : threads) {
+	  wavedraw(surface, Config{g, 2, 1, t});
+	}
+      }
+    }
+  } catch (std::exception& e) {
+    std::cerr << "Exception catched : " << e.what() << std::endl;
+    ret = 1;
+  }
+
+  std::cout.rdbuf(cout_buffer);
+  fs::current_path(cwd);
+  if (tmp_dir) {
+    fs::remove_all(work);
+  }
+  return ret;
+}
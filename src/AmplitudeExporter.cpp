@@ -0,0 +1,150 @@
+#include "AmplitudeExporter.hpp"
+#include "Deflate.hpp"
+#include "Profiler.hpp"
+#include "error.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <sstream>
+#include <omp.h>
+
+AmplitudeExporter::AmplitudeExporter(const std::vector<Grid> &re, const std::vector<Grid> &im,
+				     const std::vector<FLOAT> &wl):
+  ampli_re(re), ampli_im(im), wave_lengths(wl) {
+  n_rows = re.empty() ? 0 : re[0].getNbRows();
+  n_cols = re.empty() ? 0 : re[0].getNbCols();
+  cell_size = re.empty() ? 0 : re[0].getCellSize();
+  chunk_rows = 64;
+  level = 1;
+}
+
+void AmplitudeExporter::setChunkRows(int r) {
+  chunk_rows = std::max(1, r);
+}
+
+/* zlib level of the chunks, 0 to store them uncompressed (always for .npy) */
+void AmplitudeExporter::setLevel(int l) {
+  level = std::max(0, std::min(9, l));
+}
+
+/* Channels of rows [r0, r1) of wave length w; the magnitude comes from the
+   squared modulus, 20 log10(|a|/0.001) = 10 log10(|a|^2) + 60 */
+void AmplitudeExporter::channels(int w, int r0, int r1, std::vector<float> &out) const {
+  size_t first = (size_t)r0*n_cols, n = (size_t)(r1 - r0)*n_cols;
+  const FLOAT *re = ampli_re[w].data() + first;
+  const FLOAT *im = ampli_im[w].data() + first;
+  out.resize(nChannels_*n);
+  float *o = out.data();
+  for (size_t k = 0; k < n; ++k) {
+    float a = re[k], b = im[k];
+    o[nChannels_*k + DB_] = 10.0f*std::log10(a*a + b*b) + 60.0f;
+    o[nChannels_*k + PHASE_] = std::atan2(b, a);
+    o[nChannels_*k + RE_] = a;
+    o[nChannels_*k + IM_] = b;
+  }
+}
+
+/* NPY format 1.0, little endian float32, header padded to 64 bytes */
+void AmplitudeExporter::writeNpyHeader(std::ostream &os) const {
+  std::stringstream ss;
+  ss<<"{'descr': '<f4', 'fortran_order': False, 'shape': ("
+    <<wave_lengths.size()<<", "<<n_rows<<", "<<n_cols<<", "<<(int)nChannels_<<"), }";
+  std::string dict = ss.str();
+  size_t len = 10 + dict.size() + 1;
+  dict.append((64 - len%64)%64, ' ');
+  dict += '\n';
+  uint16_t dict_len = dict.size();
+  os.write("\x93NUMPY\x01\x00", 8);
+  os.write((const char*)&dict_len, sizeof(dict_len));
+  os.write(dict.data(), dict.size());
+}
+
+/* The chunks are computed (and compressed) by batches in parallel, then
+   written in order */
+void AmplitudeExporter::write(std::string file) const {
+  PROFILE_ZONE("AmplitudeExporter::write");
+  VERBOSE(1, "Exporting amplitudes: "<<file);
+  bool npy = file.size() > 4 && file.compare(file.size() - 4, 4, ".npy") == 0;
+  bool compress = !npy && level > 0;
+  int nb_wl = wave_lengths.size();
+  int bands = (n_rows + chunk_rows - 1)/chunk_rows;
+  int n_chunks = nb_wl*bands;
+
+  std::ofstream os(file.c_str(), std::ios::binary);
+  ERROR(os.good(), "Cannot open file "<<file, "");
+  std::streampos index_field = 0;
+  if (npy) {
+    writeNpyHeader(os);
+  } else {
+    int32_t header[6] = {nb_wl, n_rows, n_cols, nChannels_, chunk_rows, compress ? 1 : 0};
+    float cs = cell_size;
+    int32_t zero = 0;
+    uint64_t index_offset = 0;
+    os.write("WDAMPL01", 8);
+    os.write((const char*)header, sizeof(header));
+    os.write((const char*)&cs, sizeof(cs));
+    os.write((const char*)&zero, sizeof(zero));
+    index_field = os.tellp();
+    os.write((const char*)&index_offset, sizeof(index_offset));
+    std::vector<float> wl(wave_lengths.begin(), wave_lengths.end());
+    os.write((const char*)wl.data(), wl.size()*sizeof(float));
+  }
+
+  std::vector<uint64_t> index(2*n_chunks);
+  int batch = 4*omp_get_max_threads();
+  std::vector<std::vector<float> > values(batch);
+  std::vector<std::vector<unsigned char> > packed(batch);
+  // first exception of a batch (Deflate::zlib may throw), thrown again
+  // once its parallel loop is done
+  std::exception_ptr error;
+  for (int b0 = 0; b0 < n_chunks; b0 += batch) {
+    int b1 = std::min(n_chunks, b0 + batch);
+#pragma omp parallel for schedule(dynamic)
+    for (int c = b0; c < b1; ++c) {
+      try {
+	int w = c/bands, r0 = (c%bands)*chunk_rows;
+	channels(w, r0, std::min(n_rows, r0 + chunk_rows), values[c - b0]);
+	if (compress) {
+	  size_t n = values[c - b0].size();
+	  const unsigned char *bytes = (const unsigned char*)values[c - b0].data();
+	  std::vector<unsigned char> shuffled(n*sizeof(float));
+	  for (size_t b = 0; b < sizeof(float); ++b) {
+	    for (size_t k = 0; k < n; ++k) {
+	      shuffled[b*n + k] = bytes[k*sizeof(float) + b];
+	    }
+	  }
+	  packed[c - b0].clear();
+	  Deflate::zlib(shuffled.data(), shuffled.size(), packed[c - b0], level);
+	}
+      } catch (...) {
+#pragma omp critical(amplitude_error)
+	if (!error) {
+	  error = std::current_exception();
+	}
+      }
+    }
+    if (error) {
+      std::rethrow_exception(error);
+    }
+    for (int c = b0; c < b1; ++c) {
+      const char *data = compress ? (const char*)packed[c - b0].data() : (const char*)values[c - b0].data();
+      size_t size = compress ? packed[c - b0].size() : values[c - b0].size()*sizeof(float);
+      index[2*c] = os.tellp();
+      index[2*c + 1] = size;
+      os.write(data, size);
+    }
+  }
+
+  if (!npy) {
+    uint64_t index_offset = os.tellp();
+    os.write((const char*)index.data(), index.size()*sizeof(uint64_t));
+    os.seekp(index_field);
+    os.write((const char*)&index_offset, sizeof(index_offset));
+  }
+  ERROR(os.good(), "Error while writing "<<file, "");
+  os.close();
+}
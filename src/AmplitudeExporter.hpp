@@ -0,0 +1,54 @@
+#ifndef AMPLITUDEEXPORTER_HPP
+#define AMPLITUDEEXPORTER_HPP
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include "Grid.hpp"
+
+/*
+ * Writes the complex amplitude of every wave length as 4 float32 channels
+ * per node, computed in one parallel pass by bands of rows: magnitude in
+ * dB (20 log10(|a|/0.001)), phase (atan2, -pi to pi), real and imaginary
+ * parts. The channels are interleaved, nodes are row major.
+ *
+ * - .npy: NumPy array of shape (nb_wl, n_rows, n_cols, 4);
+ * - otherwise a chunked container: "WDAMPL01", int32 nb_wl, n_rows, n_cols,
+ *   n_channels, chunk_rows, compression (0: none, 1: zlib), float32
+ *   cell_size, int32 0, uint64 offset of the index, float32 wave lengths,
+ *   the chunks (chunk_rows rows of one wave length), then the index:
+ *   uint64 offset and size of each chunk, wave length major. A compressed
+ *   chunk is the zlib stream of its bytes shuffled by position in the
+ *   float (the first bytes of all the values, then the second ones...),
+ *   which groups the exponents.
+ */
+class AmplitudeExporter {
+public:
+  enum channel_t {DB_ = 0,
+		  PHASE_,
+		  RE_,
+		  IM_,
+		  nChannels_};
+
+private:
+  const std::vector<Grid> &ampli_re, &ampli_im;
+  const std::vector<FLOAT> &wave_lengths;
+  int n_rows, n_cols;
+  FLOAT cell_size;
+  int chunk_rows;
+  int level;
+
+  void channels(int w, int r0, int r1, std::vector<float> &out) const;
+  void writeNpyHeader(std::ostream &os) const;
+
+public:
+  AmplitudeExporter(const std::vector<Grid> &re, const std::vector<Grid> &im,
+		    const std::vector<FLOAT> &wl);
+
+  void setChunkRows(int r);
+  void setLevel(int l);
+
+  void write(std::string file) const;
+};
+
+#endif
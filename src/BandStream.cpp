@@ -0,0 +1,86 @@
+#include "BandStream.hpp"
+#include "error.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+BandStream::BandStream(std::string file_name, int nr, int nc, int nch, int br) {
+  n_rows = nr;
+  n_cols = nc;
+  n_channels = nch;
+  band_rows = std::max(1, std::min(br, nr));
+  next_row = 0;
+  current = 0;
+  write_error = false;
+
+  file = std::fopen(file_name.c_str(), "wb");
+  ERROR(file != NULL, "Cannot open file "<<file_name, "");
+
+  int32_t header[4] = {n_rows, n_cols, n_channels, band_rows};
+  std::fwrite("WDBAND01", 1, 8, file);
+  std::fwrite(header, sizeof(int32_t), 4, file);
+
+  size_t band_size = (size_t)band_rows*n_cols*n_channels;
+  buffers[0] = std::vector<float>(band_size);
+  buffers[1] = std::vector<float>(band_size);
+}
+
+BandStream::~BandStream() {
+  wait();
+  if (file != NULL) {
+    std::fclose(file);
+  }
+}
+
+/* Number of rows per band so that the two band buffers plus <workspace>
+   bytes of per-row scratch memory fit in <budget> bytes. */
+int BandStream::bandRows(int nc, int nch, int workspace, size_t budget) {
+  size_t row_bytes = 2*(size_t)nc*nch*sizeof(float) + (size_t)workspace;
+  return std::max((size_t)1, budget/row_bytes);
+}
+
+int BandStream::getBandRows() const {
+  return band_rows;
+}
+
+int BandStream::getNextRow() const {
+  return next_row;
+}
+
+bool BandStream::done() const {
+  return next_row >= n_rows;
+}
+
+float *BandStream::band() {
+  return buffers[current].data();
+}
+
+void BandStream::wait() {
+  if (writer.joinable()) {
+    writer.join();
+  }
+}
+
+void BandStream::submit(int rows) {
+  ERROR(rows > 0 && rows <= band_rows && next_row + rows <= n_rows,
+	"BandStream: invalid band size "<<rows, "");
+  wait();
+  int b = current;
+  size_t n = (size_t)rows*n_cols*n_channels;
+  writer = std::thread([this, b, n]() {
+      if (std::fwrite(buffers[b].data(), sizeof(float), n, file) != n) {
+	write_error = true;
+      }
+    });
+  current = 1 - current;
+  next_row += rows;
+}
+
+void BandStream::close() {
+  wait();
+  ERROR(next_row == n_rows, "BandStream: only "<<next_row<<" of "<<n_rows<<" rows written", "");
+  ERROR(!write_error, "BandStream: write error", "");
+  std::fclose(file);
+  file = NULL;
+}
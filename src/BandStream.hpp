@@ -0,0 +1,47 @@
+#ifndef BANDSTREAM_HPP
+#define BANDSTREAM_HPP
+
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Writes a n_rows x n_cols field (n_channels float values per node, row major,
+ * channels interleaved) to a binary file one band of rows at a time.
+ * Two band buffers are used: while one is written to disk by a background
+ * thread, the caller fills the other one.
+ *
+ * File layout: "WDBAND01", then int32 n_rows, n_cols, n_channels, band_rows,
+ * then the raw float32 data.
+ */
+class BandStream {
+private:
+  int n_rows, n_cols, n_channels;
+  int band_rows;
+  int next_row;
+
+  std::FILE *file;
+  std::vector<float> buffers[2];
+  int current;
+  std::thread writer;
+  bool write_error;
+
+  void wait();
+
+public:
+  BandStream(std::string file_name, int nr, int nc, int nch, int br);
+  ~BandStream();
+
+  static int bandRows(int nc, int nch, int workspace, size_t budget);
+
+  int getBandRows() const;
+  int getNextRow() const;
+  bool done() const;
+
+  float *band();
+  void submit(int rows);
+  void close();
+};
+
+#endif
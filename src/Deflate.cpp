@@ -0,0 +1,97 @@
+#include "Deflate.hpp"
+#include "error.hpp"
+
+#include <algorithm>
+#include <exception>
+#include <omp.h>
+
+namespace {
+
+  const size_t dict_size = 32768;
+
+  /* Compresses data[begin, end) as raw deflate, with the preceding 32 kB
+     as dictionary; ends with Z_FINISH if last, with Z_SYNC_FLUSH otherwise */
+  void deflateStrip(const unsigned char *data, size_t begin, size_t end, bool last,
+		    int level, std::vector<unsigned char> &out) {
+    z_stream strm;
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    ERROR(deflateInit2(&strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK,
+	  "Deflate: cannot initialize zlib", "");
+    if (begin > 0) {
+      size_t dict = std::min(begin, dict_size);
+      deflateSetDictionary(&strm, data + begin - dict, dict);
+    }
+    // a sync flush adds at most 5 bytes (empty stored block) to the bound
+    out.resize(deflateBound(&strm, end - begin) + 16);
+    strm.next_in = (Bytef*) data + begin;
+    strm.avail_in = end - begin;
+    strm.next_out = out.data();
+    strm.avail_out = out.size();
+    int ret = deflate(&strm, last ? Z_FINISH : Z_SYNC_FLUSH);
+    out.resize(out.size() - strm.avail_out);
+    deflateEnd(&strm);
+    ERROR(ret == (last ? Z_STREAM_END : Z_OK) && strm.avail_in == 0,
+	  "Deflate: compression failed", ret);
+  }
+
+}
+
+void Deflate::raw(const unsigned char *data, size_t size, std::vector<unsigned char> &out,
+		  bool last, uLong *adler, int level, size_t strip) {
+  strip = std::max(strip, dict_size);
+  size_t n_strips = std::max((size_t)1, (size_t)((size + strip - 1)/strip));
+  std::vector<std::vector<unsigned char> > strips(n_strips);
+  std::vector<uLong> sums(n_strips);
+  // an exception must not leave the parallel region: the first one is
+  // kept and thrown again once all the strips are done
+  std::exception_ptr error;
+#pragma omp parallel for schedule(dynamic, 1)
+  for (size_t s = 0; s < n_strips; ++s) {
+    try {
+      size_t begin = s*strip, end = std::min(size, begin + strip);
+      deflateStrip(data, begin, end, last && s == n_strips - 1, level, strips[s]);
+      if (adler != NULL) {
+	sums[s] = adler32(adler32(0L, Z_NULL, 0), data + begin, end - begin);
+      }
+    } catch (...) {
+#pragma omp critical(deflate_error)
+      if (!error) {
+	error = std::current_exception();
+      }
+    }
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  size_t total = out.size();
+  for (size_t s = 0; s < n_strips; ++s) {
+    total += strips[s].size();
+  }
+  out.reserve(total);
+  for (size_t s = 0; s < n_strips; ++s) {
+    out.insert(out.end(), strips[s].begin(), strips[s].end());
+  }
+  if (adler != NULL) {
+    uLong a = sums[0];
+    for (size_t s = 1; s < n_strips; ++s) {
+      size_t begin = s*strip, end = std::min(size, begin + strip);
+      a = adler32_combine(a, sums[s], end - begin);
+    }
+    *adler = a;
+  }
+}
+
+void Deflate::zlib(const unsigned char *data, size_t size, std::vector<unsigned char> &out,
+		   int level, size_t strip) {
+  // 32K window, deflate, default level: 0x78 0x9c (header checksum included)
+  out.push_back(0x78);
+  out.push_back(0x9c);
+  uLong adler;
+  raw(data, size, out, true, &adler, level, strip);
+  out.push_back((adler >> 24) & 0xff);
+  out.push_back((adler >> 16) & 0xff);
+  out.push_back((adler >> 8) & 0xff);
+  out.push_back(adler & 0xff);
+}
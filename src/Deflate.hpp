@@ -0,0 +1,32 @@
+#ifndef DEFLATE_HPP
+#define DEFLATE_HPP
+
+#include <cstddef>
+#include <vector>
+#include <zlib.h>
+
+/*
+ * Parallel deflate compression (same scheme as pigz): the input is cut into
+ * strips compressed independently, each one primed with the last 32 kB of
+ * the previous strip as dictionary and ended by a sync flush, so that the
+ * compressed strips simply concatenate into one valid stream. The adler32
+ * checksums of the strips are computed in parallel too and merged with
+ * adler32_combine.
+ */
+class Deflate {
+public:
+  static const size_t default_strip = 1 << 18;
+
+  // raw deflate stream (RFC 1951); if last is false the stream ends with a
+  // sync flush and can be followed by another one. adler (if not NULL)
+  // receives the adler32 checksum of the input
+  static void raw(const unsigned char *data, size_t size, std::vector<unsigned char> &out,
+		  bool last = true, uLong *adler = NULL,
+		  int level = Z_DEFAULT_COMPRESSION, size_t strip = default_strip);
+
+  // zlib stream (RFC 1950): header, raw deflate stream and adler32
+  static void zlib(const unsigned char *data, size_t size, std::vector<unsigned char> &out,
+		   int level = Z_DEFAULT_COMPRESSION, size_t strip = default_strip);
+};
+
+#endif
@@ -0,0 +1,94 @@
+#include "ExportQueue.hpp"
+#include "error.hpp"
+#include "Profiler.hpp"
+
+#include <algorithm>
+
+ExportQueue::ExportQueue(int n_threads, size_t cap, policy_t pol) {
+  capacity = std::max((size_t)1, cap);
+  policy = pol;
+  stop = false;
+  busy = 0;
+  n_done = 0;
+  n_dropped = 0;
+  for (int i = 0; i < std::max(1, n_threads); ++i) {
+    writers.push_back(std::thread(&ExportQueue::run, this));
+  }
+}
+
+/* The pending jobs are written before the threads are stopped */
+ExportQueue::~ExportQueue() {
+  flush();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+  not_empty.notify_all();
+  for (auto &w : writers) {
+    w.join();
+  }
+}
+
+void ExportQueue::run() {
+  Profiler::setThreadName("export");
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    not_empty.wait(lock, [this] {return stop || !jobs.empty();});
+    if (jobs.empty()) {
+      return;
+    }
+    std::function<void()> job = std::move(jobs.front());
+    jobs.pop_front();
+    ++busy;
+    lock.unlock();
+    not_full.notify_one();
+    try {
+      job();
+    } catch (std::exception& e) {
+      std::cerr << "Exception catched in export thread: " << e.what() << std::endl;
+    }
+    lock.lock();
+    --busy;
+    ++n_done;
+    if (jobs.empty() && busy == 0) {
+      idle.notify_all();
+    }
+  }
+}
+
+/* Returns false if the job was dropped (queue full with the DROP_ policy) */
+bool ExportQueue::push(std::function<void()> job) {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (jobs.size() >= capacity) {
+    if (policy == DROP_) {
+      ++n_dropped;
+      return false;
+    }
+    not_full.wait(lock, [this] {return jobs.size() < capacity;});
+  }
+  jobs.push_back(std::move(job));
+  lock.unlock();
+  not_empty.notify_one();
+  return true;
+}
+
+/* Waits until every queued job is written */
+void ExportQueue::flush() {
+  std::unique_lock<std::mutex> lock(mutex);
+  idle.wait(lock, [this] {return jobs.empty() && busy == 0;});
+}
+
+size_t ExportQueue::pending() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return jobs.size() + busy;
+}
+
+unsigned long ExportQueue::done() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return n_done;
+}
+
+unsigned long ExportQueue::dropped() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return n_dropped;
+}
@@ -0,0 +1,49 @@
+#ifndef EXPORTQUEUE_HPP
+#define EXPORTQUEUE_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Bounded queue of export jobs run by a pool of writer threads, so that
+ * encoding and disk I/O are taken off the simulation / GUI thread. A job
+ * owns the data it writes (captured copy). When the queue is full, push
+ * either waits for a free slot (BLOCK_) or drops the job (DROP_).
+ */
+class ExportQueue {
+public:
+  enum policy_t {BLOCK_ = 0,
+		 DROP_,
+		 nPolicies};
+
+private:
+  std::deque<std::function<void()> > jobs;
+  size_t capacity;
+  policy_t policy;
+
+  std::vector<std::thread> writers;
+  mutable std::mutex mutex;
+  std::condition_variable not_empty, not_full, idle;
+  bool stop;
+  int busy;
+  unsigned long n_done, n_dropped;
+
+  void run();
+
+public:
+  ExportQueue(int n_threads, size_t capacity, policy_t policy);
+  ~ExportQueue();
+
+  bool push(std::function<void()> job);
+  void flush();
+
+  size_t pending() const;
+  unsigned long done() const;
+  unsigned long dropped() const;
+};
+
+#endif
@@ -0,0 +1,300 @@
+#include "FrameSeries.hpp"
+#include "Deflate.hpp"
+#include "Profiler.hpp"
+#include "error.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <omp.h>
+#include <zlib.h>
+
+namespace {
+
+  struct DataHeader {
+    char magic[8];
+    int32_t n_rows, n_cols, keyframe_interval, zero;
+    float cell_size;
+  };
+
+  const size_t index_header = 8;
+
+  /* std::fseek takes a long, 32 bits on Windows: the files may be larger
+     than 2 GB */
+  bool seek(std::FILE *f, uint64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(f, (__int64)offset, SEEK_SET) == 0;
+#else
+    return fseeko(f, (off_t)offset, SEEK_SET) == 0;
+#endif
+  }
+
+  /* decoded = (key ? 0 : decoded) + q*scale, the same for the writer and
+     the reader */
+  void apply(const int16_t *q, float scale, bool key, float *decoded, size_t n) {
+#pragma omp parallel for if (n > 65536)
+    for (size_t k = 0; k < n; ++k) {
+      decoded[k] = (key ? 0.0f : decoded[k]) + q[k]*scale;
+    }
+  }
+
+  /* Quantizes values - decoded (values for a keyframe) against their
+     maximum, returns the scale and updates decoded */
+  float quantize(const FLOAT *values, float *decoded, bool key, size_t n, std::vector<int16_t> &q) {
+    float max = 0;
+#pragma omp parallel for reduction(max: max)
+    for (size_t k = 0; k < n; ++k) {
+      max = std::max(max, std::fabs((float)values[k] - (key ? 0.0f : decoded[k])));
+    }
+    float scale = max/32767;
+    q.resize(n);
+#pragma omp parallel for
+    for (size_t k = 0; k < n; ++k) {
+      float d = (float)values[k] - (key ? 0.0f : decoded[k]);
+      q[k] = scale > 0 ? (int16_t)std::max(-32767.0f, std::min(32767.0f, std::nearbyint(d/scale))) : 0;
+    }
+    apply(q.data(), scale, key, decoded, n);
+    return scale;
+  }
+
+}
+
+std::string FrameSeries::indexFile(const std::string &file) {
+  return file + ".idx";
+}
+
+/* Creates the series, or with append continues an existing one (with its
+   own keyframe interval) after its last indexed frame */
+FrameSeriesWriter::FrameSeriesWriter(std::string file, int nr, int nc, FLOAT cs, int keyframes,
+				     int l, bool append) {
+  file_name = file;
+  n_rows = nr;
+  n_cols = nc;
+  keyframe_interval = std::max(1, keyframes);
+  level = l;
+  n_frames = 0;
+  previous.assign((size_t)nr*nc, 0.0f);
+  std::FILE *existing = append ? std::fopen(file.c_str(), "rb") : NULL;
+  if (existing) {
+    std::fclose(existing);
+    FrameSeriesReader reader(file);
+    ERROR(reader.getNbRows() == nr && reader.getNbCols() == nc, "Cannot append to "<<file,
+	  "frames of "<<reader.getNbRows()<<" x "<<reader.getNbCols()<<" nodes");
+    keyframe_interval = reader.getKeyframeInterval();
+    n_frames = reader.nbFrames();
+    end = sizeof(DataHeader);
+    if (n_frames > 0) {
+      reader.read(n_frames - 1, previous);
+    }
+    data = std::fopen(file.c_str(), "r+b");
+    index = std::fopen(FrameSeries::indexFile(file).c_str(), "r+b");
+    ERROR(data && index, "Cannot open file "<<file, "");
+    if (n_frames > 0) {
+      FrameSeries::Entry e;
+      ERROR(seek(index, index_header + (uint64_t)(n_frames - 1)*sizeof(FrameSeries::Entry))
+	    && std::fread(&e, sizeof(e), 1, index) == 1, "Cannot read file "<<FrameSeries::indexFile(file), "");
+      end = e.offset + e.size;
+    }
+    // a frame written without its index entry is overwritten
+    ERROR(seek(data, end) && seek(index, index_header + (uint64_t)n_frames*sizeof(FrameSeries::Entry)),
+	  "Cannot append to "<<file, "");
+  } else {
+    data = std::fopen(file.c_str(), "wb");
+    index = std::fopen(FrameSeries::indexFile(file).c_str(), "wb");
+    ERROR(data && index, "Cannot open file "<<file, "");
+    DataHeader h;
+    std::memcpy(h.magic, "WDFRAME1", 8);
+    h.n_rows = n_rows;
+    h.n_cols = n_cols;
+    h.keyframe_interval = keyframe_interval;
+    h.zero = 0;
+    h.cell_size = cs;
+    bool ok = std::fwrite(&h, sizeof(h), 1, data) == 1 && std::fwrite("WDFIDX01", 1, 8, index) == 8
+      && std::fflush(data) == 0 && std::fflush(index) == 0;
+    ERROR(ok, "Cannot write file "<<file, "");
+    end = sizeof(h);
+  }
+}
+
+FrameSeriesWriter::~FrameSeriesWriter() {
+  close();
+}
+
+void FrameSeriesWriter::append(const FLOAT *values, int time) {
+  PROFILE_ZONE("FrameSeriesWriter::append");
+  ERROR(data, "Series "<<file_name<<" closed", "");
+  bool key = n_frames % keyframe_interval == 0;
+  size_t n = previous.size();
+  std::vector<int16_t> q;
+  float scale = quantize(values, previous.data(), key, n, q);
+
+  std::vector<unsigned char> shuffled(2*n);
+#pragma omp parallel for
+  for (size_t k = 0; k < n; ++k) {
+    uint16_t v = q[k];
+    shuffled[k] = v & 0xff;
+    shuffled[n + k] = v >> 8;
+  }
+  std::vector<unsigned char> stream;
+  Deflate::zlib(shuffled.data(), shuffled.size(), stream, level);
+
+  FrameSeries::Entry e;
+  e.offset = end;
+  e.size = stream.size();
+  e.time = time;
+  e.scale = scale;
+  e.flags = key ? FrameSeries::keyframe_ : 0;
+  bool ok = std::fwrite(stream.data(), 1, stream.size(), data) == stream.size() && std::fflush(data) == 0
+    && std::fwrite(&e, sizeof(e), 1, index) == 1 && std::fflush(index) == 0;
+  ERROR(ok, "Cannot write file "<<file_name, "");
+  end += stream.size();
+  ++n_frames;
+}
+
+int FrameSeriesWriter::nbFrames() const {
+  return n_frames;
+}
+
+void FrameSeriesWriter::close() {
+  if (data) {
+    std::fclose(data);
+    std::fclose(index);
+  }
+  data = NULL;
+  index = NULL;
+}
+
+FrameSeriesReader::FrameSeriesReader(std::string file) {
+  file_name = file;
+  data = std::fopen(file.c_str(), "rb");
+  ERROR(data, "Cannot open file "<<file, "");
+  DataHeader h;
+  bool ok = std::fread(&h, sizeof(h), 1, data) == 1 && std::memcmp(h.magic, "WDFRAME1", 8) == 0
+    && h.n_rows > 0 && h.n_cols > 0 && h.keyframe_interval > 0;
+  if (!ok) {
+    std::fclose(data);
+    ERROR(false, "Invalid series file "<<file, "");
+  }
+  n_rows = h.n_rows;
+  n_cols = h.n_cols;
+  keyframe_interval = h.keyframe_interval;
+  cell_size = h.cell_size;
+  refresh();
+}
+
+FrameSeriesReader::~FrameSeriesReader() {
+  std::fclose(data);
+}
+
+/* Reads the index entries written since the last call, returns the number
+   of frames */
+int FrameSeriesReader::refresh() {
+  std::string idx = FrameSeries::indexFile(file_name);
+  std::FILE *index = std::fopen(idx.c_str(), "rb");
+  ERROR(index, "Cannot open file "<<idx, "");
+  char magic[8];
+  bool ok = std::fread(magic, 1, 8, index) == 8 && std::memcmp(magic, "WDFIDX01", 8) == 0;
+  if (ok) {
+    ok = seek(index, index_header + (uint64_t)entries.size()*sizeof(FrameSeries::Entry));
+    FrameSeries::Entry e;
+    while (ok && std::fread(&e, sizeof(e), 1, index) == 1) {
+      entries.push_back(e);
+    }
+  }
+  std::fclose(index);
+  ERROR(ok, "Invalid index file "<<idx, "");
+  return entries.size();
+}
+
+int FrameSeriesReader::nbFrames() const {
+  return entries.size();
+}
+
+int FrameSeriesReader::getNbRows() const {
+  return n_rows;
+}
+
+int FrameSeriesReader::getNbCols() const {
+  return n_cols;
+}
+
+FLOAT FrameSeriesReader::getCellSize() const {
+  return cell_size;
+}
+
+int FrameSeriesReader::getKeyframeInterval() const {
+  return keyframe_interval;
+}
+
+int FrameSeriesReader::getTime(int k) const {
+  return entries[k].time;
+}
+
+/* Quantized values of frames [first, last]: the streams are read at once
+   (they are contiguous) and inflated in parallel */
+void FrameSeriesReader::readStreams(int first, int last, std::vector<std::vector<int16_t> > &q) {
+  uint64_t begin = entries[first].offset;
+  uint64_t size = entries[last].offset + entries[last].size - begin;
+  std::vector<unsigned char> bytes(size);
+  ERROR(seek(data, begin) && std::fread(bytes.data(), 1, size, data) == size, "Cannot read file "<<file_name, "");
+
+  size_t n = (size_t)n_rows*n_cols;
+  int n_frames = last - first + 1;
+  q.resize(n_frames);
+  bool ok = true;
+#pragma omp parallel for schedule(dynamic) reduction(&&: ok)
+  for (int f = 0; f < n_frames; ++f) {
+    const FrameSeries::Entry &e = entries[first + f];
+    std::vector<unsigned char> shuffled(2*n);
+    uLongf length = shuffled.size();
+    bool inflated = uncompress(shuffled.data(), &length, bytes.data() + (e.offset - begin), e.size) == Z_OK
+      && length == shuffled.size();
+    ok = ok && inflated;
+    q[f].resize(n);
+    for (size_t k = 0; k < n && inflated; ++k) {
+      q[f][k] = (int16_t)(uint16_t)(shuffled[k] | shuffled[n + k] << 8);
+    }
+  }
+  ERROR(ok, "Corrupted series file "<<file_name, "frames "<<first<<" to "<<last);
+}
+
+void FrameSeriesReader::read(int k, std::vector<float> &frame) {
+  std::vector<std::vector<float> > frames;
+  readRange(k, k, frames);
+  frame.swap(frames[0]);
+}
+
+/* Frames [first, last]: decoding starts at the keyframe before first, the
+   runs between keyframes are decoded in parallel */
+void FrameSeriesReader::readRange(int first, int last, std::vector<std::vector<float> > &frames) {
+  PROFILE_ZONE("FrameSeriesReader::readRange");
+  ERROR(0 <= first && first <= last && last < (int)entries.size(), "Invalid frames "<<first<<" to "<<last,
+	file_name<<" has "<<entries.size()<<" frames");
+  int k0 = first;
+  while (k0 > 0 && !(entries[k0].flags & FrameSeries::keyframe_)) {
+    --k0;
+  }
+  std::vector<std::vector<int16_t> > q;
+  readStreams(k0, last, q);
+
+  std::vector<int> runs;
+  for (int k = k0; k <= last; ++k) {
+    if (k == k0 || (entries[k].flags & FrameSeries::keyframe_)) {
+      runs.push_back(k);
+    }
+  }
+  runs.push_back(last + 1);
+  size_t n = (size_t)n_rows*n_cols;
+  frames.resize(last - first + 1);
+#pragma omp parallel for schedule(dynamic)
+  for (int r = 0; r < (int)runs.size() - 1; ++r) {
+    std::vector<float> decoded(n, 0.0f);
+    for (int k = runs[r]; k < runs[r + 1]; ++k) {
+      apply(q[k - k0].data(), entries[k].scale, entries[k].flags & FrameSeries::keyframe_, decoded.data(), n);
+      if (k >= first) {
+	frames[k - first] = decoded;
+      }
+    }
+  }
+}
@@ -0,0 +1,90 @@
+#ifndef FRAMESERIES_HPP
+#define FRAMESERIES_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "definitions.hpp"
+
+/*
+ * Time series of n_rows x n_cols frames (surface heights) in one file.
+ * Every keyframe_interval frames a keyframe stores the values, the other
+ * frames the difference with the previous frame as decoded, so that the
+ * quantization errors do not add up. Values are quantized to int16 with
+ * a scale per frame (max |value| / 32767), the bytes shuffled (low bytes
+ * then high bytes) and compressed as one zlib stream.
+ *
+ * Data file: "WDFRAME1", int32 n_rows, n_cols, keyframe_interval, 0,
+ * float32 cell_size, then the frames one after the other.
+ * Index, <file>.idx: "WDFIDX01", then 24 bytes per frame: uint64 offset
+ * and uint32 size of its stream, int32 time, float32 scale, uint32 flags
+ * (1: keyframe). An entry is written after its frame and both files are
+ * flushed, so that a reader sees every indexed frame complete while the
+ * series is still being written.
+ */
+class FrameSeries {
+public:
+  struct Entry {
+    uint64_t offset;
+    uint32_t size;
+    int32_t time;
+    float scale;
+    uint32_t flags;
+  };
+
+  static const int keyframe_ = 1;
+
+  static std::string indexFile(const std::string &file);
+};
+
+class FrameSeriesWriter {
+private:
+  std::string file_name;
+  std::FILE *data, *index;
+  int n_rows, n_cols;
+  int keyframe_interval;
+  int level;
+  int n_frames;
+  uint64_t end;
+  std::vector<float> previous; // last frame as decoded
+
+public:
+  FrameSeriesWriter(std::string file, int nr, int nc, FLOAT cs, int keyframes = 32,
+		    int level = 1, bool append = false);
+  ~FrameSeriesWriter();
+
+  void append(const FLOAT *values, int time);
+  int nbFrames() const;
+  void close();
+};
+
+class FrameSeriesReader {
+private:
+  std::string file_name;
+  std::FILE *data;
+  int n_rows, n_cols;
+  int keyframe_interval;
+  FLOAT cell_size;
+  std::vector<FrameSeries::Entry> entries;
+
+  void readStreams(int first, int last, std::vector<std::vector<int16_t> > &q);
+
+public:
+  FrameSeriesReader(std::string file);
+  ~FrameSeriesReader();
+
+  int refresh();
+
+  int nbFrames() const;
+  int getNbRows() const;
+  int getNbCols() const;
+  FLOAT getCellSize() const;
+  int getKeyframeInterval() const;
+  int getTime(int k) const;
+
+  void read(int k, std::vector<float> &frame);
+  void readRange(int first, int last, std::vector<std::vector<float> > &frames);
+};
+
+#endif
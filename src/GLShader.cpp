@@ -0,0 +1,73 @@
+#include "GLShader.hpp"
+#include "error.hpp"
+
+#include <QOpenGLExtraFunctions>
+#include <string>
+
+namespace gl_shader {
+
+  const char *lighting =
+    "uniform float lights[8];\n"
+    "vec3 lighting(vec3 p, vec3 n) {\n"
+    "  vec3 c = gl_LightModel.ambient.rgb;\n"
+    "  for (int i = 0; i < 8; ++i) {\n"
+    "    vec4 lp = gl_LightSource[i].position;\n"
+    "    vec3 l = normalize(lp.xyz - lp.w*p);\n"
+    "    c += lights[i]*(gl_LightSource[i].ambient.rgb +\n"
+    "                    max(dot(n, l), 0.0)*gl_LightSource[i].diffuse.rgb);\n"
+    "  }\n"
+    "  return c;\n"
+    "}\n";
+
+  static GLuint compile(QOpenGLExtraFunctions *gl, GLenum type, const char *src) {
+    std::string full = std::string("#version 120\n") + lighting + src;
+    const char *s = full.c_str();
+    GLuint shader = gl->glCreateShader(type);
+    gl->glShaderSource(shader, 1, &s, NULL);
+    gl->glCompileShader(shader);
+    GLint ok = 0;
+    gl->glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+      char log[1024];
+      gl->glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+      WARNING(false, "Cannot compile shader", log);
+      gl->glDeleteShader(shader);
+      return 0;
+    }
+    return shader;
+  }
+
+  /* Returns 0 if the program cannot be built. */
+  GLuint createProgram(QOpenGLExtraFunctions *gl, const char *vertex, const char *fragment) {
+    GLuint vs = compile(gl, GL_VERTEX_SHADER, vertex);
+    GLuint fs = compile(gl, GL_FRAGMENT_SHADER, fragment);
+    if (vs == 0 || fs == 0) {
+      return 0;
+    }
+    GLuint program = gl->glCreateProgram();
+    gl->glAttachShader(program, vs);
+    gl->glAttachShader(program, fs);
+    gl->glLinkProgram(program);
+    gl->glDeleteShader(vs);
+    gl->glDeleteShader(fs);
+    GLint ok = 0;
+    gl->glGetProgramiv(program, GL_LINK_STATUS, &ok);
+    if (!ok) {
+      char log[1024];
+      gl->glGetProgramInfoLog(program, sizeof(log), NULL, log);
+      WARNING(false, "Cannot link shader program", log);
+      gl->glDeleteProgram(program);
+      return 0;
+    }
+    return program;
+  }
+
+  void setLights(QOpenGLExtraFunctions *gl, GLint location) {
+    float lights[8];
+    for (int i = 0; i < 8; ++i) {
+      lights[i] = glIsEnabled(GL_LIGHT0 + i) ? 1.0f : 0.0f;
+    }
+    gl->glUniform1fv(location, 8, lights);
+  }
+
+}
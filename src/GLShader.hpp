@@ -0,0 +1,23 @@
+#ifndef GLSHADER_HPP
+#define GLSHADER_HPP
+
+#include "Object.hpp"
+
+class QOpenGLExtraFunctions;
+
+/*
+ * Helpers shared by the buffer object renderers (GridRenderer,
+ * MarkerRenderer).
+ */
+namespace gl_shader {
+
+  // GLSL 1.20 function "vec3 lighting(vec3 p, vec3 n)": fixed pipeline
+  // ambient + diffuse lighting of an eye space point, using the uniform
+  // "float lights[8]" (1 for enabled lights, see setLights)
+  extern const char *lighting;
+
+  GLuint createProgram(QOpenGLExtraFunctions *gl, const char *vertex, const char *fragment);
+  void setLights(QOpenGLExtraFunctions *gl, GLint location);
+};
+
+#endif
@@ -18,7 +18,11 @@
  */
 
 #include "Grid.hpp"
+#include "Profiler.hpp"
+#include "PerfOverlay.hpp"
+#include "MeshExporter.hpp"
 #include <iostream>
+#include <utility>
  #include "error.hpp"
 #include "settings.hpp"
 
@@ -37,14 +41,15 @@ inline int Grid::col(int ind) const {
 }
 
 
-Grid::Grid() {
+Grid::Grid(): normals_valid(false) {
   n_rows = 0;
   n_cols = 0;
+  n_nodes = 0;
   cell_size = 0;
    setColor(1, 1, 1);
 }
 
-Grid::Grid(int rows, int cols, FLOAT cs) {
+Grid::Grid(int rows, int cols, FLOAT cs): normals_valid(false) {
    setColor(1, 1, 1);
   n_rows = rows;
   n_cols = cols;
@@ -55,39 +60,42 @@ Grid::Grid(int rows, int cols, FLOAT cs) {
   reset(0);
 }
 
+Grid::Grid(const Grid& g): Object(), normals_valid(false) {
+  *this = g;
+  setColor(g.cr, g.cg, g.cb);
+}
+
 Grid::~Grid() {}
 
 void Grid::animate() {}
 
 void Grid::draw() {
+  PROFILE_ZONE("Grid::draw");
+#ifndef WD_HEADLESS
+  const std::vector<VEC3> &n = getNormals();
   glBegin(GL_TRIANGLES);
   glColor3f(cr, cg, cb);
   for (int i = 0; i < n_rows - 1; i++) {
     for (int j = 0; j < n_cols - 1; j++) {
-      FLOAT nx = nodes[index(i+1,j)] - nodes[index(i,j)];
-      FLOAT ny = nodes[index(i,j)] - nodes[index(i,j+1)];
-      FLOAT nz = cell_size;
-      FLOAT n = sqrt(nx*nx + ny*ny + nz*nz);
-      nx /= n;
-      ny /= n;
-      nz /= n;
-      
-      glNormal3f(nx, ny, nz);
-      glVertex3f(i*cell_size, j*cell_size, nodes[index(i,j)]);
-      glNormal3f(nx, ny, nz);
-      glVertex3f((i+1)*cell_size, j*cell_size, nodes[index(i+1,j)]);
-      glNormal3f(nx, ny, nz);
-      glVertex3f((i+1)*cell_size, (j+1)*cell_size, nodes[index(i+1,j+1)]);
-
-      glNormal3f(nx, ny, nz);
-      glVertex3f((i+1)*cell_size, (j+1)*cell_size, nodes[index(i+1,j+1)]);
-      glNormal3f(nx, ny, nz);
-      glVertex3f(i*cell_size, (j+1)*cell_size, nodes[index(i,j+1)]);
-      glNormal3f(nx, ny, nz);
-      glVertex3f(i*cell_size, j*cell_size, nodes[index(i,j)]);
+      int i0 = index(i, j), i1 = index(i+1, j), i2 = index(i+1, j+1), i3 = index(i, j+1);
+
+      glNormal3f(n[i0](0), n[i0](1), n[i0](2));
+      glVertex3f(i*cell_size, j*cell_size, nodes[i0]);
+      glNormal3f(n[i1](0), n[i1](1), n[i1](2));
+      glVertex3f((i+1)*cell_size, j*cell_size, nodes[i1]);
+      glNormal3f(n[i2](0), n[i2](1), n[i2](2));
+      glVertex3f((i+1)*cell_size, (j+1)*cell_size, nodes[i2]);
+
+      glNormal3f(n[i2](0), n[i2](1), n[i2](2));
+      glVertex3f((i+1)*cell_size, (j+1)*cell_size, nodes[i2]);
+      glNormal3f(n[i3](0), n[i3](1), n[i3](2));
+      glVertex3f(i*cell_size, (j+1)*cell_size, nodes[i3]);
+      glNormal3f(n[i0](0), n[i0](1), n[i0](2));
+      glVertex3f(i*cell_size, j*cell_size, nodes[i0]);
     }
   }
   glEnd();
+#endif
   
   //     glBegin(GL_LINES);
   // glColor3f(cr, cg, cb);
@@ -184,80 +192,136 @@ FLOAT & Grid::operator()(int i, int j) {
   return nodes[ind];
 }
 
+const FLOAT *Grid::data() const {
+  return nodes.data();
+}
+
 FLOAT Grid::interpolatedValue(FLOAT x, FLOAT y) const {
   ERROR(false, "TODO: Grid::interpolatedValue", "");
 }
 
 void Grid::reset(FLOAT val) {
+  normals_valid = false;
   #pragma omp for
   for (int i = 0; i < n_nodes; ++i) {
     nodes[i] = val;
   }
 }
 
-void Grid::loadTexture(std::string file) {
-  SDL_Surface *height_field;
-  height_field = IMG_Load(file.c_str());
-  if(height_field == 0) {
-    std::cout << "Erreur : " << SDL_GetError() << std::endl;
-    std::exit(1);
+/* Per node normals from central differences of the heights (one sided
+   on the borders). */
+void Grid::computeNormals() const {
+  PerfOverlay::Timer overlay_timer(PerfOverlay::NORMALS_);
+  normals.resize(n_nodes);
+  FLOAT *out = (FLOAT*) normals.data();
+  const FLOAT *h = nodes.data();
+#pragma omp parallel for
+  for (int i = 0; i < n_rows; ++i) {
+    int im = std::max(i - 1, 0), ip = std::min(i + 1, n_rows - 1);
+    FLOAT sx = (ip > im) ? 1/((ip - im)*cell_size) : 0;
+    FLOAT sy = 1/(2*cell_size);
+    const FLOAT *r = h + index(i, 0), *rm = h + index(im, 0), *rp = h + index(ip, 0);
+    FLOAT *o = out + 3*index(i, 0);
+#pragma omp simd
+    for (int j = 1; j < n_cols - 1; ++j) {
+      FLOAT gx = (rp[j] - rm[j])*sx;
+      FLOAT gy = (r[j+1] - r[j-1])*sy;
+      FLOAT inv = 1/sqrt(gx*gx + gy*gy + 1);
+      o[3*j] = -gx*inv;
+      o[3*j+1] = -gy*inv;
+      o[3*j+2] = inv;
+    }
+    for (int j = 0; j < n_cols; j += std::max(1, n_cols - 1)) {
+      int jm = std::max(j - 1, 0), jp = std::min(j + 1, n_cols - 1);
+      FLOAT gx = (rp[j] - rm[j])*sx;
+      FLOAT gy = (jp > jm) ? (r[jp] - r[jm])/((jp - jm)*cell_size) : 0;
+      FLOAT inv = 1/sqrt(gx*gx + gy*gy + 1);
+      o[3*j] = -gx*inv;
+      o[3*j+1] = -gy*inv;
+      o[3*j+2] = inv;
+    }
   }
-  setValues(height_field);
+  normals_valid = true;
+}
+
+/* To be called once after heights have been written through operator() */
+void Grid::invalidateNormals() {
+  normals_valid = false;
+}
+
+const std::vector<VEC3> &Grid::getNormals() const {
+  if (!normals_valid || (int)normals.size() != n_nodes) {
+    computeNormals();
+  }
+  return normals;
+}
+
+void Grid::loadTexture(std::string file) {
+  setValues(*Texture::load(file));
 }
   
 
+#ifndef WD_HEADLESS
 void Grid::setValues(const SDL_Surface * texture) {
-  int w = texture->w;
-  int h = texture->h;
-  FLOAT pix_per_cell_x = (FLOAT)h/(FLOAT)n_rows;
-  FLOAT pix_per_cell_y = (FLOAT)w/(FLOAT)n_cols;
-  FLOAT byte_per_cell_x = texture->format->BytesPerPixel * pix_per_cell_x;
-  FLOAT byte_per_cell_y = texture->format->BytesPerPixel * pix_per_cell_y;
-  unsigned char* pixels = (unsigned char*) texture->pixels;
-  
-  #pragma omp for
-  for (int i = 0; i < n_rows; ++i) {
-    int x = i*byte_per_cell_x/texture->format->BytesPerPixel;//
-    x *= texture->format->BytesPerPixel;
-    for (int j = 0; j < n_cols; ++j) {
-      int y = j*byte_per_cell_y/texture->format->BytesPerPixel;
-      y *= texture->format->BytesPerPixel;
-      
-      nodes[i*n_cols+j] = (int)pixels[(int)(x*w+y)]/256.0;
-      //      TR(i<<" "<<j<<" "<<nodes[i*n_cols+j]);
-       // if (nodes[i*n_cols+j] < 0.1) {
-       // 	nodes[i*n_cols+j] = 0;
-       // } else if (nodes[i*n_cols+j] > 0.9) {
-       // 	nodes[i*n_cols+j] = 1;
-       // } 
-    }
-  }
+  setValues(Texture(texture));
 }
+#endif
 
-std::ostream& Grid::exportObj(std::ostream& os) const {
-  INFO("export Grid");
-  os << "# Grid\n";
+/* Box filtered when the texture is larger than the grid, bilinear
+   otherwise (see Texture::resample). */
+void Grid::setValues(const Texture &texture) {
+  normals_valid = false;
+  texture.resample(nodes.data(), n_rows, n_cols);
+}
+
+std::vector<VEC3> Grid::meshVertices() const {
+  std::vector<VEC3> vertices(n_nodes);
+#pragma omp parallel for
   for (int i = 0; i < n_rows; i++) {
     for (int j = 0; j < n_cols; j++) {
-      VEC2 posv = VEC2(2*i*cell_size/scale_ - 1, 2*(FLOAT)j*cell_size/scale_ - 1);
-      FLOAT h = nodes[index(i, j)];
-      os <<"v "<<posv(0)<<" "<<posv(1)<<" "<<h<<"\n";
+      vertices[index(i, j)] = VEC3(2*i*cell_size/scale_ - 1, 2*(FLOAT)j*cell_size/scale_ - 1,
+				   nodes[index(i, j)]);
     }
   }
-  for (int i = 0; i < n_rows-2; i++) {
-    for (int j = 0; j < n_cols-2; j++) {
-      int idx = j + i * n_cols + 1;
-      int J   = 1;
-      int I   = n_cols;
-      os << "f "<<idx<<" "<<idx + J<<" "<<idx + I<<"\n";
-      os << "f "<<idx + I<<" "<<idx + J<<" "<<idx + I + J<<"\n";
-    }
+  return vertices;
+}
+
+/* normals of meshVertices(), whose xy coordinates are scaled by 2/scale_ */
+std::vector<VEC3> Grid::meshNormals() const {
+  const std::vector<VEC3> &n = getNormals();
+  std::vector<VEC3> out(n_nodes);
+  FLOAT s = 2/scale_;
+#pragma omp parallel for
+  for (int i = 0; i < n_nodes; ++i) {
+    out[i] = VEC3(n[i](0)/s, n[i](1)/s, n[i](2)).normalized();
   }
-  return os;
+  return out;
+}
+
+std::ostream& Grid::exportObj(std::ostream& os) const {
+  INFO("export Grid");
+  std::vector<VEC3> vertices = meshVertices();
+  std::vector<VEC3> normals_mesh = meshNormals();
+  MeshExporter mesh(n_rows, n_cols, vertices.data());
+  mesh.setNormals(normals_mesh.data());
+  mesh.setQuads(n_rows-2, n_cols-2);
+  mesh.setComment("Grid");
+  return mesh.writeObj(os);
+}
+
+void Grid::exportMesh(std::string file) const {
+  std::vector<VEC3> vertices = meshVertices();
+  std::vector<VEC3> normals_mesh = meshNormals();
+  MeshExporter mesh(n_rows, n_cols, vertices.data());
+  mesh.setNormals(normals_mesh.data());
+  mesh.setQuads(n_rows-2, n_cols-2);
+  mesh.setComment("Grid");
+  mesh.write(file, MeshExporter::format(file));
 }
 
 
 Grid& Grid::operator=(const Grid& g) {
+  normals_valid = false;
   n_rows = g.n_rows;
   n_cols = g.n_cols;
   n_nodes = n_rows*n_cols;
@@ -270,6 +334,20 @@ Grid& Grid::operator=(const Grid& g) {
   return *this;
 }
 
+/* Exchanges the contents (heights and cached normals) of two grids without
+   copying the nodes */
+void Grid::swap(Grid& g) {
+  std::swap(n_rows, g.n_rows);
+  std::swap(n_cols, g.n_cols);
+  std::swap(n_nodes, g.n_nodes);
+  std::swap(cell_size, g.cell_size);
+  nodes.swap(g.nodes);
+  normals.swap(g.normals);
+  bool valid = normals_valid;
+  normals_valid = g.normals_valid.load();
+  g.normals_valid = valid;
+}
+
 std::ostream& operator<<(std::ostream& os, const Grid& g) {
   os << g.n_rows<<" "<<g.n_cols<<" ";
   for (int i = 0; i < g.n_nodes; ++i) {
@@ -278,6 +356,7 @@ std::ostream& operator<<(std::ostream& os, const Grid& g) {
   return os;
 }
 std::istream& operator >> (std::istream& is, Grid& g) {
+  g.normals_valid = false;
   is >> g.n_rows >> g.n_cols;
   g.n_nodes = g.n_rows*g.n_cols;
   g.nodes = std::vector<FLOAT>(g.n_nodes);
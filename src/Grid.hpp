@@ -20,11 +20,15 @@
 #ifndef GRID_HPP
 #define GRID_HPP
 
+#include <atomic>
 #include <vector>
 #include "Object.hpp"
 #include "definitions.hpp"
+#include "Texture.hpp"
 
+#ifndef WD_HEADLESS
 #include <SDL2/SDL_image.h>
+#endif
 
 class Grid: public Object {
 
@@ -33,6 +37,12 @@ private:
   FLOAT cell_size;
   std::vector<FLOAT> nodes;
 
+  // per node normals, recomputed lazily once invalidated: by the bulk
+  // updates (reset, setValues, operator=...), not by operator() which is
+  // used in the hot loops, see invalidateNormals
+  mutable std::vector<VEC3> normals;
+  mutable std::atomic<bool> normals_valid;
+
   inline int index(int i, int j) const;
   inline int row(int ind) const ;
   inline int col(int ind) const;
@@ -42,6 +52,7 @@ private:
 public:
   Grid();
   Grid(int n_rows, int n_cols, FLOAT cs);
+  Grid(const Grid& g);
   ~Grid();
 
   void animate();
@@ -61,19 +72,31 @@ public:
 
   FLOAT operator()(int i, int j) const;
   FLOAT &operator()(int i, int j);
+  const FLOAT *data() const;
   FLOAT value(FLOAT x, FLOAT y) const;
   FLOAT interpolatedValue(FLOAT x, FLOAT y) const;
 
   void reset(FLOAT val);
+
+  void computeNormals() const;
+  void invalidateNormals();
+  const std::vector<VEC3> &getNormals() const;
   
   void loadTexture(std::string file);
+#ifndef WD_HEADLESS
   void setValues(const SDL_Surface *texture);
+#endif
+  void setValues(const Texture &texture);
 
   
   void getPixels(unsigned char *pixels) const;
+  std::vector<VEC3> meshVertices() const;
+  std::vector<VEC3> meshNormals() const;
   std::ostream& exportObj(std::ostream& os) const;
+  void exportMesh(std::string file) const;
   
   Grid& operator=(const Grid& g);
+  void swap(Grid& g);
   Grid& operator+=(const Grid& g);
   friend std::ostream& operator<<(std::ostream& os, const Grid& g);
   friend std::istream& operator>>(std::istream& is, Grid& F);
@@ -0,0 +1,230 @@
+#include "GridLod.hpp"
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+GridLod::GridLod() {
+  n_rows = 0;
+  n_cols = 0;
+  has_view = false;
+  pixel_ratio = 1;
+  perspective = true;
+  tolerance = 1;
+  n_visible = 0;
+}
+
+/* Camera used by the next builds: frustum planes as returned by
+   qglviewer::Camera::getFrustumPlanesCoefficients (a point is outside when
+   a*x + b*y + c*z - d > 0), eye position, and size of a pixel in world
+   units at unit depth (perspective) or everywhere (orthographic) */
+void GridLod::setView(const double p[6][4], const double e[3], double ratio,
+		      bool persp, double tol) {
+  std::copy(&p[0][0], &p[0][0] + 24, &planes[0][0]);
+  std::copy(e, e + 3, eye);
+  pixel_ratio = ratio;
+  perspective = persp;
+  tolerance = tol;
+  has_view = true;
+}
+
+/* Chunk bounds along an axis of n cells; a last chunk of a single cell is
+   merged with the previous one so that every chunk has an interior */
+void GridLod::split(int n, std::vector<int> &bounds) const {
+  bounds.clear();
+  for (int k = 0; k < n; k += chunk_size) {
+    bounds.push_back(k);
+  }
+  if (bounds.size() > 1 && n - bounds.back() < 2) {
+    bounds.pop_back();
+  }
+  bounds.push_back(std::max(n, 0));
+}
+
+/* Step of a chunk, 0 if it is outside the frustum. Only full chunks are
+   decimated so that the steps always divide the sides. */
+int GridLod::chooseStep(int ci, int cj, FLOAT cs, FLOAT zmin, FLOAT zmax) const {
+  int a0 = row_bounds[ci], a1 = row_bounds[ci + 1];
+  int b0 = col_bounds[cj], b1 = col_bounds[cj + 1];
+  if (!has_view) {
+    return 1;
+  }
+  double lo[3] = {a0*cs, b0*cs, zmin};
+  double hi[3] = {a1*cs, b1*cs, zmax};
+  for (int k = 0; k < 6; ++k) {
+    double dmin = -planes[k][3];
+    for (int c = 0; c < 3; ++c) {
+      dmin += planes[k][c]*(planes[k][c] > 0 ? lo[c] : hi[c]);
+    }
+    if (dmin > 0) {
+      return 0;
+    }
+  }
+  if (a1 - a0 != chunk_size || b1 - b0 != chunk_size) {
+    return 1;
+  }
+  double depth = 1;
+  if (perspective) {
+    double d2 = 0;
+    for (int c = 0; c < 3; ++c) {
+      double d = std::max(std::max(lo[c] - eye[c], eye[c] - hi[c]), 0.0);
+      d2 += d*d;
+    }
+    depth = sqrt(d2);
+  }
+  int s = 1;
+  while (2*s <= chunk_size/2 && 2*s*cs <= tolerance*pixel_ratio*depth) {
+    s *= 2;
+  }
+  return s;
+}
+
+/* Appends the triangle with the orientation of Grid::draw */
+void GridLod::triangle(int a, int b, int c, std::vector<unsigned int> &out) const {
+  int ia = a/n_cols, ja = a%n_cols;
+  int ib = b/n_cols, jb = b%n_cols;
+  int ic = c/n_cols, jc = c%n_cols;
+  if ((ib - ia)*(jc - ja) - (jb - ja)*(ic - ia) < 0) {
+    std::swap(b, c);
+  }
+  out.push_back(a);
+  out.push_back(b);
+  out.push_back(c);
+}
+
+/* Triangulates the strip between a side of a chunk and the parallel row of
+   interior nodes, both ordered along the side */
+void GridLod::zipper(const std::vector<int> &outer, const std::vector<int> &inner, bool along_j,
+		     std::vector<unsigned int> &out) const {
+  auto pos = [&](int n) {return along_j ? n%n_cols : n/n_cols;};
+  size_t p = 0, q = 0;
+  while (p + 1 < outer.size() || q + 1 < inner.size()) {
+    if (q + 1 == inner.size() || (p + 1 < outer.size() && pos(outer[p + 1]) <= pos(inner[q + 1]))) {
+      triangle(outer[p], outer[p + 1], inner[q], out);
+      ++p;
+    } else {
+      triangle(outer[p], inner[q + 1], inner[q], out);
+      ++q;
+    }
+  }
+}
+
+void GridLod::triangulate(int ci, int cj, std::vector<unsigned int> &out) const {
+  int n_ci = row_bounds.size() - 1, n_cj = col_bounds.size() - 1;
+  int a0 = row_bounds[ci], a1 = row_bounds[ci + 1];
+  int b0 = col_bounds[cj], b1 = col_bounds[cj + 1];
+  int s = steps[ci*n_cj + cj];
+  auto node = [&](int i, int j) {return i*n_cols + j;};
+
+  if (a1 - a0 < 2 || b1 - b0 < 2) {
+    for (int i = a0; i < a1; ++i) {
+      for (int j = b0; j < b1; ++j) {
+	triangle(node(i, j), node(i + 1, j), node(i + 1, j + 1), out);
+	triangle(node(i + 1, j + 1), node(i, j + 1), node(i, j), out);
+      }
+    }
+    return;
+  }
+
+  // sides i = a0, i = a1, j = b0, j = b1: coarser step of the two chunks
+  int nb[4] = {ci > 0 ? steps[(ci - 1)*n_cj + cj] : 0,
+	       ci < n_ci - 1 ? steps[(ci + 1)*n_cj + cj] : 0,
+	       cj > 0 ? steps[ci*n_cj + cj - 1] : 0,
+	       cj < n_cj - 1 ? steps[ci*n_cj + cj + 1] : 0};
+  int e[4];
+  for (int k = 0; k < 4; ++k) {
+    e[k] = std::max(s, nb[k]);
+  }
+
+  for (int i = a0 + s; i < a1 - s; i += s) {
+    for (int j = b0 + s; j < b1 - s; j += s) {
+      triangle(node(i, j), node(i + s, j), node(i + s, j + s), out);
+      triangle(node(i + s, j + s), node(i, j + s), node(i, j), out);
+    }
+  }
+
+  std::vector<int> outer, inner;
+  for (int k = 0; k < 4; ++k) {
+    outer.clear();
+    inner.clear();
+    if (k < 2) {
+      int i = k == 0 ? a0 : a1, i_in = k == 0 ? a0 + s : a1 - s;
+      for (int j = b0; j <= b1; j += e[k]) outer.push_back(node(i, j));
+      for (int j = b0 + s; j <= b1 - s; j += s) inner.push_back(node(i_in, j));
+    } else {
+      int j = k == 2 ? b0 : b1, j_in = k == 2 ? b0 + s : b1 - s;
+      for (int i = a0; i <= a1; i += e[k]) outer.push_back(node(i, j));
+      for (int i = a0 + s; i <= a1 - s; i += s) inner.push_back(node(i, j_in));
+    }
+    zipper(outer, inner, k < 2, out);
+  }
+}
+
+void GridLod::build(const Grid &g) {
+  PROFILE_ZONE("GridLod::build");
+  if (g.getNbRows() != n_rows || g.getNbCols() != n_cols) {
+    n_rows = g.getNbRows();
+    n_cols = g.getNbCols();
+    split(n_rows - 1, row_bounds);
+    split(n_cols - 1, col_bounds);
+    chunk_tris.assign((row_bounds.size() - 1)*(col_bounds.size() - 1), std::vector<unsigned int>());
+  }
+  int n_ci = row_bounds.size() - 1, n_cj = col_bounds.size() - 1;
+  int n_chunks = n_ci*n_cj;
+  tris.clear();
+  n_visible = 0;
+  if (n_rows < 2 || n_cols < 2) {
+    return;
+  }
+
+  // the height range of the whole surface bounds every chunk
+  const FLOAT *h = g.data();
+  int n_nodes = n_rows*n_cols;
+  FLOAT zmin = h[0], zmax = h[0];
+#pragma omp parallel for reduction(min:zmin) reduction(max:zmax)
+  for (int k = 0; k < n_nodes; ++k) {
+    zmin = std::min(zmin, h[k]);
+    zmax = std::max(zmax, h[k]);
+  }
+
+  steps.resize(n_chunks);
+  FLOAT cs = g.getCellSize();
+#pragma omp parallel for reduction(+:n_visible)
+  for (int c = 0; c < n_chunks; ++c) {
+    steps[c] = chooseStep(c/n_cj, c%n_cj, cs, zmin, zmax);
+    n_visible += steps[c] > 0;
+  }
+
+  std::vector<size_t> offsets(n_chunks + 1, 0);
+#pragma omp parallel for schedule(dynamic)
+  for (int c = 0; c < n_chunks; ++c) {
+    chunk_tris[c].clear();
+    if (steps[c] > 0) {
+      triangulate(c/n_cj, c%n_cj, chunk_tris[c]);
+    }
+  }
+  for (int c = 0; c < n_chunks; ++c) {
+    offsets[c + 1] = offsets[c] + chunk_tris[c].size();
+  }
+  tris.resize(offsets[n_chunks]);
+#pragma omp parallel for schedule(dynamic)
+  for (int c = 0; c < n_chunks; ++c) {
+    std::copy(chunk_tris[c].begin(), chunk_tris[c].end(), tris.begin() + offsets[c]);
+  }
+}
+
+int GridLod::nbTriangles() const {
+  return tris.size()/3;
+}
+
+int GridLod::nbChunks() const {
+  return steps.size();
+}
+
+int GridLod::nbVisibleChunks() const {
+  return n_visible;
+}
+
+const std::vector<unsigned int> &GridLod::triangles() const {
+  return tris;
+}
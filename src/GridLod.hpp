@@ -0,0 +1,56 @@
+#ifndef GRIDLOD_HPP
+#define GRIDLOD_HPP
+
+#include <vector>
+#include "Grid.hpp"
+
+/*
+ * View dependent triangulation of a Grid. The grid is split in chunks of
+ * chunk_size x chunk_size cells; chunks outside the camera frustum are
+ * skipped and the others are decimated with a power of two step, the
+ * largest one whose cells stay below the pixel tolerance on screen.
+ * The border ring of a chunk is stitched to its neighbours: each side is
+ * sampled with the coarser step of the two chunks sharing it, and
+ * joined to the interior by a zipper strip, so there are no cracks.
+ * The indices refer to the nodes of the grid (index = n_cols*i + j).
+ */
+class GridLod {
+private:
+  static const int chunk_size = 32;
+
+  int n_rows, n_cols;
+  std::vector<int> row_bounds, col_bounds;
+
+  bool has_view;
+  double planes[6][4];
+  double eye[3];
+  double pixel_ratio;
+  bool perspective;
+  double tolerance;
+
+  std::vector<int> steps;
+  std::vector<std::vector<unsigned int> > chunk_tris;
+  std::vector<unsigned int> tris;
+  int n_visible;
+
+  void split(int n, std::vector<int> &bounds) const;
+  int chooseStep(int ci, int cj, FLOAT cs, FLOAT zmin, FLOAT zmax) const;
+  void triangulate(int ci, int cj, std::vector<unsigned int> &out) const;
+  void zipper(const std::vector<int> &outer, const std::vector<int> &inner, bool along_j,
+	      std::vector<unsigned int> &out) const;
+  void triangle(int a, int b, int c, std::vector<unsigned int> &out) const;
+
+public:
+  GridLod();
+
+  void setView(const double planes[6][4], const double eye[3], double pixel_ratio,
+	       bool perspective, double tolerance);
+  void build(const Grid &g);
+
+  int nbTriangles() const;
+  int nbChunks() const;
+  int nbVisibleChunks() const;
+  const std::vector<unsigned int> &triangles() const;
+};
+
+#endif
@@ -0,0 +1,235 @@
+#include "GridRenderer.hpp"
+#include "Profiler.hpp"
+#include "PerfOverlay.hpp"
+#include "GLShader.hpp"
+#include "error.hpp"
+
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <cmath>
+
+namespace {
+
+  const char *vertex_shader =
+    "attribute vec2 xy;\n"
+    "attribute float height;\n"
+    "attribute vec3 normal;\n"
+    "uniform vec3 color;\n"
+    "varying vec3 shade;\n"
+    "void main() {\n"
+    "  vec4 p = gl_ModelViewMatrix*vec4(xy, height, 1.0);\n"
+    "  shade = color*lighting(p.xyz, normalize(gl_NormalMatrix*normal));\n"
+    "  gl_Position = gl_ProjectionMatrix*p;\n"
+    "}\n";
+
+  const char *fragment_shader =
+    "varying vec3 shade;\n"
+    "void main() {\n"
+    "  gl_FragColor = vec4(shade, 1.0);\n"
+    "}\n";
+
+}
+
+GridRenderer::GridRenderer() {
+  gl = NULL;
+  initialized = false;
+  supported = false;
+  n_rows = 0;
+  n_cols = 0;
+  cell_size = 0;
+  n_indices = 0;
+  program = 0;
+  xy_buffer = height_buffer = normal_buffer = index_buffer = lod_buffer = 0;
+  lod_enabled = false;
+}
+
+GridRenderer::~GridRenderer() {}
+
+bool GridRenderer::isSupported() const {
+  return supported;
+}
+
+bool GridRenderer::init() {
+  initialized = true;
+  QOpenGLContext *context = QOpenGLContext::currentContext();
+  if (context == NULL) {
+    return false;
+  }
+  gl = context->extraFunctions();
+
+  program = gl_shader::createProgram(gl, vertex_shader, fragment_shader);
+  if (program == 0) {
+    WARNING(false, "GridRenderer: using immediate mode", "");
+    return false;
+  }
+  xy_loc = gl->glGetAttribLocation(program, "xy");
+  height_loc = gl->glGetAttribLocation(program, "height");
+  normal_loc = gl->glGetAttribLocation(program, "normal");
+  color_loc = gl->glGetUniformLocation(program, "color");
+  lights_loc = gl->glGetUniformLocation(program, "lights");
+
+  GLuint buffers[5];
+  gl->glGenBuffers(5, buffers);
+  xy_buffer = buffers[0];
+  height_buffer = buffers[1];
+  normal_buffer = buffers[2];
+  index_buffer = buffers[3];
+  lod_buffer = buffers[4];
+  supported = true;
+  return true;
+}
+
+/* Static part of the mesh: node positions in the plane and triangles
+   (same triangulation as Grid::draw). */
+void GridRenderer::create(int nr, int nc, FLOAT cs) {
+  n_rows = nr;
+  n_cols = nc;
+  cell_size = cs;
+  int n_nodes = n_rows*n_cols;
+
+  std::vector<float> xy(2*(size_t)n_nodes);
+#pragma omp parallel for
+  for (int i = 0; i < n_rows; ++i) {
+    for (int j = 0; j < n_cols; ++j) {
+      xy[2*(i*n_cols + j)] = i*cell_size;
+      xy[2*(i*n_cols + j) + 1] = j*cell_size;
+    }
+  }
+  int quads_cols = std::max(0, n_cols - 1);
+  n_indices = 6*std::max(0, n_rows - 1)*quads_cols;
+  std::vector<GLuint> indices(n_indices);
+#pragma omp parallel for
+  for (int i = 0; i < n_rows - 1; ++i) {
+    for (int j = 0; j < n_cols - 1; ++j) {
+      GLuint *t = &indices[6*(i*quads_cols + j)];
+      GLuint idx = i*n_cols + j;
+      t[0] = idx;
+      t[1] = idx + n_cols;
+      t[2] = idx + n_cols + 1;
+      t[3] = idx + n_cols + 1;
+      t[4] = idx + 1;
+      t[5] = idx;
+    }
+  }
+
+  gl->glBindBuffer(GL_ARRAY_BUFFER, xy_buffer);
+  gl->glBufferData(GL_ARRAY_BUFFER, xy.size()*sizeof(float), xy.data(), GL_STATIC_DRAW);
+  gl->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+  gl->glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size()*sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+  gl->glBindBuffer(GL_ARRAY_BUFFER, 0);
+  gl->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+}
+
+/* Dynamic part: heights and the per node normals of the grid (see
+   Grid::getNormals), uploaded in orphaned buffers so that the driver never
+   waits for the previous frame. */
+void GridRenderer::upload(const Grid &g) {
+  PROFILE_ZONE("GridRenderer::upload");
+  PerfOverlay::Timer overlay_timer(PerfOverlay::UPLOAD_);
+  int n_nodes = n_rows*n_cols;
+  const float *h = (const float*) g.data();
+  const float *n = (const float*) g.getNormals().data();
+  if (sizeof(FLOAT) != sizeof(float)) {
+    const FLOAT *hg = g.data();
+    const FLOAT *ng = (const FLOAT*) g.getNormals().data();
+    heights.resize(n_nodes);
+    normals.resize(3*(size_t)n_nodes);
+#pragma omp parallel for
+    for (int i = 0; i < n_nodes; ++i) {
+      heights[i] = hg[i];
+      normals[3*i] = ng[3*i];
+      normals[3*i + 1] = ng[3*i + 1];
+      normals[3*i + 2] = ng[3*i + 2];
+    }
+    h = heights.data();
+    n = normals.data();
+  }
+  size_t size = (size_t)n_nodes*sizeof(float);
+  gl->glBindBuffer(GL_ARRAY_BUFFER, height_buffer);
+  gl->glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+  gl->glBufferSubData(GL_ARRAY_BUFFER, 0, size, h);
+  gl->glBindBuffer(GL_ARRAY_BUFFER, normal_buffer);
+  gl->glBufferData(GL_ARRAY_BUFFER, 3*size, NULL, GL_STREAM_DRAW);
+  gl->glBufferSubData(GL_ARRAY_BUFFER, 0, 3*size, n);
+}
+
+/* Switches to the level of detail mode for the next draws, see
+   GridLod::setView */
+void GridRenderer::setView(const double planes[6][4], const double eye[3], double pixel_ratio,
+			   bool perspective, double tolerance) {
+  lod.setView(planes, eye, pixel_ratio, perspective, tolerance);
+  lod_enabled = true;
+}
+
+/* Triangles sent by the last draw */
+int GridRenderer::nbTriangles() const {
+  return lod_enabled ? lod.nbTriangles() : n_indices/3;
+}
+
+/* Returns false if the renderer cannot be used, Grid::draw should be
+   called instead. */
+bool GridRenderer::draw(const Grid &g, float r, float gr, float b) {
+  PROFILE_ZONE("GridRenderer::draw");
+  PerfOverlay::Timer overlay_timer(PerfOverlay::DRAW_);
+  if (!initialized) {
+    init();
+  }
+  if (!supported) {
+    return false;
+  }
+  if (g.isEmpty()) {
+    return true;
+  }
+  if (g.getNbRows() != n_rows || g.getNbCols() != n_cols || g.getCellSize() != cell_size) {
+    create(g.getNbRows(), g.getNbCols(), g.getCellSize());
+  }
+  upload(g);
+
+  gl->glUseProgram(program);
+  gl->glUniform3f(color_loc, r, gr, b);
+  gl_shader::setLights(gl, lights_loc);
+
+  gl->glBindBuffer(GL_ARRAY_BUFFER, xy_buffer);
+  gl->glEnableVertexAttribArray(xy_loc);
+  gl->glVertexAttribPointer(xy_loc, 2, GL_FLOAT, GL_FALSE, 0, NULL);
+  gl->glBindBuffer(GL_ARRAY_BUFFER, height_buffer);
+  gl->glEnableVertexAttribArray(height_loc);
+  gl->glVertexAttribPointer(height_loc, 1, GL_FLOAT, GL_FALSE, 0, NULL);
+  gl->glBindBuffer(GL_ARRAY_BUFFER, normal_buffer);
+  gl->glEnableVertexAttribArray(normal_loc);
+  gl->glVertexAttribPointer(normal_loc, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+
+  if (lod_enabled) {
+    lod.build(g);
+    const std::vector<unsigned int> &tris = lod.triangles();
+    gl->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lod_buffer);
+    gl->glBufferData(GL_ELEMENT_ARRAY_BUFFER, tris.size()*sizeof(GLuint), NULL, GL_STREAM_DRAW);
+    gl->glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, tris.size()*sizeof(GLuint), tris.data());
+    gl->glDrawElements(GL_TRIANGLES, tris.size(), GL_UNSIGNED_INT, NULL);
+  } else {
+    gl->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+    gl->glDrawElements(GL_TRIANGLES, n_indices, GL_UNSIGNED_INT, NULL);
+  }
+
+  gl->glDisableVertexAttribArray(xy_loc);
+  gl->glDisableVertexAttribArray(height_loc);
+  gl->glDisableVertexAttribArray(normal_loc);
+  gl->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  gl->glBindBuffer(GL_ARRAY_BUFFER, 0);
+  gl->glUseProgram(0);
+  return true;
+}
+
+/* Frees the GL objects, the GL context must be current. */
+void GridRenderer::release() {
+  if (supported) {
+    GLuint buffers[5] = {xy_buffer, height_buffer, normal_buffer, index_buffer, lod_buffer};
+    gl->glDeleteBuffers(5, buffers);
+    gl->glDeleteProgram(program);
+  }
+  initialized = false;
+  supported = false;
+  n_rows = 0;
+  n_cols = 0;
+}
@@ -0,0 +1,58 @@
+#ifndef GRIDRENDERER_HPP
+#define GRIDRENDERER_HPP
+
+#include <vector>
+#include "Grid.hpp"
+#include "GridLod.hpp"
+
+class QOpenGLExtraFunctions;
+
+/*
+ * Retained mode renderer of a Grid. The triangle indices and the xy
+ * coordinates of the nodes are uploaded once in static buffers, only the
+ * heights and normals are streamed each frame (orphaned buffers).
+ * Lighting follows the fixed pipeline (color material, enabled lights) so
+ * that the result matches Grid::draw, which stays the fallback when buffer
+ * objects or shaders are not available.
+ * After setView, the triangles are chosen each frame by a GridLod (frustum
+ * culled chunks, decimated with the distance) and streamed as indices.
+ */
+class GridRenderer {
+private:
+  QOpenGLExtraFunctions *gl;
+  bool initialized;
+  bool supported;
+
+  int n_rows, n_cols;
+  FLOAT cell_size;
+  int n_indices;
+
+  GLuint program;
+  GLuint xy_buffer, height_buffer, normal_buffer, index_buffer, lod_buffer;
+  GLint xy_loc, height_loc, normal_loc;
+  GLint color_loc, lights_loc;
+
+  // conversion buffers, only used when FLOAT is not float
+  std::vector<float> heights;
+  std::vector<float> normals;
+
+  bool lod_enabled;
+  GridLod lod;
+
+  bool init();
+  void create(int nr, int nc, FLOAT cs);
+  void upload(const Grid &g);
+
+public:
+  GridRenderer();
+  ~GridRenderer();
+
+  bool isSupported() const;
+  void setView(const double planes[6][4], const double eye[3], double pixel_ratio,
+	       bool perspective, double tolerance);
+  int nbTriangles() const;
+  bool draw(const Grid &g, float r, float gr, float b);
+  void release();
+};
+
+#endif
@@ -0,0 +1,168 @@
+#include "GridSimplifier.hpp"
+#include "error.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <omp.h>
+
+namespace {
+
+  // blocks larger than this (in nodes) are subdivided in parallel tasks
+  const long task_nodes = 64*64;
+
+}
+
+GridSimplifier::GridSimplifier(const Grid &g, FLOAT tol): grid(g) {
+  n_rows = g.getNbRows();
+  n_cols = g.getNbCols();
+  tolerance = tol;
+}
+
+/* Largest difference between the heights of the nodes of the block and the
+   four triangles (center, corner, corner) covering it */
+FLOAT GridSimplifier::error(const Block &b) const {
+  const FLOAT *h = grid.data();
+  int ci = (b.i0 + b.i1)/2, cj = (b.j0 + b.j1)/2;
+  // triangle vertices: center then the corners in boundary order
+  int pi[5] = {b.i0, b.i1, b.i1, b.i0, b.i0};
+  int pj[5] = {b.j0, b.j0, b.j1, b.j1, b.j0};
+  FLOAT hc = h[ci*n_cols + cj];
+  FLOAT err = 0;
+  for (int i = b.i0; i <= b.i1; ++i) {
+    for (int j = b.j0; j <= b.j1; ++j) {
+      for (int t = 0; t < 4; ++t) {
+	// barycentric coordinates of (i, j) in (center, p[t], p[t+1])
+	FLOAT x1 = pi[t] - ci, y1 = pj[t] - cj;
+	FLOAT x2 = pi[t+1] - ci, y2 = pj[t+1] - cj;
+	FLOAT x = i - ci, y = j - cj;
+	FLOAT det = x1*y2 - x2*y1;
+	FLOAT l1 = (x*y2 - x2*y)/det, l2 = (x1*y - x*y1)/det;
+	if (l1 >= -1e-6 && l2 >= -1e-6 && l1 + l2 <= 1 + 1e-6) {
+	  FLOAT approx = (1 - l1 - l2)*hc + l1*h[pi[t]*n_cols + pj[t]] + l2*h[pi[t+1]*n_cols + pj[t+1]];
+	  err = std::max(err, std::abs(approx - h[i*n_cols + j]));
+	  break;
+	}
+      }
+      if (err > tolerance) {
+	return err;
+      }
+    }
+  }
+  return err;
+}
+
+/* A block is kept if it is a single cell, or if it has a center node and
+   is within the tolerance. Blocks one cell wide have no center node and are
+   split down to single cells. */
+void GridSimplifier::subdivide(Block b) {
+  int di = b.i1 - b.i0, dj = b.j1 - b.j0;
+  bool leaf = (di == 1 && dj == 1) || (di >= 2 && dj >= 2 && error(b) <= tolerance);
+  if (leaf) {
+#pragma omp critical(simplifier_blocks)
+    blocks.push_back(b);
+    return;
+  }
+  int mi = di >= 2 ? (b.i0 + b.i1)/2 : b.i1;
+  int mj = dj >= 2 ? (b.j0 + b.j1)/2 : b.j1;
+  Block children[4] = {{b.i0, b.j0, mi, mj}, {mi, b.j0, b.i1, mj},
+		       {b.i0, mj, mi, b.j1}, {mi, mj, b.i1, b.j1}};
+  bool task = (long)di*dj > task_nodes;
+  for (int c = 0; c < 4; ++c) {
+    Block &child = children[c];
+    if (child.i1 <= child.i0 || child.j1 <= child.j0) {
+      continue;
+    }
+#pragma omp task firstprivate(child) if(task)
+    subdivide(child);
+  }
+#pragma omp taskwait
+}
+
+/* Fan from the center of the block (or the two triangles of a cell) through
+   the active vertices of its boundary */
+void GridSimplifier::fan(const Block &b, std::vector<int> &out) const {
+  if (b.i1 - b.i0 == 1 && b.j1 - b.j0 == 1) {
+    int idx = b.i0*n_cols + b.j0;
+    int quad[6] = {idx, idx + n_cols, idx + n_cols + 1, idx + n_cols + 1, idx + 1, idx};
+    out.insert(out.end(), quad, quad + 6);
+    return;
+  }
+  std::vector<int> boundary;
+  for (int i = b.i0; i < b.i1; ++i) {
+    if (active[i*n_cols + b.j0]) boundary.push_back(i*n_cols + b.j0);
+  }
+  for (int j = b.j0; j < b.j1; ++j) {
+    if (active[b.i1*n_cols + j]) boundary.push_back(b.i1*n_cols + j);
+  }
+  for (int i = b.i1; i > b.i0; --i) {
+    if (active[i*n_cols + b.j1]) boundary.push_back(i*n_cols + b.j1);
+  }
+  for (int j = b.j1; j > b.j0; --j) {
+    if (active[b.i0*n_cols + j]) boundary.push_back(b.i0*n_cols + j);
+  }
+  int center = ((b.i0 + b.i1)/2)*n_cols + (b.j0 + b.j1)/2;
+  int n = boundary.size();
+  for (int k = 0; k < n; ++k) {
+    out.push_back(center);
+    out.push_back(boundary[k]);
+    out.push_back(boundary[(k + 1)%n]);
+  }
+}
+
+void GridSimplifier::build() {
+  blocks.clear();
+  tris.clear();
+  if (n_rows < 2 || n_cols < 2) {
+    return;
+  }
+#pragma omp parallel
+#pragma omp single
+  subdivide({0, 0, n_rows - 1, n_cols - 1});
+
+  active = std::vector<char>((size_t)n_rows*n_cols, 0);
+  for (const Block &b : blocks) {
+    active[b.i0*n_cols + b.j0] = 1;
+    active[b.i1*n_cols + b.j0] = 1;
+    active[b.i0*n_cols + b.j1] = 1;
+    active[b.i1*n_cols + b.j1] = 1;
+  }
+
+  int n_threads = omp_get_max_threads();
+  std::vector<std::vector<int> > parts(n_threads);
+#pragma omp parallel
+  {
+    std::vector<int> &part = parts[omp_get_thread_num()];
+#pragma omp for schedule(dynamic, 64)
+    for (int k = 0; k < (int)blocks.size(); ++k) {
+      fan(blocks[k], part);
+    }
+  }
+  for (auto &part : parts) {
+    tris.insert(tris.end(), part.begin(), part.end());
+  }
+  INFO("Simplified grid: "<<nbTriangles()<<" triangles instead of "<<2*(n_rows - 1)*(n_cols - 1));
+}
+
+int GridSimplifier::nbTriangles() const {
+  return tris.size()/3;
+}
+
+/* Node indices (n_cols*i + j), three per triangle */
+const std::vector<int> &GridSimplifier::triangles() const {
+  return tris;
+}
+
+#ifndef WD_HEADLESS
+void GridSimplifier::draw(float r, float g, float b) const {
+  const std::vector<VEC3> &n = grid.getNormals();
+  const FLOAT *h = grid.data();
+  FLOAT cs = grid.getCellSize();
+  glBegin(GL_TRIANGLES);
+  glColor3f(r, g, b);
+  for (int idx : tris) {
+    glNormal3f(n[idx](0), n[idx](1), n[idx](2));
+    glVertex3f((idx/n_cols)*cs, (idx%n_cols)*cs, h[idx]);
+  }
+  glEnd();
+}
+#endif
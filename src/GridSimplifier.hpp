@@ -0,0 +1,48 @@
+#ifndef GRIDSIMPLIFIER_HPP
+#define GRIDSIMPLIFIER_HPP
+
+#include <vector>
+#include "Grid.hpp"
+
+/*
+ * Adaptive triangulation of a heightfield within a height tolerance, used
+ * to send a few thousand triangles instead of the full grid to the vector
+ * (EPS, SVG, FIG) exporters.
+ * A quadtree is built over the cells: a block is kept if the four triangles
+ * joining its corners to its center reproduce every node inside it within
+ * the tolerance, flat areas end up in large blocks and curved ones in small
+ * blocks. The corners of the blocks are marked in an active vertex bitmap
+ * and each block is triangulated as a fan from its center through every
+ * active vertex of its boundary, so that neighbouring blocks of different
+ * sizes share the same edge vertices (no cracks).
+ */
+class GridSimplifier {
+private:
+  const Grid &grid;
+  int n_rows, n_cols;
+  FLOAT tolerance;
+
+  struct Block {
+    int i0, j0, i1, j1;
+  };
+  std::vector<Block> blocks;
+  std::vector<char> active;
+  std::vector<int> tris;
+
+  FLOAT error(const Block &b) const;
+  void subdivide(Block b);
+  void fan(const Block &b, std::vector<int> &out) const;
+
+public:
+  GridSimplifier(const Grid &g, FLOAT tol);
+
+  void build();
+  int nbTriangles() const;
+  const std::vector<int> &triangles() const;
+
+#ifndef WD_HEADLESS
+  void draw(float r, float g, float b) const;
+#endif
+};
+
+#endif
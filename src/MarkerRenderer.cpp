@@ -0,0 +1,161 @@
+#include "MarkerRenderer.hpp"
+#include "GLShader.hpp"
+#include "Sphere.hpp"
+#include "error.hpp"
+
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+
+namespace {
+
+  const char *vertex_shader =
+    "attribute vec3 vertex;\n"
+    "attribute vec3 normal;\n"
+    "attribute vec3 position;\n"
+    "attribute vec3 color;\n"
+    "uniform float size;\n"
+    "varying vec3 shade;\n"
+    "void main() {\n"
+    "  vec4 p = gl_ModelViewMatrix*vec4(position + size*vertex, 1.0);\n"
+    "  shade = color*lighting(p.xyz, normalize(gl_NormalMatrix*normal));\n"
+    "  gl_Position = gl_ProjectionMatrix*p;\n"
+    "}\n";
+
+  const char *fragment_shader =
+    "varying vec3 shade;\n"
+    "void main() {\n"
+    "  gl_FragColor = vec4(shade, 1.0);\n"
+    "}\n";
+
+}
+
+MarkerRenderer::MarkerRenderer() {
+  gl = NULL;
+  initialized = false;
+  supported = false;
+  program = 0;
+  vertex_buffer = normal_buffer = position_buffer = color_buffer = 0;
+  n_instances = 0;
+  dirty = true;
+}
+
+MarkerRenderer::~MarkerRenderer() {}
+
+bool MarkerRenderer::init() {
+  initialized = true;
+  QOpenGLContext *context = QOpenGLContext::currentContext();
+  if (context == NULL) {
+    return false;
+  }
+  if (context->format().version() < qMakePair(3, 3) &&
+      !context->hasExtension("GL_ARB_instanced_arrays")) {
+    WARNING(false, "MarkerRenderer: no instanced arrays, using immediate mode", "");
+    return false;
+  }
+  gl = context->extraFunctions();
+  program = gl_shader::createProgram(gl, vertex_shader, fragment_shader);
+  if (program == 0) {
+    WARNING(false, "MarkerRenderer: using immediate mode", "");
+    return false;
+  }
+  vertex_loc = gl->glGetAttribLocation(program, "vertex");
+  normal_loc = gl->glGetAttribLocation(program, "normal");
+  position_loc = gl->glGetAttribLocation(program, "position");
+  color_loc = gl->glGetAttribLocation(program, "color");
+  size_loc = gl->glGetUniformLocation(program, "size");
+  lights_loc = gl->glGetUniformLocation(program, "lights");
+
+  GLuint buffers[4];
+  gl->glGenBuffers(4, buffers);
+  vertex_buffer = buffers[0];
+  normal_buffer = buffers[1];
+  position_buffer = buffers[2];
+  color_buffer = buffers[3];
+
+  gl->glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+  gl->glBufferData(GL_ARRAY_BUFFER, Sphere::arraySize()*sizeof(GLfloat), Sphere::getVertices(), GL_STATIC_DRAW);
+  gl->glBindBuffer(GL_ARRAY_BUFFER, normal_buffer);
+  gl->glBufferData(GL_ARRAY_BUFFER, Sphere::arraySize()*sizeof(GLfloat), Sphere::getNormals(), GL_STATIC_DRAW);
+  gl->glBindBuffer(GL_ARRAY_BUFFER, 0);
+  supported = true;
+  dirty = true;
+  return true;
+}
+
+void MarkerRenderer::clear() {
+  positions.clear();
+  colors.clear();
+  dirty = true;
+}
+
+void MarkerRenderer::addMarker(VEC3 pos, float r, float g, float b) {
+  positions.push_back(pos(0));
+  positions.push_back(pos(1));
+  positions.push_back(pos(2));
+  colors.push_back(r);
+  colors.push_back(g);
+  colors.push_back(b);
+  dirty = true;
+}
+
+int MarkerRenderer::nbMarkers() const {
+  return positions.size()/3;
+}
+
+/* Returns false if instancing is not available, the markers should then
+   be drawn one by one with Sphere::draw. */
+bool MarkerRenderer::draw(float size) {
+  if (!initialized) {
+    init();
+  }
+  if (!supported) {
+    return false;
+  }
+  if (dirty) {
+    n_instances = nbMarkers();
+    gl->glBindBuffer(GL_ARRAY_BUFFER, position_buffer);
+    gl->glBufferData(GL_ARRAY_BUFFER, positions.size()*sizeof(float), positions.data(), GL_STATIC_DRAW);
+    gl->glBindBuffer(GL_ARRAY_BUFFER, color_buffer);
+    gl->glBufferData(GL_ARRAY_BUFFER, colors.size()*sizeof(float), colors.data(), GL_STATIC_DRAW);
+    dirty = false;
+  }
+  if (n_instances == 0) {
+    gl->glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return true;
+  }
+
+  gl->glUseProgram(program);
+  gl->glUniform1f(size_loc, size);
+  gl_shader::setLights(gl, lights_loc);
+
+  GLint locations[4] = {vertex_loc, normal_loc, position_loc, color_loc};
+  GLuint buffers[4] = {vertex_buffer, normal_buffer, position_buffer, color_buffer};
+  for (int k = 0; k < 4; ++k) {
+    gl->glBindBuffer(GL_ARRAY_BUFFER, buffers[k]);
+    gl->glEnableVertexAttribArray(locations[k]);
+    gl->glVertexAttribPointer(locations[k], 3, GL_FLOAT, GL_FALSE, 0, NULL);
+    gl->glVertexAttribDivisor(locations[k], k < 2 ? 0 : 1);
+  }
+
+  gl->glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, Sphere::arraySize()/3, n_instances);
+
+  for (int k = 0; k < 4; ++k) {
+    gl->glVertexAttribDivisor(locations[k], 0);
+    gl->glDisableVertexAttribArray(locations[k]);
+  }
+  gl->glBindBuffer(GL_ARRAY_BUFFER, 0);
+  gl->glUseProgram(0);
+  return true;
+}
+
+/* Frees the GL objects, the GL context must be current. */
+void MarkerRenderer::release() {
+  if (supported) {
+    GLuint buffers[4] = {vertex_buffer, normal_buffer, position_buffer, color_buffer};
+    gl->glDeleteBuffers(4, buffers);
+    gl->glDeleteProgram(program);
+  }
+  initialized = false;
+  supported = false;
+  dirty = true;
+}
@@ -0,0 +1,45 @@
+#ifndef MARKERRENDERER_HPP
+#define MARKERRENDERER_HPP
+
+#include <vector>
+#include "definitions.hpp"
+#include "Object.hpp"
+
+class QOpenGLExtraFunctions;
+
+/*
+ * Draws many spheres (sources, constraints...) in a single instanced call.
+ * The Sphere vertex and normal arrays are uploaded once; the per instance
+ * positions and colors are uploaded again only after setMarkers.
+ */
+class MarkerRenderer {
+private:
+  QOpenGLExtraFunctions *gl;
+  bool initialized;
+  bool supported;
+
+  GLuint program;
+  GLuint vertex_buffer, normal_buffer, position_buffer, color_buffer;
+  GLint vertex_loc, normal_loc, position_loc, color_loc;
+  GLint size_loc, lights_loc;
+
+  std::vector<float> positions;
+  std::vector<float> colors;
+  int n_instances;
+  bool dirty;
+
+  bool init();
+
+public:
+  MarkerRenderer();
+  ~MarkerRenderer();
+
+  void clear();
+  void addMarker(VEC3 pos, float r, float g, float b);
+  int nbMarkers() const;
+
+  bool draw(float size);
+  void release();
+};
+
+#endif
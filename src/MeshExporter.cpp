@@ -0,0 +1,234 @@
+#include "MeshExporter.hpp"
+#include "Profiler.hpp"
+#include "error.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include <omp.h>
+
+namespace {
+
+  inline char *writeFloat(char *p, float v) {
+    return std::to_chars(p, p + 32, v).ptr;
+  }
+
+  inline char *writeInt(char *p, unsigned int v) {
+    return std::to_chars(p, p + 16, v).ptr;
+  }
+
+}
+
+MeshExporter::MeshExporter(int nr, int nc, const VEC3 *v) {
+  n_rows = nr;
+  n_cols = nc;
+  quad_rows = std::max(0, nr - 1);
+  quad_cols = std::max(0, nc - 1);
+  vertices = v;
+  normals = NULL;
+}
+
+void MeshExporter::setQuads(int qr, int qc) {
+  quad_rows = std::max(0, std::min(qr, n_rows - 1));
+  quad_cols = std::max(0, std::min(qc, n_cols - 1));
+}
+
+void MeshExporter::setNormals(const VEC3 *n) {
+  normals = n;
+}
+
+void MeshExporter::setComment(std::string c) {
+  comment = c;
+}
+
+int MeshExporter::nbTriangles() const {
+  return 2*quad_rows*quad_cols;
+}
+
+/* 0-based vertex indices of the two triangles of quad q */
+inline void MeshExporter::triangles(int q, unsigned int *tri) const {
+  unsigned int idx = (q/quad_cols)*n_cols + q%quad_cols;
+  unsigned int J = 1, I = n_cols;
+  tri[0] = idx;     tri[1] = idx + J; tri[2] = idx + I;
+  tri[3] = idx + I; tri[4] = idx + J; tri[5] = idx + I + J;
+}
+
+/* Formats items [0, n) by chunks of <chunk> items in parallel and writes
+   the chunks in order. At most a few chunks per thread are kept in memory. */
+void MeshExporter::writeChunks(std::ostream &os, int n, int chunk, formatter_t format) const {
+  int n_chunks = (n + chunk - 1)/chunk;
+  int batch = 4*omp_get_max_threads();
+  std::vector<std::string> buffers(batch);
+  for (int b0 = 0; b0 < n_chunks; b0 += batch) {
+    int b1 = std::min(n_chunks, b0 + batch);
+#pragma omp parallel for schedule(dynamic)
+    for (int c = b0; c < b1; ++c) {
+      format(c*chunk, std::min(n, (c + 1)*chunk), buffers[c - b0]);
+    }
+    for (int c = b0; c < b1; ++c) {
+      os.write(buffers[c - b0].data(), buffers[c - b0].size());
+    }
+  }
+}
+
+std::ostream& MeshExporter::writeObj(std::ostream &os) const {
+  if (!comment.empty()) {
+    os << "# "<<comment<<"\n";
+  }
+  int chunk = chunk_rows*n_cols;
+  writeChunks(os, n_rows*n_cols, chunk, [this](int first, int last, std::string &buf) {
+      buf.resize((size_t)(last - first)*(normals ? 2 : 1)*56);
+      char *p = &buf[0];
+      for (int v = first; v < last; ++v) {
+	const VEC3 &x = vertices[v];
+	*p++ = 'v'; *p++ = ' ';
+	p = writeFloat(p, x(0)); *p++ = ' ';
+	p = writeFloat(p, x(1)); *p++ = ' ';
+	p = writeFloat(p, x(2)); *p++ = '\n';
+      }
+      if (normals) {
+	for (int v = first; v < last; ++v) {
+	  const VEC3 &n = normals[v];
+	  *p++ = 'v'; *p++ = 'n'; *p++ = ' ';
+	  p = writeFloat(p, n(0)); *p++ = ' ';
+	  p = writeFloat(p, n(1)); *p++ = ' ';
+	  p = writeFloat(p, n(2)); *p++ = '\n';
+	}
+      }
+      buf.resize(p - buf.data());
+    });
+
+  chunk = std::max(1, chunk_rows*quad_cols);
+  writeChunks(os, quad_rows*quad_cols, chunk, [this](int first, int last, std::string &buf) {
+      buf.resize((size_t)(last - first)*2*(normals ? 72 : 40));
+      char *p = &buf[0];
+      unsigned int tri[6];
+      for (int q = first; q < last; ++q) {
+	triangles(q, tri);
+	for (int t = 0; t < 6; t += 3) {
+	  *p++ = 'f';
+	  for (int k = 0; k < 3; ++k) {
+	    *p++ = ' ';
+	    p = writeInt(p, tri[t+k] + 1);
+	    if (normals) {
+	      *p++ = '/'; *p++ = '/';
+	      p = writeInt(p, tri[t+k] + 1);
+	    }
+	  }
+	  *p++ = '\n';
+	}
+      }
+      buf.resize(p - buf.data());
+    });
+  return os;
+}
+
+/* Binary little endian PLY, float positions (and normals), int indices. */
+std::ostream& MeshExporter::writePly(std::ostream &os) const {
+  os << "ply\nformat binary_little_endian 1.0\n";
+  if (!comment.empty()) {
+    os << "comment "<<comment<<"\n";
+  }
+  os << "element vertex "<<n_rows*n_cols<<"\n";
+  os << "property float x\nproperty float y\nproperty float z\n";
+  if (normals) {
+    os << "property float nx\nproperty float ny\nproperty float nz\n";
+  }
+  os << "element face "<<nbTriangles()<<"\n";
+  os << "property list uchar int vertex_indices\nend_header\n";
+
+  int n_floats = normals ? 6 : 3;
+  writeChunks(os, n_rows*n_cols, chunk_rows*n_cols, [this, n_floats](int first, int last, std::string &buf) {
+      buf.resize((size_t)(last - first)*n_floats*sizeof(float));
+      float *p = (float*) &buf[0];
+      for (int v = first; v < last; ++v) {
+	*p++ = vertices[v](0); *p++ = vertices[v](1); *p++ = vertices[v](2);
+	if (normals) {
+	  *p++ = normals[v](0); *p++ = normals[v](1); *p++ = normals[v](2);
+	}
+      }
+    });
+
+  writeChunks(os, quad_rows*quad_cols, std::max(1, chunk_rows*quad_cols), [this](int first, int last, std::string &buf) {
+      const size_t face_size = 1 + 3*sizeof(int32_t);
+      buf.resize((size_t)(last - first)*2*face_size);
+      char *p = &buf[0];
+      unsigned int tri[6];
+      for (int q = first; q < last; ++q) {
+	triangles(q, tri);
+	for (int t = 0; t < 6; t += 3) {
+	  *p++ = 3;
+	  std::memcpy(p, &tri[t], 3*sizeof(int32_t));
+	  p += 3*sizeof(int32_t);
+	}
+      }
+    });
+  return os;
+}
+
+/* Raw indexed triangle list: "WDMESH01", uint32 nb vertices, nb triangles,
+   has normals, then float32 positions, float32 normals and uint32 indices. */
+std::ostream& MeshExporter::writeIndexed(std::ostream &os) const {
+  uint32_t header[3] = {(uint32_t)(n_rows*n_cols), (uint32_t)nbTriangles(), normals ? 1u : 0u};
+  os.write("WDMESH01", 8);
+  os.write((const char*)header, sizeof(header));
+
+  writeChunks(os, n_rows*n_cols, chunk_rows*n_cols, [this](int first, int last, std::string &buf) {
+      buf.resize((size_t)(last - first)*3*sizeof(float));
+      float *p = (float*) &buf[0];
+      for (int v = first; v < last; ++v) {
+	*p++ = vertices[v](0); *p++ = vertices[v](1); *p++ = vertices[v](2);
+      }
+    });
+  if (normals) {
+    writeChunks(os, n_rows*n_cols, chunk_rows*n_cols, [this](int first, int last, std::string &buf) {
+	buf.resize((size_t)(last - first)*3*sizeof(float));
+	float *p = (float*) &buf[0];
+	for (int v = first; v < last; ++v) {
+	  *p++ = normals[v](0); *p++ = normals[v](1); *p++ = normals[v](2);
+	}
+      });
+  }
+  writeChunks(os, quad_rows*quad_cols, std::max(1, chunk_rows*quad_cols), [this](int first, int last, std::string &buf) {
+      buf.resize((size_t)(last - first)*6*sizeof(uint32_t));
+      unsigned int *p = (unsigned int*) &buf[0];
+      for (int q = first; q < last; ++q) {
+	triangles(q, p);
+	p += 6;
+      }
+    });
+  return os;
+}
+
+void MeshExporter::write(std::string file, format_t format) const {
+  PROFILE_ZONE("MeshExporter::write");
+  VERBOSE(1, "Exporting mesh: "<<file);
+  std::ofstream os(file.c_str(), std::ios::binary);
+  ERROR(os.good(), "Cannot open file "<<file, "");
+  switch (format) {
+  case OBJ_:
+    writeObj(os);
+    break;
+  case PLY_:
+    writePly(os);
+    break;
+  default:
+    writeIndexed(os);
+    break;
+  }
+  ERROR(os.good(), "Error while writing "<<file, "");
+  os.close();
+}
+
+MeshExporter::format_t MeshExporter::format(std::string file) {
+  std::string ext = file.substr(file.find_last_of('.') + 1);
+  if (ext == "obj") {
+    return OBJ_;
+  } else if (ext == "ply") {
+    return PLY_;
+  }
+  return INDEXED_;
+}
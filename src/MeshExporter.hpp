@@ -0,0 +1,52 @@
+#ifndef MESHEXPORTER_HPP
+#define MESHEXPORTER_HPP
+
+#include <functional>
+#include <ostream>
+#include <string>
+#include "definitions.hpp"
+
+/*
+ * Writes a regular n_rows x n_cols mesh (row major vertices, two triangles
+ * per quad) as OBJ text, binary PLY or a raw indexed triangle list.
+ * Rows are formatted by chunks in parallel into per-chunk buffers which are
+ * then written in order.
+ */
+class MeshExporter {
+public:
+  enum format_t {OBJ_ = 0,
+		 PLY_,
+		 INDEXED_,
+		 nFormats};
+
+private:
+  int n_rows, n_cols;
+  int quad_rows, quad_cols;
+  const VEC3 *vertices;
+  const VEC3 *normals;
+  std::string comment;
+
+  static const int chunk_rows = 16;
+
+  typedef std::function<void(int first, int last, std::string &buf)> formatter_t;
+  void writeChunks(std::ostream &os, int n, int chunk, formatter_t format) const;
+  void triangles(int q, unsigned int *tri) const;
+
+public:
+  MeshExporter(int nr, int nc, const VEC3 *v);
+
+  void setQuads(int qr, int qc);
+  void setNormals(const VEC3 *n);
+  void setComment(std::string c);
+
+  int nbTriangles() const;
+
+  std::ostream& writeObj(std::ostream &os) const;
+  std::ostream& writePly(std::ostream &os) const;
+  std::ostream& writeIndexed(std::ostream &os) const;
+
+  void write(std::string file, format_t format) const;
+  static format_t format(std::string file);
+};
+
+#endif
@@ -0,0 +1,143 @@
+#include "MitsubaExporter.hpp"
+#include "Deflate.hpp"
+#include "Profiler.hpp"
+#include "error.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+  const uint16_t format_id = 0x041C;
+  const uint16_t format_version = 4;
+  const uint32_t vertex_normals = 0x0001;
+  const uint32_t single_precision = 0x1000;
+
+}
+
+MitsubaExporter::MitsubaExporter() {
+  n_rows = 0;
+  n_cols = 0;
+  quad_rows = 0;
+  quad_cols = 0;
+  level = 1;
+  topology_adler = adler32(0L, Z_NULL, 0);
+  topology_size = 0;
+}
+
+/* Mesh of nr x nc vertices whose first qr x qc quads are triangulated; the
+   indices are only compressed again if one of them has changed */
+void MitsubaExporter::setGrid(int nr, int nc, int qr, int qc) {
+  qr = std::max(0, std::min(qr, nr - 1));
+  qc = std::max(0, std::min(qc, nc - 1));
+  if (nr == n_rows && nc == n_cols && qr == quad_rows && qc == quad_cols && !topology.empty()) {
+    return;
+  }
+  n_rows = nr;
+  n_cols = nc;
+  quad_rows = qr;
+  quad_cols = qc;
+  compressTopology();
+}
+
+/* zlib level, the same for the indices and the vertices */
+void MitsubaExporter::setLevel(int l) {
+  l = std::max(0, std::min(9, l));
+  if (l != level) {
+    level = l;
+    compressTopology();
+  }
+}
+
+int MitsubaExporter::nbTriangles() const {
+  return 2*quad_rows*quad_cols;
+}
+
+/* Same triangles as MeshExporter, two per quad */
+void MitsubaExporter::compressTopology() {
+  PROFILE_ZONE("MitsubaExporter::compressTopology");
+  int n_quads = quad_rows*quad_cols;
+  std::vector<uint32_t> indices(6*(size_t)n_quads);
+#pragma omp parallel for
+  for (int q = 0; q < n_quads; ++q) {
+    uint32_t idx = (q/quad_cols)*n_cols + q%quad_cols;
+    uint32_t J = 1, I = n_cols;
+    uint32_t *tri = &indices[6*(size_t)q];
+    tri[0] = idx;     tri[1] = idx + J; tri[2] = idx + I;
+    tri[3] = idx + I; tri[4] = idx + J; tri[5] = idx + I + J;
+  }
+  topology.clear();
+  topology_size = indices.size()*sizeof(uint32_t);
+  Deflate::raw((const unsigned char*)indices.data(), topology_size, topology, true, &topology_adler, level);
+}
+
+/* One shape at the current position of os: only the positions and normals
+   are compressed, then followed by the stream of the indices */
+std::ostream& MitsubaExporter::writeShape(std::ostream &os, const std::string &name,
+					  const VEC3 *vertices, const VEC3 *normals) const {
+  PROFILE_ZONE("MitsubaExporter::writeShape");
+  uint64_t n_vertices = (uint64_t)n_rows*n_cols, n_triangles = nbTriangles();
+  uint32_t flags = single_precision | (normals ? vertex_normals : 0);
+  std::vector<unsigned char> head(sizeof(flags) + name.size() + 1 + 2*sizeof(uint64_t));
+  unsigned char *h = head.data();
+  std::memcpy(h, &flags, sizeof(flags));
+  h += sizeof(flags);
+  std::memcpy(h, name.c_str(), name.size() + 1);
+  h += name.size() + 1;
+  std::memcpy(h, &n_vertices, sizeof(n_vertices));
+  std::memcpy(h + sizeof(n_vertices), &n_triangles, sizeof(n_triangles));
+
+  size_t n = n_vertices;
+  std::vector<float> values((normals ? 6 : 3)*n);
+#pragma omp parallel for
+  for (size_t v = 0; v < n; ++v) {
+    for (int k = 0; k < 3; ++k) {
+      values[3*v + k] = vertices[v](k);
+      if (normals) {
+	values[3*(n + v) + k] = normals[v](k);
+      }
+    }
+  }
+
+  // zlib header as Deflate::zlib, then the three raw streams
+  std::vector<unsigned char> stream;
+  stream.push_back(0x78);
+  stream.push_back(0x9c);
+  uLong adler_head, adler_values;
+  size_t values_size = values.size()*sizeof(float);
+  Deflate::raw(head.data(), head.size(), stream, false, &adler_head, level);
+  Deflate::raw((const unsigned char*)values.data(), values_size, stream, false, &adler_values, level);
+  uLong adler = adler32_combine(adler_head, adler_values, values_size);
+  adler = adler32_combine(adler, topology_adler, topology_size);
+  unsigned char trailer[4] = {(unsigned char)(adler >> 24), (unsigned char)(adler >> 16),
+			      (unsigned char)(adler >> 8), (unsigned char)adler};
+
+  os.write((const char*)&format_id, sizeof(format_id));
+  os.write((const char*)&format_version, sizeof(format_version));
+  os.write((const char*)stream.data(), stream.size());
+  os.write((const char*)topology.data(), topology.size());
+  os.write((const char*)trailer, sizeof(trailer));
+  return os;
+}
+
+std::ostream& MitsubaExporter::writeDictionary(std::ostream &os, const std::vector<uint64_t> &offsets) {
+  uint32_t count = offsets.size();
+  os.write((const char*)offsets.data(), offsets.size()*sizeof(uint64_t));
+  os.write((const char*)&count, sizeof(count));
+  return os;
+}
+
+/* File holding a single shape */
+void MitsubaExporter::write(std::string file, const std::string &name,
+			    const VEC3 *vertices, const VEC3 *normals) const {
+  PROFILE_ZONE("MitsubaExporter::write");
+  VERBOSE(1, "Exporting Mitsuba mesh: "<<file);
+  ERROR(!topology.empty(), "Cannot export "<<file, "no grid set");
+  std::ofstream os(file.c_str(), std::ios::binary);
+  ERROR(os.good(), "Cannot open file "<<file, "");
+  writeShape(os, name, vertices, normals);
+  writeDictionary(os, std::vector<uint64_t>(1, 0));
+  ERROR(os.good(), "Error while writing "<<file, "");
+  os.close();
+}
@@ -0,0 +1,51 @@
+#ifndef MITSUBAEXPORTER_HPP
+#define MITSUBAEXPORTER_HPP
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include "definitions.hpp"
+
+/*
+ * Writes a regular n_rows x n_cols mesh (as MeshExporter) in the Mitsuba
+ * serialized format: per shape uint16 0x041C, uint16 version 4, then a zlib
+ * stream of uint32 flags (0x1001: vertex normals, single precision), the
+ * name (UTF-8, null terminated), uint64 nb vertices and nb triangles,
+ * float32 positions, float32 normals and uint32 indices. The file ends with
+ * the uint64 offsets of the shapes and their uint32 count.
+ *
+ * The indices do not change from a frame to the next: their deflate stream
+ * is computed once (setGrid) and appended to the stream of the positions
+ * and normals of every shape, the adler32 checksums being combined.
+ */
+class MitsubaExporter {
+private:
+  int n_rows, n_cols;
+  int quad_rows, quad_cols;
+  int level;
+
+  // raw deflate stream of the indices, adler32 and size of the indices
+  std::vector<unsigned char> topology;
+  uLong topology_adler;
+  size_t topology_size;
+
+  void compressTopology();
+
+public:
+  MitsubaExporter();
+
+  void setGrid(int nr, int nc, int qr, int qc);
+  void setLevel(int l);
+
+  int nbTriangles() const;
+
+  std::ostream& writeShape(std::ostream &os, const std::string &name,
+			   const VEC3 *vertices, const VEC3 *normals) const;
+  static std::ostream& writeDictionary(std::ostream &os, const std::vector<uint64_t> &offsets);
+
+  void write(std::string file, const std::string &name, const VEC3 *vertices, const VEC3 *normals) const;
+};
+
+#endif
@@ -1,7 +1,10 @@
 #ifndef OBJECT_HPP
 #define OBJECT_HPP
 
+// WD_HEADLESS: batch build without Qt, OpenGL nor SDL (see batch/)
+#ifndef WD_HEADLESS
 #include <QGLViewer/qglviewer.h>
+#endif
 
 
 class Object {
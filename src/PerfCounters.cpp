@@ -0,0 +1,164 @@
+#include "PerfCounters.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+  const char *names[PerfCounters::nCounters_] = {"cycles", "instructions", "LLC misses", "FP vector ops"};
+
+  std::atomic<uint64_t> raw_event(0x3cc7);
+
+  // counters opened by at least one thread, and why some could not be
+  std::atomic<unsigned> opened(0);
+  std::mutex status_mutex;
+  std::string last_error;
+
+  // counters of the calling thread: one group, read at once
+  struct ThreadCounters {
+    bool tried = false;
+    int leader = -1;
+    int fds[PerfCounters::nCounters_] = {-1, -1, -1, -1};
+    int slot[PerfCounters::nCounters_] = {-1, -1, -1, -1}; // position in the group read
+    int n_open = 0;
+    ~ThreadCounters() {PerfCounters::close();}
+  };
+
+  thread_local ThreadCounters local;
+
+  void setError(const std::string &e) {
+    std::lock_guard<std::mutex> lock(status_mutex);
+    last_error = e;
+  }
+
+}
+
+const char *PerfCounters::name(int c) {
+  return names[c];
+}
+
+/* Raw event (model specific) counted as FP_VECTOR_ by the threads that
+   open their counters afterwards */
+void PerfCounters::setRawEvent(uint64_t config) {
+  raw_event = config;
+}
+
+/* Opens the counters of the calling thread, returns false if none could
+   be opened. Only tried once per thread. */
+bool PerfCounters::open() {
+#ifdef __linux__
+  if (local.tried) {
+    return local.n_open > 0;
+  }
+  local.tried = true;
+  for (int c = 0; c < nCounters_; ++c) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    switch (c) {
+    case CYCLES_:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_CPU_CYCLES;
+      break;
+    case INSTRUCTIONS_:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+      break;
+    case LLC_MISSES_:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_CACHE_MISSES;
+      break;
+    default:
+      attr.type = PERF_TYPE_RAW;
+      attr.config = raw_event;
+    }
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.disabled = local.leader < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    int fd = syscall(__NR_perf_event_open, &attr, 0, -1, local.leader, 0);
+    if (fd < 0) {
+      setError(std::string(names[c]) + ": " + std::strerror(errno)
+	       + (errno == EACCES || errno == EPERM ? " (see /proc/sys/kernel/perf_event_paranoid)" : ""));
+      continue;
+    }
+    if (local.leader < 0) {
+      local.leader = fd;
+    }
+    local.fds[c] = fd;
+    local.slot[c] = local.n_open++;
+    opened |= 1u << c;
+  }
+  if (local.leader >= 0) {
+    ioctl(local.leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(local.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+  return local.n_open > 0;
+#else
+  setError("hardware counters are only supported on Linux");
+  return false;
+#endif
+}
+
+/* Current values of the counters of the calling thread (0 for those not
+   available) */
+void PerfCounters::read(uint64_t values[nCounters_]) {
+  std::memset(values, 0, nCounters_*sizeof(uint64_t));
+#ifdef __linux__
+  if (local.n_open == 0) {
+    return;
+  }
+  uint64_t buf[1 + nCounters_];
+  if (::read(local.leader, buf, sizeof(buf)) < (ssize_t)((1 + local.n_open)*sizeof(uint64_t))) {
+    return;
+  }
+  for (int c = 0; c < nCounters_; ++c) {
+    if (local.slot[c] >= 0) {
+      values[c] = buf[1 + local.slot[c]];
+    }
+  }
+#endif
+}
+
+/* Closes the counters of the calling thread */
+void PerfCounters::close() {
+#ifdef __linux__
+  for (int c = nCounters_ - 1; c >= 0; --c) {
+    if (local.fds[c] >= 0) {
+      ::close(local.fds[c]);
+    }
+    local.fds[c] = -1;
+    local.slot[c] = -1;
+  }
+  local.leader = -1;
+  local.n_open = 0;
+#endif
+}
+
+bool PerfCounters::available(int c) {
+  return (opened.load() >> c) & 1;
+}
+
+/* Counters not available and the last error, empty if all are */
+std::string PerfCounters::status() {
+  std::string s;
+  for (int c = 0; c < nCounters_; ++c) {
+    if (!available(c)) {
+      s += (s.empty() ? "" : ", ") + std::string(names[c]);
+    }
+  }
+  if (s.empty()) {
+    return s;
+  }
+  std::lock_guard<std::mutex> lock(status_mutex);
+  return "not available: " + s + (last_error.empty() ? "" : " (" + last_error + ")");
+}
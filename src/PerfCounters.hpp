@@ -0,0 +1,38 @@
+#ifndef PERFCOUNTERS_HPP
+#define PERFCOUNTERS_HPP
+
+#include <cstdint>
+#include <string>
+
+/*
+ * Hardware performance counters of the calling thread (Linux
+ * perf_event_open, user space only): cycles, instructions, last level
+ * cache misses and floating point vector operations. Every thread opens
+ * its own counters; a counter the kernel refuses (permissions, see
+ * /proc/sys/kernel/perf_event_paranoid, or event not supported by the
+ * CPU) reads 0 and is reported as not available. Elsewhere nothing is
+ * available.
+ * The vector operation count is a raw event, by default the Intel
+ * FP_ARITH_INST_RETIRED packed single and double (128 and 256 bits).
+ */
+class PerfCounters {
+public:
+  enum counter_t {CYCLES_ = 0,
+		  INSTRUCTIONS_,
+		  LLC_MISSES_,
+		  FP_VECTOR_,
+		  nCounters_};
+
+  static const char *name(int c);
+
+  static void setRawEvent(uint64_t config);
+
+  static bool open();
+  static void read(uint64_t values[nCounters_]);
+  static void close();
+
+  static bool available(int c);
+  static std::string status();
+};
+
+#endif
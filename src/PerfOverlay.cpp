@@ -0,0 +1,188 @@
+#include "PerfOverlay.hpp"
+
+#include <algorithm>
+#include <initializer_list>
+#include <iomanip>
+#include <sstream>
+#include <qopengl.h>
+
+namespace {
+
+  const char *phase_names[PerfOverlay::nPhases_] = {"amplitudes", "phase rotation", "simulation (rest)",
+						     "export", "normals", "upload", "draw", "render (rest)"};
+  const float phase_colors[PerfOverlay::nPhases_ + 1][3] = {{0.1f, 0.6f, 0.2f},
+							   {0.3f, 0.9f, 0.4f},
+							   {0.6f, 1.0f, 0.6f},
+							   {0.9f, 0.7f, 0.2f},
+							   {0.6f, 0.3f, 0.9f},
+							   {0.9f, 0.3f, 0.5f},
+							   {0.2f, 0.5f, 1.0f},
+							   {0.5f, 0.8f, 1.0f},
+							   {0.6f, 0.6f, 0.6f}};
+
+}
+
+PerfOverlay::PerfOverlay(int history) {
+  visible = false;
+  running = NULL;
+  frames.resize(std::max(history, 2));
+  n_frames = 0;
+  next = 0;
+  current = Frame();
+  started = false;
+}
+
+PerfOverlay::~PerfOverlay() {
+  if (current_overlay == this) {
+    setCurrent(NULL);
+  }
+}
+
+/* Overlay of the timers, measured on the calling thread */
+void PerfOverlay::setCurrent(PerfOverlay *o) {
+  current_overlay = o;
+  if (o) {
+    o->thread = std::this_thread::get_id();
+  }
+}
+
+bool PerfOverlay::isVisible() const {
+  return visible;
+}
+
+/* The statistics start over when the overlay is shown */
+void PerfOverlay::setVisible(bool v) {
+  visible = v;
+  n_frames = 0;
+  next = 0;
+  current = Frame();
+  started = false;
+}
+
+/* The frame time is the time since the previous frame ended */
+void PerfOverlay::endFrame() {
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  if (started) {
+    current.total = std::chrono::duration<double, std::milli>(now - last_end).count();
+    frames[next] = current;
+    next = (next + 1) % frames.size();
+    n_frames = std::min(n_frames + 1, (int)frames.size());
+  }
+  started = true;
+  last_end = now;
+  current = Frame();
+}
+
+/* p-th percentile (0 to 100) of the frame times, nearest rank */
+double PerfOverlay::percentile(double p) const {
+  if (n_frames == 0) {
+    return 0;
+  }
+  std::vector<double> t(n_frames);
+  for (int k = 0; k < n_frames; ++k) {
+    t[k] = frames[k].total;
+  }
+  int rank = std::min(n_frames - 1, std::max(0, (int)(p/100.0*n_frames + 0.5) - 1));
+  std::nth_element(t.begin(), t.begin() + rank, t.end());
+  return t[rank];
+}
+
+/* Frame time, percentiles and mean time of each phase */
+std::vector<std::string> PerfOverlay::text() const {
+  std::vector<std::string> lines;
+  double mean = 0, phases[nPhases_] = {};
+  for (int k = 0; k < n_frames; ++k) {
+    mean += frames[k].total;
+    for (int p = 0; p < nPhases_; ++p) {
+      phases[p] += frames[k].phases[p];
+    }
+  }
+  std::stringstream ss;
+  ss<<std::fixed<<std::setprecision(2);
+  if (n_frames > 0) {
+    mean /= n_frames;
+    ss<<"frame "<<mean<<" ms ("<<std::setprecision(1)<<1000.0/mean<<" fps)"<<std::setprecision(2)
+      <<"  p50 "<<percentile(50)<<"  p95 "<<percentile(95)<<"  p99 "<<percentile(99);
+  } else {
+    ss<<"frame -";
+  }
+  lines.push_back(ss.str());
+  double other = mean;
+  for (int p = 0; p < nPhases_; ++p) {
+    double ms = n_frames > 0 ? phases[p]/n_frames : 0;
+    other -= ms;
+    ss.str("");
+    ss<<phase_names[p]<<" "<<ms<<" ms";
+    lines.push_back(ss.str());
+  }
+  ss.str("");
+  ss<<"other "<<std::max(0.0, other)<<" ms";
+  lines.push_back(ss.str());
+  return lines;
+}
+
+/* Stacked phases of the last frames in the w x h rectangle at (x, y) of a
+   width x height window (pixels, origin at the top left), with marks at
+   16.7 and 33.3 ms. Fixed pipeline, the GL state is restored. */
+void PerfOverlay::drawGraph(int x, int y, int w, int h, int width, int height) const {
+  double scale = std::max(33.4, 1.2*percentile(99));
+
+  glPushAttrib(GL_ALL_ATTRIB_BITS);
+  glDisable(GL_LIGHTING);
+  glDisable(GL_DEPTH_TEST);
+  glDisable(GL_TEXTURE_2D);
+  glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glMatrixMode(GL_PROJECTION);
+  glPushMatrix();
+  glLoadIdentity();
+  glOrtho(0, width, height, 0, -1, 1);
+  glMatrixMode(GL_MODELVIEW);
+  glPushMatrix();
+  glLoadIdentity();
+
+  glColor4f(0, 0, 0, 0.6f);
+  glBegin(GL_QUADS);
+  glVertex2i(x, y);
+  glVertex2i(x + w, y);
+  glVertex2i(x + w, y + h);
+  glVertex2i(x, y + h);
+  glEnd();
+
+  // oldest frame on the left
+  float bar = (float)w/frames.size();
+  glBegin(GL_QUADS);
+  for (int k = 0; k < n_frames; ++k) {
+    const Frame &f = frames[(next - n_frames + k + frames.size()) % frames.size()];
+    float x0 = x + w - (n_frames - k)*bar, x1 = x0 + bar;
+    double base = 0;
+    for (int p = 0; p <= nPhases_; ++p) {
+      double ms = p < nPhases_ ? f.phases[p] : std::max(0.0, f.total - base);
+      float y0 = y + h - std::min(1.0, base/scale)*h;
+      float y1 = y + h - std::min(1.0, (base + ms)/scale)*h;
+      glColor4f(phase_colors[p][0], phase_colors[p][1], phase_colors[p][2], 0.9f);
+      glVertex2f(x0, y0);
+      glVertex2f(x1, y0);
+      glVertex2f(x1, y1);
+      glVertex2f(x0, y1);
+      base += ms;
+    }
+  }
+  glEnd();
+
+  glColor4f(1, 1, 1, 0.5f);
+  glBegin(GL_LINES);
+  for (double ms : {1000.0/60.0, 1000.0/30.0}) {
+    float ym = y + h - ms/scale*h;
+    glVertex2f(x, ym);
+    glVertex2f(x + w, ym);
+  }
+  glEnd();
+
+  glMatrixMode(GL_PROJECTION);
+  glPopMatrix();
+  glMatrixMode(GL_MODELVIEW);
+  glPopMatrix();
+  glPopAttrib();
+}
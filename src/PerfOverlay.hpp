@@ -0,0 +1,105 @@
+#ifndef PERFOVERLAY_HPP
+#define PERFOVERLAY_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Frame statistics shown over the viewer: the last frames as a graph of
+ * stacked phases (amplitude update, phase rotation, the rest of the
+ * simulation step, export, normals, GPU upload, draw calls, the rest of
+ * the rendering and of the frame), and the frame time percentiles.
+ * Nothing is measured while it is hidden.
+ *
+ * The timers are placed in the code of each phase (WaterSurface, Grid,
+ * GridRenderer...) and count for the current overlay (setCurrent), on its
+ * thread only: the background solver is not measured. Nested timers are
+ * exclusive, the time of the inner phase is not counted in the outer one.
+ * The header does not need PerfOverlay.cpp, for the builds without Qt.
+ */
+class PerfOverlay {
+public:
+  enum phase_t {AMPLITUDES_ = 0,
+		ROTATION_,
+		SIMULATION_,
+		EXPORT_,
+		NORMALS_,
+		UPLOAD_,
+		DRAW_,
+		RENDER_,
+		nPhases_};
+
+  // adds the time of its scope to a phase of the current frame
+  class Timer {
+  private:
+    PerfOverlay *overlay;
+    phase_t phase;
+    Timer *parent;
+    std::chrono::steady_clock::time_point start;
+
+    void add(std::chrono::steady_clock::time_point now) {
+      overlay->current.phases[phase] += std::chrono::duration<double, std::milli>(now - start).count();
+    }
+
+  public:
+    Timer(phase_t p) : overlay(NULL), phase(p), parent(NULL) {
+      PerfOverlay *o = current_overlay;
+      if (o && o->visible && std::this_thread::get_id() == o->thread) {
+	overlay = o;
+	start = std::chrono::steady_clock::now();
+	parent = o->running;
+	if (parent) {
+	  parent->add(start);
+	}
+	o->running = this;
+      }
+    }
+    ~Timer() {
+      if (overlay) {
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	add(now);
+	overlay->running = parent;
+	if (parent) {
+	  parent->start = now;
+	}
+      }
+    }
+  };
+
+private:
+  struct Frame {
+    double total;
+    double phases[nPhases_];
+  };
+
+  inline static PerfOverlay *current_overlay = NULL;
+
+  bool visible;
+  std::thread::id thread; // thread of setCurrent
+  Timer *running;         // innermost timer
+  std::vector<Frame> frames; // ring of the last frames
+  int n_frames, next;
+  Frame current;
+  bool started;
+  std::chrono::steady_clock::time_point last_end;
+
+public:
+  PerfOverlay(int history = 240);
+  ~PerfOverlay();
+
+  static void setCurrent(PerfOverlay *o);
+
+  bool isVisible() const;
+  void setVisible(bool v);
+
+  void endFrame();
+
+  double percentile(double p) const;
+  std::vector<std::string> text() const;
+  void drawGraph(int x, int y, int w, int h, int width, int height) const;
+};
+
+#endif
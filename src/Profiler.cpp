@@ -0,0 +1,318 @@
+#include "Profiler.hpp"
+#include "error.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> Profiler::on_(false);
+
+namespace {
+
+  const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+  struct ThreadBuffer {
+    std::string name;
+    std::vector<Profiler::Event> events;
+    std::atomic<uint64_t> count;
+  };
+
+  std::mutex registry_mutex;
+  std::vector<std::unique_ptr<ThreadBuffer> > registry;
+  std::vector<int64_t> frame_starts;
+  size_t buffer_size = 1 << 16;
+  std::atomic<bool> counters_on(false);
+
+  thread_local ThreadBuffer *local = NULL;
+  thread_local int depth = 0;
+
+  ThreadBuffer *threadBuffer() {
+    if (local == NULL) {
+      std::lock_guard<std::mutex> lock(registry_mutex);
+      registry.emplace_back(new ThreadBuffer());
+      local = registry.back().get();
+      local->name = "thread " + std::to_string(registry.size() - 1);
+      local->events.resize(buffer_size);
+      local->count = 0;
+    }
+    return local;
+  }
+
+  /* Events still in the ring of a thread, by start time (a zone before
+     the zones it contains) */
+  std::vector<Profiler::Event> events(const ThreadBuffer &b) {
+    uint64_t count = b.count.load(std::memory_order_acquire);
+    size_t n = std::min<uint64_t>(count, b.events.size());
+    std::vector<Profiler::Event> ev(n);
+    for (size_t k = 0; k < n; ++k) {
+      ev[k] = b.events[(count - n + k) % b.events.size()];
+    }
+    std::sort(ev.begin(), ev.end(), [](const Profiler::Event &a, const Profiler::Event &b) {
+	return a.start < b.start || (a.start == b.start && a.depth < b.depth);
+      });
+    return ev;
+  }
+
+  void writeJsonString(std::ostream &os, const std::string &s) {
+    os<<'"';
+    for (char c : s) {
+      if (c == '"' || c == '\\') {
+	os<<'\\';
+      }
+      os<<c;
+    }
+    os<<'"';
+  }
+
+  struct Node {
+    std::string name;
+    unsigned long calls = 0;
+    int64_t total = 0;
+    uint64_t counters[PerfCounters::nCounters_] = {0, 0, 0, 0};
+    std::map<std::string, int> children;
+  };
+
+  void printCounter(std::ostream &os, int c, double value, int width) {
+    if (PerfCounters::available(c)) {
+      os<<std::setw(width)<<value;
+    } else {
+      os<<std::setw(width)<<"-";
+    }
+  }
+
+  void printNode(std::ostream &os, const std::vector<Node> &tree, int n, int level,
+		 double n_frames, double frame_time) {
+    const Node &node = tree[n];
+    if (level >= 0) {
+      int64_t self = node.total;
+      for (auto &c : node.children) {
+	self -= tree[c.second].total;
+      }
+      std::string name = std::string(2*level, ' ') + node.name;
+      os<<std::left<<std::setw(40)<<name<<std::right
+	<<std::setw(10)<<node.calls/n_frames
+	<<std::setw(12)<<node.total*1e-6/n_frames
+	<<std::setw(12)<<self*1e-6/n_frames;
+      if (frame_time > 0) {
+	os<<std::setw(9)<<100.0*node.total/n_frames/frame_time;
+      }
+      if (counters_on) {
+	const uint64_t *c = node.counters;
+	printCounter(os, PerfCounters::CYCLES_, c[PerfCounters::CYCLES_]*1e-6/n_frames, 10);
+	printCounter(os, PerfCounters::INSTRUCTIONS_, c[PerfCounters::CYCLES_] > 0 ?
+		     (double)c[PerfCounters::INSTRUCTIONS_]/c[PerfCounters::CYCLES_] : 0, 7);
+	printCounter(os, PerfCounters::LLC_MISSES_, c[PerfCounters::LLC_MISSES_]*1e-3/n_frames, 11);
+	printCounter(os, PerfCounters::FP_VECTOR_, c[PerfCounters::FP_VECTOR_]*1e-6/n_frames, 10);
+      }
+      os<<"\n";
+    }
+    std::vector<int> children;
+    for (auto &c : node.children) {
+      children.push_back(c.second);
+    }
+    std::sort(children.begin(), children.end(), [&](int a, int b) {return tree[a].total > tree[b].total;});
+    for (int c : children) {
+      printNode(os, tree, c, level + 1, n_frames, frame_time);
+    }
+  }
+
+}
+
+int64_t Profiler::now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void Profiler::enable(bool on) {
+  on_.store(on, std::memory_order_relaxed);
+}
+
+/* Hardware counters of the zones, the threads open their counters at
+   their first zone */
+void Profiler::enableCounters(bool on) {
+  counters_on = on;
+}
+
+bool Profiler::countersEnabled() {
+  return counters_on;
+}
+
+/* Number of events kept by the threads that have not recorded anything yet */
+void Profiler::setBufferSize(size_t n) {
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  buffer_size = std::max((size_t)1, n);
+}
+
+/* Name of the calling thread in the trace and the summary */
+void Profiler::setThreadName(const std::string &name) {
+  ThreadBuffer *b = threadBuffer();
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  b->name = name;
+}
+
+/* Marks the beginning of a frame, the summary is averaged over the frames */
+void Profiler::nextFrame() {
+  if (!enabled()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  frame_starts.push_back(now());
+}
+
+void Profiler::clear() {
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  for (auto &b : registry) {
+    b->count = 0;
+  }
+  frame_starts.clear();
+}
+
+int64_t Profiler::begin(uint64_t *counters) {
+  ++depth;
+  if (counters_on.load(std::memory_order_relaxed) && PerfCounters::open()) {
+    PerfCounters::read(counters);
+  } else {
+    std::fill(counters, counters + PerfCounters::nCounters_, 0);
+  }
+  return now();
+}
+
+void Profiler::end(const char *name, int64_t start, const uint64_t *counters) {
+  int64_t stop = now();
+  uint64_t values[PerfCounters::nCounters_] = {0, 0, 0, 0};
+  if (counters_on.load(std::memory_order_relaxed)) {
+    PerfCounters::read(values);
+  }
+  --depth;
+  ThreadBuffer *b = threadBuffer();
+  uint64_t k = b->count.load(std::memory_order_relaxed);
+  Event &e = b->events[k % b->events.size()];
+  e.name = name;
+  e.start = start;
+  e.duration = stop - start;
+  e.depth = depth;
+  for (int c = 0; c < PerfCounters::nCounters_; ++c) {
+    e.counters[c] = values[c] > counters[c] ? values[c] - counters[c] : 0;
+  }
+  b->count.store(k + 1, std::memory_order_release);
+}
+
+/* Chrome trace event format: one complete event ("X") per zone, times in
+   microseconds, and an instant event per frame */
+void Profiler::writeTrace(const std::string &file) {
+  std::ofstream os(file);
+  ERROR(os.good(), "cannot open file " + file, "");
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  os<<std::fixed<<std::setprecision(3);
+  os<<"{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+  bool first = true;
+  for (size_t t = 0; t < registry.size(); ++t) {
+    os<<(first ? "" : ",\n")<<"{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "<<t
+      <<", \"args\": {\"name\": ";
+    writeJsonString(os, registry[t]->name);
+    os<<"}}";
+    first = false;
+    for (const Event &e : events(*registry[t])) {
+      os<<",\n{\"name\": ";
+      writeJsonString(os, e.name);
+      os<<", \"ph\": \"X\", \"pid\": 1, \"tid\": "<<t<<", \"ts\": "<<e.start*1e-3
+	<<", \"dur\": "<<e.duration*1e-3;
+      if (counters_on) {
+	std::string sep = ", \"args\": {";
+	for (int c = 0; c < PerfCounters::nCounters_; ++c) {
+	  if (PerfCounters::available(c)) {
+	    os<<sep<<"\""<<PerfCounters::name(c)<<"\": "<<e.counters[c];
+	    sep = ", ";
+	  }
+	}
+	os<<(sep == ", " ? "}" : "");
+      }
+      os<<"}";
+    }
+  }
+  for (size_t f = 0; f < frame_starts.size(); ++f) {
+    os<<(first ? "" : ",\n")<<"{\"name\": \"frame "<<f<<"\", \"ph\": \"i\", \"s\": \"g\", \"pid\": 1, \"tid\": 0, \"ts\": "
+      <<frame_starts[f]*1e-3<<"}";
+    first = false;
+  }
+  os<<"\n]}\n";
+}
+
+/* Zones of each thread as a tree: calls, total and self time (ms) per
+   frame, and share of the frame time. Only the completed frames count;
+   without frames, the totals are given. With the counters: millions of
+   cycles, instructions per cycle, thousands of LLC misses and millions of
+   vector operations per frame, zones included. */
+void Profiler::summary(std::ostream &os) {
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  int64_t t0 = 0, t1 = INT64_MAX;
+  double n_frames = 1, frame_time = 0;
+  if (frame_starts.size() >= 2) {
+    t0 = frame_starts.front();
+    t1 = frame_starts.back();
+    n_frames = frame_starts.size() - 1;
+    frame_time = (t1 - t0)/n_frames;
+  }
+  std::ios::fmtflags flags = os.flags();
+  std::streamsize precision = os.precision();
+  os<<std::fixed<<std::setprecision(3);
+  os<<"\n*** Profile ("<<(frame_starts.size() >= 2 ? std::to_string((int)n_frames) + " frames, "
+			  + std::to_string(frame_time*1e-6) + " ms per frame" : "no frames, totals")<<")\n";
+  for (auto &b : registry) {
+    std::vector<Node> tree(1);
+    std::vector<int> stack;
+    std::vector<int64_t> stack_end;
+    for (const Event &e : events(*b)) {
+      if (e.start < t0 || e.start >= t1) {
+	continue;
+      }
+      // parent: innermost open zone containing this one
+      while (!stack.empty() && (stack_end.back() < e.start + e.duration || (int)stack.size() > e.depth)) {
+	stack.pop_back();
+	stack_end.pop_back();
+      }
+      int parent = stack.empty() ? 0 : stack.back();
+      auto it = tree[parent].children.find(e.name);
+      int n;
+      if (it == tree[parent].children.end()) {
+	n = tree.size();
+	tree[parent].children[e.name] = n;
+	tree.push_back(Node());
+	tree[n].name = e.name;
+      } else {
+	n = it->second;
+      }
+      tree[n].calls++;
+      tree[n].total += e.duration;
+      for (int c = 0; c < PerfCounters::nCounters_; ++c) {
+	tree[n].counters[c] += e.counters[c];
+      }
+      stack.push_back(n);
+      stack_end.push_back(e.start + e.duration);
+    }
+    if (tree.size() == 1) {
+      continue;
+    }
+    os<<"\n["<<b->name<<"]\n";
+    os<<std::left<<std::setw(40)<<"zone"<<std::right<<std::setw(10)<<"calls"
+      <<std::setw(12)<<"ms"<<std::setw(12)<<"self ms";
+    if (frame_time > 0) {
+      os<<std::setw(9)<<"% frame";
+    }
+    if (counters_on) {
+      os<<std::setw(10)<<"Mcycles"<<std::setw(7)<<"IPC"<<std::setw(11)<<"k LLC miss"<<std::setw(10)<<"M FP vec";
+    }
+    os<<"\n";
+    printNode(os, tree, 0, -1, n_frames, frame_time);
+  }
+  if (counters_on && !PerfCounters::status().empty()) {
+    os<<"\nHardware counters "<<PerfCounters::status()<<"\n";
+  }
+  os.flags(flags);
+  os.precision(precision);
+}
@@ -0,0 +1,80 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include "PerfCounters.hpp"
+
+/*
+ * Hierarchical profiler. PROFILE_ZONE("name") opens a zone until the end of
+ * the enclosing scope; zones nest, and every thread records its closed
+ * zones in its own ring buffer (no lock, the oldest events are overwritten
+ * when it is full). When the profiler is off, a zone costs a relaxed atomic
+ * load, and nothing at all if WD_NO_PROFILER is defined.
+ * The events are written as a Chrome trace (chrome://tracing, Perfetto) or
+ * summed up per frame (see nextFrame) in a table. Both should be called
+ * when the other threads are idle.
+ * Zone names must be string literals, only their address is kept.
+ * With enableCounters (set before profiling), each zone also records the
+ * hardware counters of its thread (see PerfCounters).
+ */
+class Profiler {
+public:
+  struct Event {
+    const char *name;
+    int64_t start, duration; // ns since the start of the program
+    int depth;
+    uint64_t counters[PerfCounters::nCounters_]; // counted during the zone
+  };
+
+  class Zone {
+  private:
+    const char *name;
+    int64_t start;
+    uint64_t counters[PerfCounters::nCounters_];
+  public:
+    explicit Zone(const char *n) : name(NULL), start(0) {
+      if (enabled()) {
+	name = n;
+	start = begin(counters);
+      }
+    }
+    ~Zone() {
+      if (name != NULL) {
+	end(name, start, counters);
+      }
+    }
+  };
+
+  static void enable(bool on);
+  static bool enabled() {return on_.load(std::memory_order_relaxed);}
+  static void enableCounters(bool on);
+  static bool countersEnabled();
+
+  static void setBufferSize(size_t n);
+  static void setThreadName(const std::string &name);
+  static void nextFrame();
+  static void clear();
+
+  static void writeTrace(const std::string &file);
+  static void summary(std::ostream &os);
+
+  static int64_t now();
+
+private:
+  static std::atomic<bool> on_;
+  static int64_t begin(uint64_t *counters);
+  static void end(const char *name, int64_t start, const uint64_t *counters);
+};
+
+#ifdef WD_NO_PROFILER
+#define PROFILE_ZONE(name)
+#else
+#define PROFILE_CAT_(a, b) a##b
+#define PROFILE_ZONE_(name, line) Profiler::Zone PROFILE_CAT_(profile_zone_, line)(name)
+#define PROFILE_ZONE(name) PROFILE_ZONE_(name, __LINE__)
+#endif
+
+#endif
@@ -18,9 +18,15 @@
  */
 
 #include "ProjectedGrid.hpp"
+#include "MeshExporter.hpp"
+#include "Object.hpp"
 #include "error.hpp"
 #include "settings.hpp"
 
+#include <Eigen/Geometry>
+#include <Eigen/LU>
+#include <algorithm>
+
 using namespace settings;
 
 inline int ProjectedGrid::index(int i, int j) const {
@@ -59,6 +65,18 @@ ProjectedGrid::ProjectedGrid(int nr, int nc) {
 
 ProjectedGrid::~ProjectedGrid() {}
 
+int ProjectedGrid::getNbRows() const {
+  return n_rows;
+}
+
+int ProjectedGrid::getNbCols() const {
+  return n_cols;
+}
+
+int ProjectedGrid::getNbNodes() const {
+  return n_nodes;
+}
+
 VEC3 ProjectedGrid::operator()(int i, int j) const {
   int ind = index(i, j);
   assert(ind >= 0 && ind < n_nodes);
@@ -82,7 +100,7 @@ VEC3 ProjectedGrid::operator()(int i) const {
 // }
 
 VEC2 ProjectedGrid::getPosWorld(int i, int j) const {
-  if (i < 0 || i >= n_rows || j < 0 || j > n_cols) {
+  if (i < 0 || i >= n_rows || j < 0 || j >= n_cols) {
     return VEC2(0, 0);
   }
   int ind = index(i, j);
@@ -93,7 +111,7 @@ VEC2 ProjectedGrid::getPosWorld(int i, int j) const {
 }
 
 VEC2 ProjectedGrid::getPosWorld(int i) const {
-  if (i >= 0 && i < n_nodes) {
+  if (i < 0 || i >= n_nodes) {
     return VEC2(0, 0);
   }
   VEC2 vp(viewer_pos[i](0), viewer_pos[i](1));
@@ -115,6 +133,11 @@ void ProjectedGrid::setHeight(int i, int j, FLOAT z) {
   viewer_pos[ind](2) = z;
 }
 
+void ProjectedGrid::setHeight(int i, FLOAT z) {
+  assert(i >= 0 && i < n_nodes);
+  viewer_pos[i](2) = z;
+}
+
 void ProjectedGrid::setDisplacement(int i, int j, VEC2 d) {
   int ind = index(i, j);
   assert(ind >= 0 && ind < n_nodes);
@@ -130,6 +153,7 @@ void ProjectedGrid::setDisplacement(int i, int j, FLOAT x, FLOAT y) {
 
 void ProjectedGrid::setSizes() {
   min_size = -1;
+#pragma omp parallel for
   for (int i = 0; i < n_rows; ++i) {
     for (int j = 0; j < n_cols; ++j) {
       int ind = index(i, j);
@@ -158,12 +182,13 @@ void ProjectedGrid::setSizes() {
       }
       s /= (FLOAT)n;
       sizes[ind] = s;
-      if (min_size < 0 || s < min_size) {
-	min_size = s;
-      }
     }
   }
-  
+  for (int i = 0; i < n_nodes; ++i) {
+    if (min_size < 0 || sizes[i] < min_size) {
+      min_size = sizes[i];
+    }
+  }
 }
 
 FLOAT ProjectedGrid::minSize() {
@@ -175,8 +200,81 @@ FLOAT ProjectedGrid::size(int i) {
 }
 
 
+/* Places the nodes where the rays through a regular screen space grid hit
+   the water plane z = 0. mvp is the (column major) modelview projection
+   matrix of the camera; rays that miss the plane or hit it further than
+   max_dist from the eye are stopped at max_dist, on the horizon. The sizes
+   are updated with the new positions. */
+void ProjectedGrid::project(const double mvp[16], FLOAT max_dist) {
+  Eigen::Matrix4d inv = Eigen::Map<const Eigen::Matrix4d>(mvp).inverse();
+#pragma omp parallel for
+  for (int i = 0; i < n_rows; ++i) {
+    double sy = n_rows > 1 ? 2.0*i/(n_rows - 1) - 1 : 0;
+    for (int j = 0; j < n_cols; ++j) {
+      double sx = n_cols > 1 ? 2.0*j/(n_cols - 1) - 1 : 0;
+      Eigen::Vector4d n = inv*Eigen::Vector4d(sx, sy, -1, 1);
+      Eigen::Vector4d f = inv*Eigen::Vector4d(sx, sy, 1, 1);
+      Eigen::Vector3d near = n.head<3>()/n(3);
+      Eigen::Vector3d dir = f.head<3>()/f(3) - near;
+      Eigen::Vector2d hdir = dir.head<2>();
+      Eigen::Vector2d p = near.head<2>();
+      double t = dir(2) < 0 ? -near(2)/dir(2) : -1;
+      if (t >= 0 && (t*hdir).norm() <= max_dist) {
+	p += t*hdir;
+      } else if (hdir.norm() > 0) {
+	p += max_dist*hdir.normalized();
+      }
+      VEC2 vp = world2viewer(p(0), p(1));
+      setPosOnThePlane(i, j, vp(0), vp(1));
+    }
+  }
+  setSizes();
+}
+
+#ifndef WD_HEADLESS
+/* Draws the grid in world coordinates, the normals are taken from the
+   neighbouring nodes */
+void ProjectedGrid::draw(float r, float g, float b) const {
+  std::vector<VEC3> pos(n_nodes);
+  std::vector<VEC3> normals(n_nodes);
+#pragma omp parallel for
+  for (int i = 0; i < n_nodes; ++i) {
+    VEC2 wp = getPosWorld(i);
+    pos[i] = VEC3(wp(0), wp(1), viewer_pos[i](2));
+  }
+#pragma omp parallel for
+  for (int i = 0; i < n_rows; ++i) {
+    for (int j = 0; j < n_cols; ++j) {
+      VEC3 du = pos[index(std::min(i+1, n_rows-1), j)] - pos[index(std::max(i-1, 0), j)];
+      VEC3 dv = pos[index(i, std::min(j+1, n_cols-1))] - pos[index(i, std::max(j-1, 0))];
+      VEC3 n = dv.cross(du);
+      if (n(2) < 0) {
+	n = -n;
+      }
+      FLOAT l = n.norm();
+      normals[index(i, j)] = l > 0 ? VEC3(n/l) : VEC3(0, 0, 1);
+    }
+  }
+  glBegin(GL_TRIANGLES);
+  glColor3f(r, g, b);
+  for (int i = 0; i < n_rows - 1; i++) {
+    for (int j = 0; j < n_cols - 1; j++) {
+      int quad[6] = {index(i, j), index(i+1, j), index(i+1, j+1),
+		     index(i+1, j+1), index(i, j+1), index(i, j)};
+      for (int k = 0; k < 6; ++k) {
+	const VEC3 &n = normals[quad[k]], &p = pos[quad[k]];
+	glNormal3f(n(0), n(1), n(2));
+	glVertex3f(p(0), p(1), p(2));
+      }
+    }
+  }
+  glEnd();
+}
+#endif
+
 std::ostream& ProjectedGrid::exportObj(std::ostream& os) const {
-  os << "# Projected Grid\n";
+  std::vector<VEC3> vertices(n_nodes);
+#pragma omp parallel for
   for (int i = 0; i < n_nodes; ++i) {
     VEC3 pos = viewer_pos[i];
     // VEC2 wc = getPosWorld(i);
@@ -191,18 +289,11 @@ std::ostream& ProjectedGrid::exportObj(std::ostream& os) const {
     if (pos(2) >= 0.019) {
       pos(2) = 0.019;
     }
-    os <<"v "<<pos(0)<<" "<<pos(1)<<" "<<pos(2)<<"\n";
-  }
-  for (int i = 0; i < n_rows-1; i++) {
-    for (int j = 0; j < n_cols-1; j++) {
-      int idx = j + i * n_cols + 1;
-      int J   = 1;
-      int I   = n_cols;
-      os << "f "<<idx<<" "<<idx + J<<" "<<idx + I<<"\n";
-      os << "f "<<idx + J<<" "<<idx + I + J<<" "<<idx + I<<"\n";
-    }
+    vertices[i] = pos;
   }
-  return os;
+  MeshExporter mesh(n_rows, n_cols, vertices.data());
+  mesh.setComment("Projected Grid");
+  return mesh.writeObj(os);
 }
 
 std::ostream& operator<<(std::ostream& os, const ProjectedGrid& g) {
@@ -40,6 +40,10 @@ public:
   ProjectedGrid(int nr, int nc);
   ~ProjectedGrid();
 
+  int getNbRows() const;
+  int getNbCols() const;
+  int getNbNodes() const;
+
   VEC3 operator()(int i, int j) const;
   //VEC3 &operator()(int i, int j);
   VEC3 operator()(int i) const;
@@ -49,6 +53,7 @@ public:
   
   void setPosOnThePlane(int i, int j, FLOAT x, FLOAT y);
   void setHeight(int i, int j, FLOAT z);
+  void setHeight(int i, FLOAT z);
   void setDisplacement(int i, int j, VEC2 d);
   void setDisplacement(int i, int j, FLOAT x, FLOAT y);
   
@@ -56,6 +61,11 @@ public:
   FLOAT minSize();
   FLOAT size(int i);
 
+  void project(const double mvp[16], FLOAT max_dist);
+#ifndef WD_HEADLESS
+  void draw(float r, float g, float b) const;
+#endif
+
   std::ostream& exportObj(std::ostream& os) const;
   
   friend std::ostream& operator<<(std::ostream& os, const ProjectedGrid& g);
@@ -0,0 +1,739 @@
+#include "SceneFile.hpp"
+#include "settings.hpp"
+#include "error.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+  const char magic[8] = {'W', 'D', 'S', 'C', 'E', 'N', 'E', '1'};
+
+  // errors printed when a text file is rejected
+  const size_t max_errors = 50;
+  const size_t max_wave_lengths = 1000;
+
+  struct BinaryHeader {
+    char magic[8];
+    SceneSettings settings;
+    int32_t nb_wl, nb_markers;
+  };
+
+  /* Lines of a text held in memory: blank lines and comments are skipped,
+     the cursor p moves forward on the current line [line, eol). */
+  class Scanner {
+  private:
+    const char *next, *end;
+
+  public:
+    const char *line, *eol, *p;
+    int line_no;
+
+    Scanner(const std::string &text): next(text.data()), end(text.data() + text.size()),
+				      line(NULL), eol(NULL), p(NULL), line_no(0) {}
+
+    bool nextLine() {
+      while (next < end) {
+	line = next;
+	const char *nl = (const char*)std::memchr(next, '\n', end - next);
+	eol = nl ? nl : end;
+	next = nl ? nl + 1 : end;
+	++line_no;
+	if (eol > line && eol[-1] == '\r') {
+	  --eol;
+	}
+	p = line;
+	skipBlanks();
+	if (p < eol && *p != '#') {
+	  return true;
+	}
+      }
+      return false;
+    }
+
+    void skipBlanks() {
+      while (p < eol && (*p == ' ' || *p == '\t')) {
+	++p;
+      }
+    }
+
+    template<size_t N> bool tag(const char (&t)[N]) {
+      if ((size_t)(eol - p) >= N - 1 && std::memcmp(p, t, N - 1) == 0) {
+	p += N - 1;
+	return true;
+      }
+      return false;
+    }
+
+    template<typename T> bool number(T &v) {
+      skipBlanks();
+      const char *q = p < eol && *p == '+' ? p + 1 : p;
+      std::from_chars_result r = std::from_chars(q, eol, v);
+      if (r.ec != std::errc() || r.ptr == q) {
+	return false;
+      }
+      p = r.ptr;
+      return true;
+    }
+
+    std::string text() const {
+      return std::string(line, eol);
+    }
+  };
+
+  /* Configuration file parser: same tags as the historic line parser, the
+     errors are collected and reported together. */
+  class TextParser {
+  private:
+    Scanner s;
+    Scene &scene;
+    SceneSettings &st;
+    std::vector<std::string> errors;
+
+    void error(int line_no, const std::string &msg, const std::string &text) {
+      std::stringstream ss;
+      ss<<"line "<<line_no<<": "<<msg;
+      if (!text.empty()) {
+	ss<<": \""<<text<<"\"";
+      }
+      errors.push_back(ss.str());
+    }
+
+    void error(const std::string &msg) {
+      error(s.line_no, msg, s.text());
+    }
+
+    template<typename T> bool value(T &v) {
+      T r;
+      if (!s.number(r)) {
+	error("number expected");
+	return false;
+      }
+      v = r;
+      return true;
+    }
+
+    template<typename T> bool positive(T &v) {
+      T r;
+      if (!value(r)) {
+	return false;
+      }
+      if (!(r > 0)) {
+	error("positive value expected");
+	return false;
+      }
+      v = r;
+      return true;
+    }
+
+    // next line of the block opened at line open, false at its closing tag
+    // or at the end of the file
+    template<size_t N> bool blockLine(const char (&close)[N], int open) {
+      if (!s.nextLine()) {
+	error(open, "missing " + std::string(close), "");
+	return false;
+      }
+      return !s.tag(close);
+    }
+
+    // <pos> of a <source> or <source_all> block
+    template<size_t N> bool position(const char (&close)[N], float &x, float &y) {
+      int open = s.line_no;
+      bool found = false;
+      while (blockLine(close, open)) {
+	if (s.tag("<pos>")) {
+	  found = value(x) && value(y);
+	} else {
+	  error("unknown tag in " + std::string(close).erase(1, 1));
+	}
+      }
+      if (!found) {
+	error(open, "missing <pos>", "");
+      }
+      return found;
+    }
+
+    // as WaterSurface::addEqSource: every wave length up to wl (0 for all)
+    void addSource(float x, float y, float wl, float re, float im) {
+      const std::vector<float> &table = scene.wave_lengths;
+      if (wl == 0) {
+	wl = table.back();
+      }
+      for (size_t w = 0; w < table.size() && table[w] <= wl; ++w) {
+	scene.lists[w].push(x, y, table[w], re, im);
+      }
+      scene.markers.push_back(x);
+      scene.markers.push_back(y);
+    }
+
+    void grid() {
+      int open = s.line_no;
+      while (blockLine("</grid>", open)) {
+	if (s.tag("<size>")) {
+	  int nr, nc;
+	  if (positive(nr) && positive(nc)) {
+	    st.n_rows = nr;
+	    st.n_cols = nc;
+	  }
+	} else if (s.tag("<cell_size>")) {
+	  positive(st.cell_size);
+	} else {
+	  error("unknown tag in <grid>");
+	}
+      }
+    }
+
+    void waveLengths() {
+      int open = s.line_no;
+      float min_wl = st.min_wl, max_wl = st.max_wl, step_wl = st.step_wl;
+      while (blockLine("</wave_lenghts>", open)) {
+	if (s.tag("<min>")) {
+	  if (positive(min_wl)) {
+	    st.init_wl = min_wl;
+	  }
+	} else if (s.tag("<max>")) {
+	  positive(max_wl);
+	} else if (s.tag("<number>")) {
+	  int n;
+	  if (positive(n)) {
+	    step_wl = (max_wl - min_wl)/n;
+	  }
+	} else if (s.tag("<step>")) {
+	  value(step_wl);
+	} else {
+	  error("unknown tag in <wave_lenghts>");
+	}
+      }
+      st.min_wl = min_wl;
+      st.max_wl = max_wl;
+      st.step_wl = step_wl;
+      if (max_wl > min_wl && !(step_wl > 1)) {
+	error(open, "the step between the wave lengths must be greater than 1", "");
+	return;
+      }
+      std::vector<float> table = SceneFile::waveLengthTable(min_wl, max_wl, step_wl);
+      if (table.size() > max_wave_lengths) {
+	error(open, "more than " + std::to_string(max_wave_lengths) + " wave lengths", "");
+	return;
+      }
+      // as WaterSurface::setLists, the sources defined before are dropped
+      scene.wave_lengths = table;
+      scene.lists.assign(table.size(), SceneSources());
+    }
+
+    void wave() {
+      int open = s.line_no;
+      float wl = 0, re = st.height_ampli, im = 0;
+      while (blockLine("</wave>", open)) {
+	float x = 0, y = 0;
+	if (s.tag("<wave_lenght>")) {
+	  float v;
+	  if (value(v)) {
+	    if (v < 0) {
+	      error("positive value expected");
+	    } else {
+	      wl = v;
+	    }
+	  }
+	} else if (s.tag("<amplitude>") || s.tag("<ampli>")) {
+	  // the imaginary part is optional
+	  if (value(re) && !s.number(im)) {
+	    im = 0;
+	  }
+	} else if (s.tag("<source>")) {
+	  if (position("</source>", x, y)) {
+	    addSource(x, y, wl, re, im);
+	  }
+	} else if (s.tag("<source_all>")) {
+	  if (position("</source_all>", x, y)) {
+	    for (size_t w = 0; w < scene.lists.size(); ++w) {
+	      scene.lists[w].push(x, y, scene.wave_lengths[w], re, im);
+	    }
+	  }
+	} else if (s.tag("<source_at>")) {
+	  sourceAt(re, im);
+	} else {
+	  error("unknown tag in <wave>");
+	}
+      }
+    }
+
+    // one source of one wave length list
+    void sourceAt(float re, float im) {
+      int open = s.line_no;
+      int list = 0;
+      float x = 0, y = 0, wl = 0;
+      bool pos = false;
+      while (blockLine("</source_at>", open)) {
+	if (s.tag("<list>")) {
+	  int l;
+	  if (value(l)) {
+	    if (l < 0 || l >= (int)scene.lists.size()) {
+	      error("no such wave length list");
+	    } else {
+	      list = l;
+	    }
+	  }
+	} else if (s.tag("<wave_lenght>")) {
+	  positive(wl);
+	} else if (s.tag("<pos>")) {
+	  pos = value(x) && value(y);
+	} else {
+	  error("unknown tag in <source_at>");
+	}
+      }
+      if (!pos) {
+	error(open, "missing <pos>", "");
+	return;
+      }
+      scene.lists[list].push(x, y, wl > 0 ? wl : scene.wave_lengths[list], re, im);
+    }
+
+    // the patterns are not used, the values are only checked
+    void pattern() {
+      int open = s.line_no;
+      while (blockLine("</pattern>", open)) {
+	float a, b;
+	int n;
+	if (s.tag("<file>")) {
+	} else if (s.tag("<size>")) {
+	  positive(n) && positive(n);
+	} else if (s.tag("<cell_size>") || s.tag("<radius>")) {
+	  positive(a);
+	} else if (s.tag("<pos>")) {
+	  value(a) && value(b);
+	} else if (s.tag("<ampli>") || s.tag("<init>")) {
+	  value(a);
+	} else if (s.tag("<method>")) {
+	  if (value(n)) {
+	    INFO("Metode  "<<n);
+	  }
+	} else {
+	  error("unknown tag in <pattern>");
+	}
+      }
+    }
+
+  public:
+    TextParser(const std::string &text, Scene &sc): s(text), scene(sc), st(sc.settings) {}
+
+    const std::vector<std::string> &parse() {
+      while (s.nextLine()) {
+	if (s.tag("<gravity>")) {
+	  value(st.gravity);
+	} else if (s.tag("<damping>")) {
+	  value(st.damping);
+	} else if (s.tag("<ampli>")) {
+	  value(st.height_ampli);
+	} else if (s.tag("<grid>")) {
+	  grid();
+	} else if (s.tag("<wave_lenghts>")) {
+	  waveLengths();
+	} else if (s.tag("<wave>")) {
+	  wave();
+	} else if (s.tag("<pattern>")) {
+	  pattern();
+	} else if (s.tag("<load_texture>")) {
+	  st.load_texture = !st.load_texture;
+	} else if (s.tag("<marker>")) {
+	  float x = 0, y = 0;
+	  if (value(x) && value(y)) {
+	    scene.markers.push_back(x);
+	    scene.markers.push_back(y);
+	  }
+	} else {
+	  error("unknown tag");
+	}
+      }
+      return errors;
+    }
+  };
+
+  void appendFloat(std::string &out, float v) {
+    char buf[32];
+    std::to_chars_result r = std::to_chars(buf, buf + sizeof(buf), v);
+    out.append(buf, r.ptr);
+  }
+
+  void appendTag(std::string &out, const char *tag, float a) {
+    out += tag;
+    out += ' ';
+    appendFloat(out, a);
+    out += '\n';
+  }
+
+  void appendTag(std::string &out, const char *tag, float a, float b) {
+    out += tag;
+    out += ' ';
+    appendFloat(out, a);
+    out += ' ';
+    appendFloat(out, b);
+    out += '\n';
+  }
+
+  bool sameSource(const SceneSources &a, size_t i, const SceneSources &b, size_t j) {
+    return a.x[i] == b.x[j] && a.y[i] == b.y[j] && a.re[i] == b.re[j] && a.im[i] == b.im[j];
+  }
+
+}
+
+size_t SceneSources::size() const {
+  return x.size();
+}
+
+void SceneSources::push(float px, float py, float pwl, float pre, float pim) {
+  x.push_back(px);
+  y.push_back(py);
+  wl.push_back(pwl);
+  re.push_back(pre);
+  im.push_back(pim);
+}
+
+SceneArrays SceneSources::arrays() const {
+  SceneArrays a = {size(), x.data(), y.data(), wl.data(), re.data(), im.data()};
+  return a;
+}
+
+size_t Scene::nbSources() const {
+  size_t n = 0;
+  for (const SceneSources &l : lists) {
+    n += l.size();
+  }
+  return n;
+}
+
+SceneMap::SceneMap(const std::string &file) {
+  data = NULL;
+  size = 0;
+#ifdef _WIN32
+  file_handle = CreateFileA(file.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+			    FILE_ATTRIBUTE_NORMAL, NULL);
+  map_handle = NULL;
+  ERROR(file_handle != INVALID_HANDLE_VALUE, "Cannot open file "<<file, "");
+  LARGE_INTEGER file_size;
+  GetFileSizeEx(file_handle, &file_size);
+  size = file_size.QuadPart;
+  if (size >= sizeof(BinaryHeader)) {
+    map_handle = CreateFileMappingA(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (map_handle) {
+      data = (const char*)MapViewOfFile(map_handle, FILE_MAP_READ, 0, 0, 0);
+    }
+  }
+#else
+  int fd = ::open(file.c_str(), O_RDONLY);
+  ERROR(fd >= 0, "Cannot open file "<<file, "");
+  struct stat sb;
+  if (fstat(fd, &sb) == 0) {
+    size = sb.st_size;
+  }
+  if (size >= sizeof(BinaryHeader)) {
+    void *m = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    data = m == MAP_FAILED ? NULL : (const char*)m;
+  }
+  ::close(fd);
+#endif
+
+  // layout of the arrays, checked against the size of the file
+  const BinaryHeader *h = (const BinaryHeader*)data;
+  bool valid = data && std::memcmp(h->magic, magic, 8) == 0
+    && h->nb_wl > 0 && (size_t)h->nb_wl <= max_wave_lengths && h->nb_markers >= 0;
+  size_t offset = sizeof(BinaryHeader);
+  if (valid) {
+    header = &h->settings;
+    nb_wl = h->nb_wl;
+    nb_markers = h->nb_markers;
+    // the counts follow the 68 bytes header, they are not 8 bytes aligned
+    const char *counts = data + offset;
+    offset += nb_wl*(sizeof(uint64_t) + sizeof(float));
+    valid = offset <= size;
+    if (valid) {
+      table = (const float*)(counts + nb_wl*sizeof(uint64_t));
+      lists.resize(nb_wl);
+      for (int w = 0; w < nb_wl && valid; ++w) {
+	uint64_t n;
+	std::memcpy(&n, counts + w*sizeof(uint64_t), sizeof(n));
+	valid = n <= (size - offset)/(5*sizeof(float));
+	if (valid) {
+	  const float *a = (const float*)(data + offset);
+	  SceneArrays arrays = {(size_t)n, a, a + n, a + 2*n, a + 3*n, a + 4*n};
+	  lists[w] = arrays;
+	  offset += 5*n*sizeof(float);
+	}
+      }
+    }
+    marker_data = (const float*)(data + offset);
+    valid = valid && offset + 2*sizeof(float)*nb_markers == size;
+  }
+  if (!valid) {
+#ifdef _WIN32
+    if (data) {
+      UnmapViewOfFile(data);
+    }
+    if (map_handle) {
+      CloseHandle(map_handle);
+    }
+    CloseHandle(file_handle);
+#else
+    if (data) {
+      munmap((void*)data, size);
+    }
+#endif
+    ERROR(false, "Invalid scene file "<<file, "");
+  }
+}
+
+SceneMap::~SceneMap() {
+#ifdef _WIN32
+  UnmapViewOfFile(data);
+  CloseHandle(map_handle);
+  CloseHandle(file_handle);
+#else
+  munmap((void*)data, size);
+#endif
+}
+
+const SceneSettings &SceneMap::settings() const {
+  return *header;
+}
+
+int SceneMap::nbWaveLengths() const {
+  return nb_wl;
+}
+
+const float *SceneMap::waveLengths() const {
+  return table;
+}
+
+const SceneArrays &SceneMap::sources(int w) const {
+  return lists[w];
+}
+
+int SceneMap::nbMarkers() const {
+  return nb_markers;
+}
+
+const float *SceneMap::markers() const {
+  return marker_data;
+}
+
+/* Scene of WaterSurface::reset before its configuration file is loaded */
+Scene SceneFile::defaults() {
+  Scene scene;
+  SceneSettings &st = scene.settings;
+  st.gravity = settings::gravity_;
+  st.damping = settings::damping_;
+  st.height_ampli = settings::height_ampli_;
+  st.n_rows = settings::n_rows_;
+  st.n_cols = settings::n_cols_;
+  st.cell_size = settings::cell_size_;
+  st.init_wl = settings::init_wl_;
+  st.min_wl = 1;
+  st.max_wl = 1;
+  st.step_wl = settings::init_wl_;
+  st.load_texture = settings::doLoadTexture;
+  st.reserved = 0;
+  scene.wave_lengths = waveLengthTable(st.min_wl, st.max_wl, st.step_wl);
+  scene.lists.resize(scene.wave_lengths.size());
+  return scene;
+}
+
+/* Wave lengths from min_wl, multiplied by step_wl up to max_wl (see
+   WaterSurface::setLists) */
+std::vector<float> SceneFile::waveLengthTable(float min_wl, float max_wl, float step_wl) {
+  std::vector<float> table(1, min_wl);
+  FLOAT wl = min_wl;
+  while (wl < max_wl && table.size() <= max_wave_lengths) {
+    wl *= step_wl;
+    table.push_back(wl);
+  }
+  return table;
+}
+
+bool SceneFile::isBinary(const std::string &file) {
+  char head[8];
+  std::ifstream is(file, std::ios::binary);
+  return is.read(head, 8) && std::memcmp(head, magic, 8) == 0;
+}
+
+void SceneFile::read(const std::string &file, Scene &scene) {
+  if (isBinary(file)) {
+    readBinary(file, scene);
+  } else {
+    readText(file, scene);
+  }
+}
+
+/* Binary if the extension is .wds */
+void SceneFile::write(const std::string &file, const Scene &scene) {
+  if (file.size() > 4 && file.compare(file.size() - 4, 4, ".wds") == 0) {
+    writeBinary(file, scene);
+  } else {
+    writeText(file, scene);
+  }
+}
+
+/* Adds the content of a configuration file to scene; nothing is changed if
+   the file is invalid */
+void SceneFile::readText(const std::string &file, Scene &scene) {
+  std::ifstream is(file, std::ios::binary);
+  ERROR(is.good(), "Cannot open file "<<file, "");
+  std::string text;
+  is.seekg(0, std::ios::end);
+  text.resize((size_t)is.tellg());
+  is.seekg(0, std::ios::beg);
+  is.read(&text[0], text.size());
+  is.close();
+
+  Scene parsed = scene;
+  TextParser parser(text, parsed);
+  const std::vector<std::string> &errors = parser.parse();
+  if (!errors.empty()) {
+    std::stringstream ss;
+    for (size_t k = 0; k < errors.size() && k < max_errors; ++k) {
+      ss<<"  "<<errors[k]<<"\n";
+    }
+    if (errors.size() > max_errors) {
+      ss<<"  ... "<<errors.size() - max_errors<<" more\n";
+    }
+    ERROR(false, "Invalid configuration file \""<<file<<"\" ("<<errors.size()<<" errors)", ss.str());
+  }
+  scene = std::move(parsed);
+}
+
+/* The sources present in every list with the wave length of the list are
+   written as <source_all>, the others as <source_at>, and the markers
+   separately: reading the file gives back the same lists in the same
+   order. */
+void SceneFile::writeText(const std::string &file, const Scene &scene) {
+  const SceneSettings &st = scene.settings;
+  std::string out;
+  appendTag(out, "<gravity>", st.gravity);
+  appendTag(out, "<damping>", st.damping);
+  appendTag(out, "<ampli>", st.height_ampli);
+  out += "<grid>\n<size> " + std::to_string(st.n_rows) + " " + std::to_string(st.n_cols) + "\n";
+  appendTag(out, "<cell_size>", st.cell_size);
+  out += "</grid>\n#\n<wave_lenghts>\n";
+  appendTag(out, "<min>", st.min_wl);
+  appendTag(out, "<max>", st.max_wl);
+  appendTag(out, "<step>", st.step_wl);
+  out += "</wave_lenghts>\n#\n";
+  // relative to the default (see settings::doLoadTexture)
+  if (!st.load_texture) {
+    out += "<load_texture>\n";
+  }
+  for (size_t k = 0; k + 1 < scene.markers.size(); k += 2) {
+    appendTag(out, "<marker>", scene.markers[k], scene.markers[k + 1]);
+  }
+
+  out += "<wave>\n";
+  float re = st.height_ampli, im = 0;
+  size_t nb_wl = scene.lists.size();
+  std::vector<size_t> cursor(nb_wl, 0);
+  auto setAmpli = [&](const SceneSources &l, size_t i) {
+    if (l.re[i] != re || l.im[i] != im) {
+      re = l.re[i];
+      im = l.im[i];
+      appendTag(out, "<ampli>", re, im);
+    }
+  };
+  auto sourceAt = [&](size_t w, size_t i) {
+    const SceneSources &l = scene.lists[w];
+    setAmpli(l, i);
+    out += "<source_at>\n<list> " + std::to_string(w) + "\n";
+    appendTag(out, "<wave_lenght>", l.wl[i]);
+    appendTag(out, "<pos>", l.x[i], l.y[i]);
+    out += "</source_at>\n";
+  };
+  if (nb_wl > 0) {
+    const SceneSources &first = scene.lists[0];
+    for (size_t i = 0; i < first.size(); ++i) {
+      bool all = true;
+      for (size_t w = 0; w < nb_wl && all; ++w) {
+	const SceneSources &l = scene.lists[w];
+	size_t c = w == 0 ? i : cursor[w];
+	all = c < l.size() && l.wl[c] == scene.wave_lengths[w] && sameSource(l, c, first, i);
+      }
+      if (all) {
+	setAmpli(first, i);
+	out += "<source_all>\n";
+	appendTag(out, "<pos>", first.x[i], first.y[i]);
+	out += "</source_all>\n";
+	for (size_t w = 1; w < nb_wl; ++w) {
+	  ++cursor[w];
+	}
+      } else {
+	sourceAt(0, i);
+      }
+    }
+  }
+  for (size_t w = 1; w < nb_wl; ++w) {
+    for (size_t i = cursor[w]; i < scene.lists[w].size(); ++i) {
+      sourceAt(w, i);
+    }
+  }
+  out += "</wave>\n";
+
+  std::ofstream os(file, std::ios::binary);
+  ERROR(os.good(), "Cannot open file "<<file, "");
+  os.write(out.data(), out.size());
+  ERROR(os.good(), "Cannot write file "<<file, "");
+}
+
+void SceneFile::readBinary(const std::string &file, Scene &scene) {
+  SceneMap map(file);
+  scene.settings = map.settings();
+  scene.wave_lengths.assign(map.waveLengths(), map.waveLengths() + map.nbWaveLengths());
+  scene.lists.assign(map.nbWaveLengths(), SceneSources());
+  for (int w = 0; w < map.nbWaveLengths(); ++w) {
+    const SceneArrays &a = map.sources(w);
+    SceneSources &l = scene.lists[w];
+    l.x.assign(a.x, a.x + a.n);
+    l.y.assign(a.y, a.y + a.n);
+    l.wl.assign(a.wl, a.wl + a.n);
+    l.re.assign(a.re, a.re + a.n);
+    l.im.assign(a.im, a.im + a.n);
+  }
+  scene.markers.assign(map.markers(), map.markers() + 2*map.nbMarkers());
+}
+
+void SceneFile::writeBinary(const std::string &file, const Scene &scene) {
+  BinaryHeader header;
+  std::memcpy(header.magic, magic, 8);
+  header.settings = scene.settings;
+  header.settings.reserved = 0;
+  header.nb_wl = scene.wave_lengths.size();
+  header.nb_markers = scene.markers.size()/2;
+  ERROR(scene.lists.size() == scene.wave_lengths.size(), "Invalid scene: "<<scene.lists.size()
+	<<" source lists for "<<scene.wave_lengths.size()<<" wave lengths", "");
+
+  std::vector<uint64_t> counts(header.nb_wl);
+  for (int w = 0; w < header.nb_wl; ++w) {
+    counts[w] = scene.lists[w].size();
+  }
+  std::FILE *f = std::fopen(file.c_str(), "wb");
+  ERROR(f, "Cannot open file "<<file, "");
+  bool ok = std::fwrite(&header, sizeof(header), 1, f) == 1
+    && std::fwrite(counts.data(), sizeof(uint64_t), counts.size(), f) == counts.size()
+    && std::fwrite(scene.wave_lengths.data(), sizeof(float), header.nb_wl, f) == (size_t)header.nb_wl;
+  for (const SceneSources &l : scene.lists) {
+    for (const std::vector<float> *a : {&l.x, &l.y, &l.wl, &l.re, &l.im}) {
+      ok = ok && std::fwrite(a->data(), sizeof(float), a->size(), f) == a->size();
+    }
+  }
+  ok = ok && std::fwrite(scene.markers.data(), sizeof(float), 2*header.nb_markers, f) == 2*(size_t)header.nb_markers;
+  ok = std::fclose(f) == 0 && ok;
+  ERROR(ok, "Cannot write file "<<file, "");
+}
@@ -0,0 +1,100 @@
+#ifndef SCENEFILE_HPP
+#define SCENEFILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Scene of a configuration file: the settings, the wave length table and
+ * the sources of each wave length as arrays (the engine keeps one list of
+ * sources per wave length, see WaterSurface::waves).
+ *
+ * Two formats:
+ * - the text configuration files (see conf/), read in one pass by a
+ *   scanner that reports all the errors with their line number;
+ * - a binary snapshot (.wds) loaded by mapping the file: "WDSCENE1", the
+ *   SceneSettings, int32 number of wave lengths and of markers, uint64
+ *   number of sources of each wave length, the float32 wave lengths, then
+ *   for each wave length the float32 arrays x, y, wave length, real and
+ *   imaginary amplitude of its sources, and the markers (x, y pairs).
+ */
+
+// stored as is in the binary header
+struct SceneSettings {
+  float gravity, damping, height_ampli;
+  int32_t n_rows, n_cols;
+  float cell_size;
+  float init_wl, min_wl, max_wl, step_wl;
+  int32_t load_texture;
+  int32_t reserved;
+};
+
+// sources of one wave length
+struct SceneArrays {
+  size_t n;
+  const float *x, *y, *wl, *re, *im;
+};
+
+struct SceneSources {
+  std::vector<float> x, y, wl, re, im;
+
+  size_t size() const;
+  void push(float px, float py, float pwl, float pre, float pim);
+  SceneArrays arrays() const;
+};
+
+struct Scene {
+  SceneSettings settings;
+  std::vector<float> wave_lengths;
+  std::vector<SceneSources> lists; // one per wave length
+  std::vector<float> markers;      // positions of the source markers, x, y pairs
+
+  size_t nbSources() const;
+};
+
+// read only mapping of a binary scene
+class SceneMap {
+private:
+  const char *data;
+  size_t size;
+#ifdef _WIN32
+  void *file_handle, *map_handle;
+#endif
+  const SceneSettings *header;
+  int nb_wl, nb_markers;
+  std::vector<SceneArrays> lists;
+  const float *table, *marker_data;
+
+public:
+  SceneMap(const std::string &file);
+  ~SceneMap();
+  SceneMap(const SceneMap &) = delete;
+  SceneMap &operator=(const SceneMap &) = delete;
+
+  const SceneSettings &settings() const;
+  int nbWaveLengths() const;
+  const float *waveLengths() const;
+  const SceneArrays &sources(int w) const;
+  int nbMarkers() const;
+  const float *markers() const;
+};
+
+class SceneFile {
+public:
+  static Scene defaults();
+
+  static bool isBinary(const std::string &file);
+  static void read(const std::string &file, Scene &scene);
+  static void write(const std::string &file, const Scene &scene);
+
+  static void readText(const std::string &file, Scene &scene);
+  static void writeText(const std::string &file, const Scene &scene);
+  static void readBinary(const std::string &file, Scene &scene);
+  static void writeBinary(const std::string &file, const Scene &scene);
+
+  static std::vector<float> waveLengthTable(float min_wl, float max_wl, float step_wl);
+};
+
+#endif
@@ -0,0 +1,175 @@
+#include "SnapshotCapture.hpp"
+#include "Profiler.hpp"
+#include "plotter.hpp"
+#include "error.hpp"
+
+#include <cstring>
+#include <memory>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+
+SnapshotCapture::SnapshotCapture(int n_buffers, int n_threads, size_t capacity) :
+  slots(n_buffers > 0 ? n_buffers : 1), queue(n_threads, capacity, ExportQueue::DROP_) {
+  gl = NULL;
+  initialized = false;
+  supported = false;
+  head = 0;
+  n_pending = 0;
+  n_captured = 0;
+  n_dropped = 0;
+  for (Slot &s : slots) {
+    s.buffer = 0;
+    s.fence = 0;
+    s.width = s.height = 0;
+  }
+}
+
+SnapshotCapture::~SnapshotCapture() {}
+
+bool SnapshotCapture::init() {
+  initialized = true;
+  QOpenGLContext *context = QOpenGLContext::currentContext();
+  if (context == NULL) {
+    return false;
+  }
+  gl = context->extraFunctions();
+  if (context->format().version() < qMakePair(3, 2) &&
+      !(context->hasExtension("GL_ARB_pixel_buffer_object") &&
+        context->hasExtension("GL_ARB_map_buffer_range") &&
+        context->hasExtension("GL_ARB_sync"))) {
+    WARNING(false, "SnapshotCapture: no pixel buffer objects, synchronous read back", "");
+    return false;
+  }
+  for (Slot &s : slots) {
+    gl->glGenBuffers(1, &s.buffer);
+  }
+  supported = true;
+  return true;
+}
+
+/* Copies the bottom-up rows of the frame buffer and hands them to the
+   writer threads. */
+void SnapshotCapture::encode(const std::string &file, const unsigned char *pixels, int width, int height) {
+  size_t row_size = (size_t)3*width;
+  auto image = std::make_shared<std::vector<unsigned char> >(row_size*height);
+  for (int y = 0; y < height; ++y) {
+    memcpy(image->data() + row_size*y, pixels + row_size*(height - 1 - y), row_size);
+  }
+  queue.push([=] {Plotter::writePng(file, image->data(), width, height);});
+}
+
+/* Reads the current frame buffer into the next free pixel buffer. The GL
+   context must be current, and the frame drawn. */
+void SnapshotCapture::capture(const std::string &file, int width, int height) {
+  PROFILE_ZONE("SnapshotCapture::capture");
+  if (!initialized) {
+    init();
+  }
+  if (gl == NULL) {
+    return;
+  }
+  ++n_captured;
+  GLint alignment;
+  gl->glGetIntegerv(GL_PACK_ALIGNMENT, &alignment);
+  gl->glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+  if (!supported) {
+    std::vector<unsigned char> pixels((size_t)3*width*height);
+    gl->glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+    gl->glPixelStorei(GL_PACK_ALIGNMENT, alignment);
+    encode(file, pixels.data(), width, height);
+    return;
+  }
+
+  poll();
+  if (n_pending == (int)slots.size()) {
+    // the oldest read back is not finished, waiting would stall the frame
+    ++n_dropped;
+    gl->glPixelStorei(GL_PACK_ALIGNMENT, alignment);
+    return;
+  }
+  Slot &s = slots[(head + n_pending) % slots.size()];
+  gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, s.buffer);
+  if (s.width != width || s.height != height) {
+    gl->glBufferData(GL_PIXEL_PACK_BUFFER, (size_t)3*width*height, NULL, GL_STREAM_READ);
+    s.width = width;
+    s.height = height;
+  }
+  gl->glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+  gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  gl->glPixelStorei(GL_PACK_ALIGNMENT, alignment);
+  s.fence = gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  s.file = file;
+  ++n_pending;
+}
+
+/* Maps the finished read backs, in order. With wait, blocks until all the
+   pending ones are finished. */
+void SnapshotCapture::poll(bool wait) {
+  while (n_pending > 0) {
+    Slot &s = slots[head];
+    GLenum status = gl->glClientWaitSync(s.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+                                         wait ? 1000000000 : 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+      if (wait) {
+        WARNING(false, "SnapshotCapture: read back not finished", s.file);
+      }
+      return;
+    }
+    gl->glDeleteSync(s.fence);
+    s.fence = 0;
+    gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, s.buffer);
+    const unsigned char *pixels = (const unsigned char *)
+      gl->glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (size_t)3*s.width*s.height, GL_MAP_READ_BIT);
+    if (pixels != NULL) {
+      encode(s.file, pixels, s.width, s.height);
+      gl->glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    } else {
+      ++n_dropped;
+    }
+    gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    head = (head + 1) % slots.size();
+    --n_pending;
+  }
+}
+
+/* Waits until every captured frame is written, the GL context must be
+   current. */
+void SnapshotCapture::flush() {
+  if (supported) {
+    poll(true);
+  }
+  queue.flush();
+}
+
+/* Frees the GL objects, the GL context must be current. */
+void SnapshotCapture::release() {
+  if (supported) {
+    for (Slot &s : slots) {
+      if (s.fence != 0) {
+        gl->glDeleteSync(s.fence);
+        s.fence = 0;
+      }
+      gl->glDeleteBuffers(1, &s.buffer);
+      s.width = s.height = 0;
+    }
+  }
+  n_dropped += n_pending;
+  head = 0;
+  n_pending = 0;
+  initialized = false;
+  supported = false;
+}
+
+/* Frames read back or waiting to be encoded. */
+int SnapshotCapture::queueDepth() const {
+  return n_pending + (int)queue.pending();
+}
+
+unsigned long SnapshotCapture::capturedFrames() const {
+  return n_captured;
+}
+
+unsigned long SnapshotCapture::droppedFrames() const {
+  return n_dropped + queue.dropped();
+}
@@ -0,0 +1,54 @@
+#ifndef SNAPSHOTCAPTURE_HPP
+#define SNAPSHOTCAPTURE_HPP
+
+#include <string>
+#include <vector>
+#include <qopengl.h>
+#include "ExportQueue.hpp"
+
+class QOpenGLExtraFunctions;
+
+/*
+ * Saves the frame buffer to PNG files without stalling the draw loop.
+ * glReadPixels writes into a ring of pixel buffer objects, a buffer is
+ * mapped a few frames later once its fence is signaled, and the image is
+ * encoded by the writer threads of an ExportQueue. A frame is dropped when
+ * the ring or the queue is full. Without PBO and sync objects, the read
+ * back is synchronous but the encoding is still done in the background.
+ */
+class SnapshotCapture {
+private:
+  struct Slot {
+    GLuint buffer;
+    GLsync fence;
+    int width, height;
+    std::string file;
+  };
+
+  QOpenGLExtraFunctions *gl;
+  bool initialized;
+  bool supported;
+
+  std::vector<Slot> slots;
+  int head, n_pending;
+  unsigned long n_captured, n_dropped;
+  ExportQueue queue;
+
+  bool init();
+  void encode(const std::string &file, const unsigned char *pixels, int width, int height);
+
+public:
+  SnapshotCapture(int n_buffers, int n_threads, size_t capacity);
+  ~SnapshotCapture();
+
+  void capture(const std::string &file, int width, int height);
+  void poll(bool wait = false);
+  void flush();
+  void release();
+
+  int queueDepth() const;
+  unsigned long capturedFrames() const;
+  unsigned long droppedFrames() const;
+};
+
+#endif
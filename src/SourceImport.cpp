@@ -0,0 +1,305 @@
+#include "SourceImport.hpp"
+#include "error.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <utility>
+#include <omp.h>
+
+namespace {
+
+  // errors printed when a file is rejected
+  const size_t max_errors = 50;
+  const size_t chunk_bytes = 1 << 20;
+  const size_t chunk_records = 1 << 16;
+  // relative difference accepted between a wave length and the table
+  const float wl_tolerance = 1e-4f;
+
+  // records of a part of the file
+  struct Chunk {
+    SceneSources sources;
+    std::vector<int> lists;                             // -1 for every list
+    std::vector<std::pair<size_t, std::string>> errors; // line in the chunk or record
+    size_t n_errors = 0;
+    size_t lines = 0;
+  };
+
+  void addError(Chunk &c, size_t where, const std::string &msg) {
+    if (c.errors.size() < max_errors) {
+      c.errors.push_back(std::make_pair(where, msg));
+    }
+    ++c.n_errors;
+  }
+
+  // list of wave length wl (increasing table), -1 for 0 (every list), -2 if none
+  int findList(const std::vector<float> &table, float wl) {
+    if (wl == 0) {
+      return -1;
+    }
+    size_t w = std::lower_bound(table.begin(), table.end(), wl) - table.begin();
+    for (size_t k = w > 0 ? w - 1 : 0; k <= w && k < table.size(); ++k) {
+      if (std::fabs(table[k] - wl) <= wl_tolerance*table[k]) {
+	return k;
+      }
+    }
+    return -2;
+  }
+
+  void addRecord(Chunk &c, size_t where, const float v[5], const std::vector<float> &table) {
+    for (int k = 0; k < 5; ++k) {
+      if (!std::isfinite(v[k])) {
+	addError(c, where, "value not finite");
+	return;
+      }
+    }
+    int list = findList(table, v[2]);
+    if (list == -2) {
+      std::stringstream ss;
+      ss<<"wave length "<<v[2]<<" not in the table ("<<table.front()<<" to "<<table.back()<<")";
+      addError(c, where, ss.str());
+      return;
+    }
+    c.sources.push(v[0], v[1], v[2], v[3], v[4]);
+    c.lists.push_back(list);
+  }
+
+  inline const char *skipBlanks(const char *p, const char *eol) {
+    while (p < eol && (*p == ' ' || *p == '\t' || *p == '\r')) {
+      ++p;
+    }
+    return p;
+  }
+
+  // lines [p, end) of a CSV file, header is true for the chunk starting the file
+  void parseCsv(const char *p, const char *end, bool header, const std::vector<float> &table, Chunk &c) {
+    while (p < end) {
+      const char *nl = (const char*)std::memchr(p, '\n', end - p);
+      const char *eol = nl ? nl : end;
+      const char *q = skipBlanks(p, eol);
+      size_t line = ++c.lines;
+      p = nl ? nl + 1 : end;
+      if (q == eol || *q == '#' || (header && line == 1 && std::isalpha((unsigned char)*q))) {
+	continue;
+      }
+      float v[5] = {0, 0, 0, 1, 0};
+      int n = 0;
+      const char *error = NULL;
+      while (q < eol) {
+	if (n == 5) {
+	  error = "more than 5 values";
+	  break;
+	}
+	if (*q == '+') {
+	  ++q;
+	}
+	std::from_chars_result r = std::from_chars(q, eol, v[n]);
+	if (r.ec != std::errc() || r.ptr == q) {
+	  error = "number expected";
+	  break;
+	}
+	++n;
+	q = skipBlanks(r.ptr, eol);
+	if (q < eol && (*q == ',' || *q == ';')) {
+	  q = skipBlanks(q + 1, eol);
+	}
+      }
+      if (!error && n < 3) {
+	error = "x, y and wave length expected";
+      }
+      if (error) {
+	addError(c, line, error);
+      } else {
+	addRecord(c, line, v, table);
+      }
+    }
+  }
+
+  // records [r0, r1) of a float32 file
+  void parseFloat32(const char *data, size_t r0, size_t r1, const std::vector<float> &table, Chunk &c) {
+    for (std::vector<float> *a : {&c.sources.x, &c.sources.y, &c.sources.wl, &c.sources.re, &c.sources.im}) {
+      a->reserve(r1 - r0);
+    }
+    c.lists.reserve(r1 - r0);
+    for (size_t r = r0; r < r1; ++r) {
+      float v[5];
+      std::memcpy(v, data + 5*sizeof(float)*r, sizeof(v));
+      addRecord(c, r + 1, v, table);
+    }
+  }
+
+  // key of a position, 0 and -0 are the same
+  inline uint64_t positionKey(float x, float y) {
+    uint32_t bx = 0, by = 0;
+    if (x != 0) {
+      std::memcpy(&bx, &x, sizeof(bx));
+    }
+    if (y != 0) {
+      std::memcpy(&by, &y, sizeof(by));
+    }
+    return (uint64_t)bx << 32 | by;
+  }
+
+  // ids of the distinct positions, numbered in order (open addressing)
+  class PositionTable {
+  private:
+    // not a key: the positions are finite
+    static constexpr uint64_t empty = ~(uint64_t)0;
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> ids;
+    int bits;
+    uint32_t n;
+
+  public:
+    PositionTable(size_t n_max): bits(4), n(0) {
+      while (((size_t)1 << bits) < 2*n_max) {
+	++bits;
+      }
+      keys.assign((size_t)1 << bits, empty);
+      ids.resize(keys.size());
+    }
+
+    uint32_t size() const {
+      return n;
+    }
+
+    uint32_t insert(uint64_t key, bool &added) {
+      size_t mask = keys.size() - 1;
+      size_t h = (key*0x9E3779B97F4A7C15ull) >> (64 - bits);
+      while (keys[h] != key && keys[h] != empty) {
+	h = (h + 1) & mask;
+      }
+      added = keys[h] == empty;
+      if (added) {
+	keys[h] = key;
+	ids[h] = n++;
+      }
+      return ids[h];
+    }
+  };
+
+}
+
+SourceSet SourceImport::read(const std::string &file, const std::vector<float> &table) {
+  std::ifstream is(file, std::ios::binary);
+  ERROR(is.good(), "Cannot open file "<<file, "");
+  std::string data;
+  is.seekg(0, std::ios::end);
+  data.resize((size_t)is.tellg());
+  is.seekg(0, std::ios::beg);
+  is.read(&data[0], data.size());
+  is.close();
+
+  // chunks ending at line (or record) boundaries
+  bool csv = file.size() > 4 && file.compare(file.size() - 4, 4, ".csv") == 0;
+  std::vector<size_t> bounds(1, 0);
+  if (csv) {
+    while (bounds.back() < data.size()) {
+      size_t b = bounds.back() + chunk_bytes;
+      if (b >= data.size()) {
+	b = data.size();
+      } else {
+	const char *nl = (const char*)std::memchr(data.data() + b, '\n', data.size() - b);
+	b = nl ? nl - data.data() + 1 : data.size();
+      }
+      bounds.push_back(b);
+    }
+  } else {
+    ERROR(data.size() % (5*sizeof(float)) == 0, "Invalid source file "<<file,
+	  "the size is not a multiple of 5 float32 values");
+    size_t n = data.size()/(5*sizeof(float));
+    while (bounds.back() < n) {
+      bounds.push_back(std::min(n, bounds.back() + chunk_records));
+    }
+  }
+  int n_chunks = bounds.size() - 1;
+  std::vector<Chunk> chunks(n_chunks);
+#pragma omp parallel for schedule(dynamic)
+  for (int c = 0; c < n_chunks; ++c) {
+    if (csv) {
+      parseCsv(data.data() + bounds[c], data.data() + bounds[c + 1], c == 0, table, chunks[c]);
+    } else {
+      parseFloat32(data.data(), bounds[c], bounds[c + 1], table, chunks[c]);
+    }
+  }
+
+  size_t n_errors = 0, line0 = 0;
+  std::stringstream ss;
+  for (const Chunk &c : chunks) {
+    for (const std::pair<size_t, std::string> &e : c.errors) {
+      if (n_errors < max_errors) {
+	ss<<"  "<<(csv ? "line " : "record ")<<(csv ? line0 + e.first : e.first)<<": "<<e.second<<"\n";
+      }
+      ++n_errors;
+    }
+    n_errors += c.n_errors - c.errors.size();
+    line0 += c.lines;
+  }
+  if (n_errors > max_errors) {
+    ss<<"  ... "<<n_errors - max_errors<<" more\n";
+  }
+  ERROR(n_errors == 0, "Invalid source file \""<<file<<"\" ("<<n_errors<<" errors)", ss.str());
+
+  // distinct positions, in the order of the file
+  SourceSet set;
+  set.n_records = 0;
+  set.n_merged = 0;
+  for (const Chunk &c : chunks) {
+    set.n_records += c.sources.size();
+  }
+  PositionTable ids(set.n_records);
+  std::vector<uint32_t> pos_id;
+  pos_id.reserve(set.n_records);
+  std::vector<size_t> count(table.size(), 0);
+  for (const Chunk &c : chunks) {
+    for (size_t k = 0; k < c.sources.size(); ++k) {
+      bool added;
+      pos_id.push_back(ids.insert(positionKey(c.sources.x[k], c.sources.y[k]), added));
+      if (added) {
+	set.markers.push_back(c.sources.x[k]);
+	set.markers.push_back(c.sources.y[k]);
+      }
+      if (c.lists[k] >= 0) {
+	++count[c.lists[k]];
+      } else {
+	for (size_t w = 0; w < table.size(); ++w) {
+	  ++count[w];
+	}
+      }
+    }
+  }
+
+  // one source per position and list, with the sum of the amplitudes
+  set.lists.resize(table.size());
+  std::vector<int64_t> slot(ids.size());
+  for (size_t w = 0; w < table.size(); ++w) {
+    SceneSources &out = set.lists[w];
+    for (std::vector<float> *a : {&out.x, &out.y, &out.wl, &out.re, &out.im}) {
+      a->reserve(count[w]);
+    }
+    std::fill(slot.begin(), slot.end(), -1);
+    size_t r = 0;
+    for (const Chunk &c : chunks) {
+      for (size_t k = 0; k < c.sources.size(); ++k, ++r) {
+	if (c.lists[k] != (int)w && c.lists[k] != -1) {
+	  continue;
+	}
+	int64_t &s = slot[pos_id[r]];
+	if (s < 0) {
+	  s = out.size();
+	  out.push(c.sources.x[k], c.sources.y[k], table[w], c.sources.re[k], c.sources.im[k]);
+	} else {
+	  out.re[s] += c.sources.re[k];
+	  out.im[s] += c.sources.im[k];
+	  ++set.n_merged;
+	}
+      }
+    }
+  }
+  return set;
+}
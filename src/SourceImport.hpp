@@ -0,0 +1,34 @@
+#ifndef SOURCEIMPORT_HPP
+#define SOURCEIMPORT_HPP
+
+#include <string>
+#include <vector>
+
+#include "SceneFile.hpp"
+
+/*
+ * Bulk import of sources produced by other tools, one source per record:
+ * x, y, wave length, real and imaginary amplitude.
+ * - .csv: one record per line, separated by commas, semicolons or blanks;
+ *   the amplitude is optional (1, 0) and so is its imaginary part, a first
+ *   line starting with a letter is a header, # starts a comment;
+ * - anything else: raw float32 records of 5 values (an N x 5 array).
+ * The file is split in chunks parsed in parallel. The wave length of a
+ * record selects the list of that wave length (0: every list); sources of
+ * the same list at the same position are merged by adding their
+ * amplitudes. Invalid records (not finite, unknown wave length) are
+ * reported together and nothing is imported.
+ */
+struct SourceSet {
+  std::vector<SceneSources> lists; // one per wave length of the table
+  std::vector<float> markers;      // distinct positions, x, y pairs
+  size_t n_records;
+  size_t n_merged;
+};
+
+class SourceImport {
+public:
+  static SourceSet read(const std::string &file, const std::vector<float> &table);
+};
+
+#endif
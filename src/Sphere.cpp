@@ -91,6 +91,18 @@ void Sphere::create_array() {
     }
 }
 
+int Sphere::arraySize() {
+  return size_array;
+}
+
+const GLfloat *Sphere::getVertices() {
+  return vertices;
+}
+
+const GLfloat *Sphere::getNormals() {
+  return normals;
+}
+
 void Sphere::create_vertex(float theta, float phi, int &index) {
     vertices[index] = cos(theta)*sin(phi);
     vertices[index+1] = sin(theta)*sin(phi);
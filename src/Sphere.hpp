@@ -27,6 +27,9 @@ public :
   void draw();
 
   static void create_array();
+  static int arraySize();
+  static const GLfloat *getVertices();
+  static const GLfloat *getNormals();
   static void create_vertex(float theta, float phi, int &index);
 
 };
@@ -0,0 +1,174 @@
+#include "Texture.hpp"
+#include "error.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#ifdef WD_HEADLESS
+#include <png.h>
+#endif
+
+std::map<std::string, std::shared_ptr<const Texture> > Texture::cache;
+
+Texture::Texture() {
+  width = 0;
+  height = 0;
+}
+
+/* Keeps the luminance of RGBA pixels (rows of <pitch> bytes) */
+void Texture::setPixels(const unsigned char *pixels, int w, int h, size_t pitch) {
+  width = w;
+  height = h;
+  values = std::vector<float>((size_t)width*height);
+#pragma omp parallel for
+  for (int y = 0; y < height; ++y) {
+    const unsigned char *p = pixels + (size_t)y*pitch;
+    float *v = &values[(size_t)y*width];
+#pragma omp simd
+    for (int x = 0; x < width; ++x) {
+      v[x] = (0.299f*p[4*x] + 0.587f*p[4*x+1] + 0.114f*p[4*x+2])/255.0f;
+    }
+  }
+}
+
+#ifndef WD_HEADLESS
+/* Converts the surface to RGBA so that every pixel format (palette, grey,
+   RGB, BGR...) is read the same way. */
+Texture::Texture(const SDL_Surface *surface) {
+  SDL_Surface *rgba = SDL_ConvertSurfaceFormat((SDL_Surface*)surface, SDL_PIXELFORMAT_RGBA32, 0);
+  ERROR(rgba != NULL, "Cannot convert texture: "<<SDL_GetError(), "");
+  setPixels((const unsigned char*) rgba->pixels, rgba->w, rgba->h, rgba->pitch);
+  SDL_FreeSurface(rgba);
+}
+#endif
+
+std::shared_ptr<const Texture> Texture::load(std::string file) {
+  auto it = cache.find(file);
+  if (it != cache.end()) {
+    return it->second;
+  }
+  INFO("Loading texture "<<file);
+#ifndef WD_HEADLESS
+  SDL_Surface *surface = IMG_Load(file.c_str());
+  ERROR(surface != NULL, "Cannot load texture "<<file<<": "<<SDL_GetError(), "");
+  std::shared_ptr<const Texture> tex = std::make_shared<const Texture>(surface);
+  SDL_FreeSurface(surface);
+#else
+  // no SDL_image in the batch build, only png files are read (libpng)
+  png_image image;
+  memset(&image, 0, sizeof(image));
+  image.version = PNG_IMAGE_VERSION;
+  ERROR(png_image_begin_read_from_file(&image, file.c_str()),
+	"Cannot load texture "<<file<<": "<<image.message, "");
+  image.format = PNG_FORMAT_RGBA;
+  std::vector<unsigned char> pixels(PNG_IMAGE_SIZE(image));
+  ERROR(png_image_finish_read(&image, NULL, pixels.data(), 0, NULL),
+	"Cannot load texture "<<file<<": "<<image.message, "");
+  std::shared_ptr<Texture> tex = std::make_shared<Texture>();
+  tex->setPixels(pixels.data(), image.width, image.height, PNG_IMAGE_ROW_STRIDE(image));
+#endif
+  cache[file] = tex;
+  return tex;
+}
+
+void Texture::clearCache() {
+  cache.clear();
+}
+
+int Texture::getWidth() const {
+  return width;
+}
+
+int Texture::getHeight() const {
+  return height;
+}
+
+float Texture::operator()(int x, int y) const {
+  return values[(size_t)y*width + x];
+}
+
+/* 1D filter taps mapping n_in samples on n_out samples: output o reads
+   count[o] inputs starting at first[o] with the weights stored at
+   o*max_count in <weights>. Minification uses a box filter over the exact
+   footprint of the output cell, magnification a linear interpolation. */
+void Texture::taps(int n_out, int n_in, std::vector<int> &first,
+		   std::vector<int> &count, std::vector<float> &weights) {
+  double scale = (double)n_in/(double)n_out;
+  int max_count = scale > 1 ? (int)std::ceil(scale) + 1 : 2;
+  first = std::vector<int>(n_out);
+  count = std::vector<int>(n_out);
+  weights = std::vector<float>((size_t)n_out*max_count, 0.0f);
+  for (int o = 0; o < n_out; ++o) {
+    float *w = &weights[(size_t)o*max_count];
+    if (scale > 1) {
+      double a = o*scale, b = std::min((o + 1)*scale, (double)n_in);
+      int p0 = (int)a;
+      int p1 = std::min((int)std::ceil(b), n_in);
+      first[o] = p0;
+      count[o] = p1 - p0;
+      for (int p = p0; p < p1; ++p) {
+	w[p - p0] = (std::min(b, p + 1.0) - std::max(a, (double)p))/(b - a);
+      }
+    } else {
+      double c = std::max(0.0, std::min((o + 0.5)*scale - 0.5, n_in - 1.0));
+      int p0 = std::min((int)c, n_in - 1);
+      double f = c - p0;
+      first[o] = p0;
+      count[o] = (p0 + 1 < n_in) ? 2 : 1;
+      w[0] = 1 - f;
+      w[1] = f;
+    }
+  }
+}
+
+/* Resamples the texture on a n_rows x n_cols grid: grid rows follow the
+   image rows and grid columns the image columns. The filter is separable:
+   image rows are first resampled horizontally, then grid rows are built
+   from the filtered image rows. */
+void Texture::resample(FLOAT *out, int n_rows, int n_cols) const {
+  if (width == 0 || height == 0) {
+    std::fill(out, out + (size_t)n_rows*n_cols, (FLOAT)0);
+    return;
+  }
+  std::vector<int> first_x, count_x, first_y, count_y;
+  std::vector<float> weights_x, weights_y;
+  taps(n_cols, width, first_x, count_x, weights_x);
+  taps(n_rows, height, first_y, count_y, weights_y);
+  int max_x = weights_x.size()/n_cols;
+  int max_y = weights_y.size()/n_rows;
+
+  std::vector<float> tmp((size_t)height*n_cols);
+#pragma omp parallel for
+  for (int y = 0; y < height; ++y) {
+    const float *v = &values[(size_t)y*width];
+    float *t = &tmp[(size_t)y*n_cols];
+    for (int j = 0; j < n_cols; ++j) {
+      const float *w = &weights_x[(size_t)j*max_x];
+      const float *p = v + first_x[j];
+      float s = 0;
+      for (int k = 0; k < count_x[j]; ++k) {
+	s += w[k]*p[k];
+      }
+      t[j] = s;
+    }
+  }
+
+#pragma omp parallel for
+  for (int i = 0; i < n_rows; ++i) {
+    FLOAT *o = out + (size_t)i*n_cols;
+    const float *w = &weights_y[(size_t)i*max_y];
+#pragma omp simd
+    for (int j = 0; j < n_cols; ++j) {
+      o[j] = 0;
+    }
+    for (int k = 0; k < count_y[i]; ++k) {
+      const float *t = &tmp[(size_t)(first_y[i] + k)*n_cols];
+      float wk = w[k];
+#pragma omp simd
+      for (int j = 0; j < n_cols; ++j) {
+	o[j] += wk*t[j];
+      }
+    }
+  }
+}
@@ -0,0 +1,47 @@
+#ifndef TEXTURE_HPP
+#define TEXTURE_HPP
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "definitions.hpp"
+
+#ifndef WD_HEADLESS
+#include <SDL2/SDL_image.h>
+#endif
+
+/*
+ * Decoded grey level image (luminance in [0, 1], row major).
+ * Decoded files are cached so that a texture can be resampled on grids of
+ * different sizes without being loaded again.
+ */
+class Texture {
+private:
+  int width, height;
+  std::vector<float> values;
+
+  static std::map<std::string, std::shared_ptr<const Texture> > cache;
+
+  void setPixels(const unsigned char *rgba, int w, int h, size_t pitch);
+
+  static void taps(int n_out, int n_in, std::vector<int> &first,
+		   std::vector<int> &count, std::vector<float> &weights);
+
+public:
+  Texture();
+#ifndef WD_HEADLESS
+  Texture(const SDL_Surface *surface);
+#endif
+
+  static std::shared_ptr<const Texture> load(std::string file);
+  static void clearCache();
+
+  int getWidth() const;
+  int getHeight() const;
+  float operator()(int x, int y) const;
+
+  void resample(FLOAT *out, int n_rows, int n_cols) const;
+};
+
+#endif
@@ -19,9 +19,7 @@
 
 
 #include "Times.hpp"
-#include <time.h>
-
-using namespace boost::posix_time;
+#include <assert.h>
 
 Times *Times::TIMES(new Times());
 Times *Times::TIMES_UP(new Times());
@@ -31,7 +29,7 @@ Times::Times() {
 
 void Times::init() {
   for (unsigned int i = 0; i < nTimes; ++i) {
-    init_time[i] = not_a_date_time;
+    started[i] = false;
     loop_time[i] = 0;
     time_sum[i] = 0;
   }
@@ -40,14 +38,15 @@ void Times::init() {
 }
 
 void Times::tick(unsigned int i) {
-  init_time[i] = microsec_clock::local_time();
+  init_time[i] = std::chrono::steady_clock::now();
+  started[i] = true;
 }
 
 void Times::tock(unsigned int i) {
-  assert(init_time[i] != not_a_date_time);
-  ptime t_end = microsec_clock::local_time();
-  loop_time[i] += (t_end - init_time[i]).total_microseconds()*1e-6;
-  init_time[i] = not_a_date_time;
+  assert(started[i]);
+  std::chrono::steady_clock::time_point t_end = std::chrono::steady_clock::now();
+  loop_time[i] += std::chrono::duration<double>(t_end - init_time[i]).count();
+  started[i] = false;
 }
 
 double Times::getTime(unsigned int i) {
@@ -69,7 +68,7 @@ double Times::getAverageNbStepsByFrame() {
 void Times::next_loop() {
   for (unsigned int i = 0; i < nTimes; ++i) {
     time_sum[i] += loop_time[i];
-    init_time[i] = not_a_date_time;
+    started[i] = false;
     loop_time[i] = 0;
   }
 
@@ -20,7 +20,7 @@
 #ifndef TIMES_HPP
 #define TIMES_HPP
 
-#include <boost/date_time/posix_time/posix_time.hpp>
+#include <chrono>
 
 class Times {
   
@@ -36,7 +36,9 @@ public :
 		 nTimes};
 
 private :
-  boost::posix_time::ptime init_time[nTimes];
+  // monotonic clock, see Profiler for the nested / per thread zones
+  std::chrono::steady_clock::time_point init_time[nTimes];
+  bool started[nTimes];
   double loop_time[nTimes];
   double time_sum[nTimes];
 
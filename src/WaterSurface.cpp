@@ -18,13 +18,24 @@
  */
 
 #include "WaterSurface.hpp"
-#include "viewer.hpp"
+#include "Profiler.hpp"
 #include "EquivalentSource.hpp"
 #include "settings.hpp"
 #include "ui_parameters.hpp"
 #include "error.hpp"
 #include "Times.hpp"
+#include "BandStream.hpp"
+#include "SceneFile.hpp"
+#include "SourceImport.hpp"
+#include "AmplitudeExporter.hpp"
+#include "PerfOverlay.hpp"
+#include "plotter.hpp"
+#ifndef WD_HEADLESS
+#include "GridSimplifier.hpp"
+#endif
+#include <algorithm>
 #include <fstream>
+#include <sstream>
 #include <boost/math/special_functions/bessel.hpp>
 
 
@@ -39,36 +50,67 @@ WaterSurface::WaterSurface() {
   import_ = false;
   export_ = false;
   load_conf = false;
+  load_sources = false;
+  stream_ = false;
+  projected_ = false;
+  proj_dirty = false;
+  std::fill(camera_mvp, camera_mvp + 16, 0.0);
   draw_sources = false;
+  draw_vbo = true;
+  markers_dirty = true;
 
   stop_time = 1e4;
 
+  solving = false;
+  dropped = 0;
+  repeated = 0;
+
   data_file = "";
+#ifndef WD_HEADLESS
   sphere_source.create_array();
+#endif
 }
 
 WaterSurface::~WaterSurface() {
+  stopSolver();
   clear();
 }
 
 void WaterSurface::clear() {
-  std::list<EquivalentSource*>::iterator it;
-  std::vector<std::list<EquivalentSource*> >::iterator itwf;
+  std::vector<EquivalentSource*>::iterator it;
+  std::vector<std::vector<EquivalentSource*> >::iterator itwf;
   for (itwf= waves.begin(); itwf != waves.end(); ++itwf) {
     for (it = (*itwf).begin(); it != (*itwf).end(); ++it) {
-      delete (*it);
+      if (!inBlock(*it)) {
+        delete (*it);
+      }
     }
   }
   waves.clear();
+  source_blocks.clear();
+}
+
+bool WaterSurface::inBlock(const EquivalentSource *s) const {
+  std::less<const EquivalentSource*> less;
+  for (const std::vector<EquivalentSource> &b : source_blocks) {
+    if (!less(s, b.data()) && less(s, b.data() + b.size())) {
+      return true;
+    }
+  }
+  return false;
 }
 
 void WaterSurface::reset() {
+  PROFILE_ZONE("WaterSurface::reset");
   clear();
     sourcesPos.clear();
   constraintsPos.clear();
+  markers_dirty = true;
   createTabs();
-  sphere_source.setSize(0.1);
-  sphere_source.setColor(0.8f, 0.2f, 1.0f);
+#ifndef WD_HEADLESS
+  sphere_source.setSize(marker_size_);
+  sphere_source.setColor(source_color_[0], source_color_[1], source_color_[2]);
+#endif
   
   srand (std::time(NULL));
   
@@ -82,13 +124,21 @@ void WaterSurface::reset() {
   if (load_conf) {
     importConfig(conf_file);
   }
+  if (load_sources) {
+    importSources(sources_file);
+  }
 
-  u = Grid(n_rows_, n_cols_, cell_size_);
-  u.setColor(29.0/256.0,162.0/256.0,216.0/256.0);
+  if (stream_) {
+    // the surface is never held in memory, see streamHeight
+    u = Grid();
+  } else {
+    u = Grid(n_rows_, n_cols_, cell_size_);
+  }
+  u.setColor(surface_color_[0], surface_color_[1], surface_color_[2]);
 
   if(settings::doLoadTexture){
     pattern = Grid(n_rows_, n_cols_, cell_size_);
-    pattern.setColor(0.5, 0.5, 0.5);
+    pattern.setColor(pattern_color_[0], pattern_color_[1], pattern_color_[2]);
     pattern.loadTexture("test_texture2.png");
   }
   //INFO("Wavelength: "<<nb_wl<<" wavelenths between "<<min_wl<<" and "<<max_wl);
@@ -111,8 +161,12 @@ void WaterSurface::reset() {
   ss6 <<data_file<<"analytic.txt";
   std::string str6(ss6.str());
 
-  exportAmplitude(str);
-  exportPhase(str4);
+  if (stream_) {
+    streamAmplitude(data_file+"ampli.band", n_rows_, n_cols_, cell_size_);
+  } else {
+    exportAmplitude(str);
+    exportPhase(str4);
+  }
 #endif
 
   INFO("DONE! "<<nb_wl);
@@ -130,11 +184,16 @@ void WaterSurface::setLists() {
     wave_lenghts.push_back(wl);
     ++nb_wl;
   }
-   
-  
-  waves = std::vector<std::list<EquivalentSource*> >(nb_wl);
+  allocLists();
+}
+
+void WaterSurface::allocLists() {
+  waves = std::vector<std::vector<EquivalentSource*> >(nb_wl);
   ampli_re = std::vector<Grid>(nb_wl);
   ampli_im = std::vector<Grid>(nb_wl);
+  if (stream_) {
+    return;
+  }
   for (int i = 0; i < nb_wl; ++i) {
     ampli_re[i] = Grid(n_rows_, n_cols_, cell_size_);
     ampli_im[i] = Grid(n_rows_, n_cols_, cell_size_);
@@ -142,12 +201,14 @@ void WaterSurface::setLists() {
 }
 
 void WaterSurface::setAmpli() {
-    std::list<EquivalentSource*>::iterator it;
+    PROFILE_ZONE("WaterSurface::setAmpli");
+    PerfOverlay::Timer overlay_timer(PerfOverlay::AMPLITUDES_);
+    std::vector<EquivalentSource*>::const_iterator it;
 
     for (int w = 0; w < nb_wl; ++w) {
       ampli_re[w].reset(0);
       ampli_im[w].reset(0);
-      std::list<EquivalentSource*> waves_wl = waves[w];
+      const std::vector<EquivalentSource*> &waves_wl = waves[w];
 
         for (it = waves_wl.begin(); it != waves_wl.end(); ++it) {
 #pragma omp parallel for
@@ -160,17 +221,20 @@ void WaterSurface::setAmpli() {
                 }
             }
         }
-      
+      ampli_re[w].invalidateNormals();
+      ampli_im[w].invalidateNormals();
     }
 }
 
 void WaterSurface::setAmpli(FLOAT t) {
-    std::list<EquivalentSource*>::iterator it;
+    PROFILE_ZONE("WaterSurface::setAmpli");
+    PerfOverlay::Timer overlay_timer(PerfOverlay::AMPLITUDES_);
+    std::vector<EquivalentSource*>::const_iterator it;
     for (int w = 0; w < nb_wl; ++w) {
         ampli_re[w].reset(0);
         ampli_im[w].reset(0);
 
-        std::list<EquivalentSource*> waves_wl = waves[w];
+        const std::vector<EquivalentSource*> &waves_wl = waves[w];
 
         for (it = waves_wl.begin(); it != waves_wl.end(); ++it) {
             #pragma omp parallel for
@@ -184,6 +248,8 @@ void WaterSurface::setAmpli(FLOAT t) {
                 }
             }
         }
+        ampli_re[w].invalidateNormals();
+        ampli_im[w].invalidateNormals();
     }
 }
 
@@ -201,6 +267,7 @@ EquivalentSource* WaterSurface::addSingleSource(FLOAT x, FLOAT y, FLOAT wl, COMP
     w->setAmplitude(ampli);
     waves[0].push_back(w);
     sourcesPos.push_back(VEC2(x,y));
+    markers_dirty = true;
     return w;
 }
 
@@ -216,6 +283,7 @@ void WaterSurface::addEqSource(FLOAT x, FLOAT y, FLOAT wl, COMPLEX ampli) {
     waves[ind].push_back(w);
   }
   sourcesPos.push_back(VEC2(x, y));
+  markers_dirty = true;
 }
 
 void WaterSurface::addEqSource(EquivalentSource* eq){
@@ -224,22 +292,122 @@ void WaterSurface::addEqSource(EquivalentSource* eq){
 
 
 void WaterSurface::update() {
+    step();
+    if (time > stop_time) {
+      exit(0);
+    }
+}
+
+void WaterSurface::step() {
+    PROFILE_ZONE("WaterSurface::step");
     TR("TIME: "<<time);
   
     Times::TIMES->tick(Times::sum_up_time_);    
-    updateHeight();
+    if (stream_) {
+      std::stringstream ss;
+      ss <<stream_file<<time<<".band";
+      streamHeight(ss.str(), n_rows_, n_cols_, cell_size_);
+    } else if (projected_) {
+      // evaluated for the current camera when drawn
+      proj_dirty = true;
+    } else {
+      updateHeight();
+    }
     Times::TIMES->tock(Times::sum_up_time_);   
 
   ++time;
-  
-  if (time > stop_time) {
-    exit(0);
-  }
+}
+
+
+/* Background simulation: update() runs in t_solve as fast as it can while
+   the GUI thread keeps drawing the newest completed frame (acquireFrame).
+   The sources and amplitudes must not be modified while the solver runs. */
+void WaterSurface::startSolver() {
+    if (solving) {
+      return;
+    }
+    if (stream_ || projected_) {
+      WARNING(false, "Background solver not available in streaming or projected grid mode", "");
+      return;
+    }
+    for (int k = 0; k < 3; ++k) {
+      frames[k] = u;
+      frames[k].setColor(surface_color_[0], surface_color_[1], surface_color_[2]);
+      frame_time[k] = time;
+    }
+    back = 0;
+    front = 1;
+    ready_frame = 2;
+    dropped = 0;
+    repeated = 0;
+    solving = true;
+    t_solve = std::thread(&WaterSurface::solve, this);
+}
+
+void WaterSurface::stopSolver() {
+    if (!solving) {
+      return;
+    }
+    solving = false;
+    t_solve.join();
+    // keep the last published frame as the current surface
+    acquireFrame();
+    u.swap(frames[front]);
+    time = frame_time[front];
+    INFO("Solver stopped, dropped frames: "<<dropped<<", repeated frames: "<<repeated);
+}
+
+bool WaterSurface::isSolving() const {
+    return solving;
+}
+
+void WaterSurface::solve() {
+    Profiler::setThreadName("solver");
+    try {
+      while (solving && time <= stop_time) {
+        step();
+        // u now holds the new frame, publish it and get back the free buffer
+        u.swap(frames[back]);
+        frame_time[back] = time;
+        int prev = ready_frame.exchange(back | 4, std::memory_order_acq_rel);
+        if (prev & 4) {
+          ++dropped;
+        }
+        back = prev & 3;
+      }
+    } catch (std::exception& e) {
+      std::cerr << "Exception catched in solver thread: " << e.what() << std::endl;
+    }
+}
+
+/* Takes the newest frame published by the solver, returns false (and counts
+   a repeated frame) if there is none since the last call. */
+bool WaterSurface::acquireFrame() {
+    if (!(ready_frame.load(std::memory_order_acquire) & 4)) {
+      ++repeated;
+      return false;
+    }
+    front = ready_frame.exchange(front, std::memory_order_acq_rel) & 3;
+    return true;
+}
+
+int WaterSurface::getFrameTime() const {
+    return solving ? frame_time[front] : time;
+}
+
+unsigned long WaterSurface::droppedFrames() const {
+    return dropped;
+}
+
+unsigned long WaterSurface::repeatedFrames() const {
+    return repeated;
 }
 
 
 
 void WaterSurface::updateHeight() {
+  PROFILE_ZONE("WaterSurface::updateHeight");
+  PerfOverlay::Timer overlay_timer(PerfOverlay::ROTATION_);
   u.reset(0.0);
   FLOAT t = time*dt_;
   setAmpli(t);
@@ -253,10 +421,13 @@ void WaterSurface::updateHeight() {
         }
       }
     }
+  u.invalidateNormals();
 }
 
 
 void WaterSurface::refreshHeight() {
+    PROFILE_ZONE("WaterSurface::refreshHeight");
+    PerfOverlay::Timer overlay_timer(PerfOverlay::ROTATION_);
     time = 0;
     u.reset(0.0);
     setAmpli(0);
@@ -269,18 +440,136 @@ void WaterSurface::refreshHeight() {
             }
         }
     }
+    u.invalidateNormals();
+}
+
+
+/* Evaluates rows [r0, r0+nr) of a nr x nc grid of cell size cs directly
+   from the sources. If <height> is set, out receives the height at time t
+   (one channel), otherwise the real and imaginary amplitudes of each wave
+   length (2*nb_wl channels). <work> is a scratch buffer of nr*nc values. */
+void WaterSurface::evalBand(int r0, int nr, int nc, FLOAT cs, FLOAT t, bool height,
+			    float *out, std::vector<COMPLEX> &work) const {
+  int n_channels = height ? 1 : 2*nb_wl;
+  std::fill(out, out + (size_t)nr*nc*n_channels, 0.0f);
+  for (int w = 0; w < nb_wl; ++w) {
+    std::vector<const EquivalentSource*> sources(waves[w].begin(), waves[w].end());
+    int n_sources = sources.size();
+#pragma omp parallel for
+    for (int i = 0; i < nr; ++i) {
+      FLOAT x = cs*(r0 + i);
+      for (int j = 0; j < nc; ++j) {
+	FLOAT y = cs*j;
+	COMPLEX a(0, 0);
+	for (int s = 0; s < n_sources; ++s) {
+	  a += sources[s]->heightc(x, y, t);
+	}
+	work[(size_t)i*nc + j] = a;
+      }
+    }
+    if (height) {
+      FLOAT k =  2*M_PI/wave_lenghts[w];
+      COMPLEX rot = exp(-angular_vel(k)*t*i_);
+#pragma omp parallel for
+      for (int i = 0; i < nr; ++i) {
+	for (int j = 0; j < nc; ++j) {
+	  size_t ind = (size_t)i*nc + j;
+	  out[ind] += real(work[ind]*rot);
+	}
+      }
+    } else {
+#pragma omp parallel for
+      for (int i = 0; i < nr; ++i) {
+	for (int j = 0; j < nc; ++j) {
+	  size_t ind = (size_t)i*nc + j;
+	  out[ind*n_channels + 2*w] = real(work[ind]);
+	  out[ind*n_channels + 2*w + 1] = imag(work[ind]);
+	}
+      }
+    }
+  }
 }
 
+/* Streaming counterpart of setAmpli/exportAmplitude: the complex amplitude
+   of every wave length is evaluated band by band and written to <file>
+   (see BandStream), so memory stays bounded by settings::band_budget_
+   whatever the grid size. */
+void WaterSurface::streamAmplitude(std::string file, int nr, int nc, FLOAT cs) const {
+  VERBOSE(1, "Streaming amplitudes: "<<file);
+  int n_channels = 2*nb_wl;
+  int br = BandStream::bandRows(nc, n_channels, nc*sizeof(COMPLEX), band_budget_);
+  BandStream stream(file, nr, nc, n_channels, br);
+  std::vector<COMPLEX> work((size_t)stream.getBandRows()*nc);
+  while (!stream.done()) {
+    int rows = std::min(stream.getBandRows(), nr - stream.getNextRow());
+    evalBand(stream.getNextRow(), rows, nc, cs, 0, false, stream.band(), work);
+    stream.submit(rows);
+  }
+  stream.close();
+}
 
+/* Streaming counterpart of updateHeight: the height at the current time is
+   evaluated band by band and written to <file>. */
+void WaterSurface::streamHeight(std::string file, int nr, int nc, FLOAT cs) const {
+  PROFILE_ZONE("WaterSurface::streamHeight");
+  VERBOSE(1, "Streaming surface: "<<file);
+  int br = BandStream::bandRows(nc, 1, nc*sizeof(COMPLEX), band_budget_);
+  BandStream stream(file, nr, nc, 1, br);
+  std::vector<COMPLEX> work((size_t)stream.getBandRows()*nc);
+  FLOAT t = time*dt_;
+  while (!stream.done()) {
+    int rows = std::min(stream.getBandRows(), nr - stream.getNextRow());
+    evalBand(stream.getNextRow(), rows, nc, cs, t, true, stream.band(), work);
+    stream.submit(rows);
+  }
+  stream.close();
+}
+
+
+#ifndef WD_HEADLESS
 void WaterSurface::draw() {
-    u.draw();
+    PROFILE_ZONE("WaterSurface::draw");
+    // vector export (VRender): simplified surfaces in immediate mode
+    GLint render_mode;
+    glGetIntegerv(GL_RENDER_MODE, &render_mode);
+    bool vectorial = render_mode == GL_FEEDBACK && vector_tolerance_ > 0;
+
+    if (projected_) {
+      if (proj_dirty) {
+        updateProjGrid((time - 1)*dt_);
+      }
+      proj_grid.draw(surface_color_[0], surface_color_[1], surface_color_[2]);
+    } else {
+      Grid &surface = solving ? frames[front] : u;
+      if (vectorial) {
+        GridSimplifier simplified(surface, vector_tolerance_);
+        simplified.build();
+        simplified.draw(surface_color_[0], surface_color_[1], surface_color_[2]);
+      } else if (!draw_vbo || !renderer.draw(surface, surface_color_[0], surface_color_[1], surface_color_[2])) {
+        surface.draw();
+      }
+    }
     glPushMatrix();
     glTranslatef(30, 0, 0);
-    pattern.draw();
+    if (vectorial) {
+        GridSimplifier simplified(pattern, vector_tolerance_);
+        simplified.build();
+        simplified.draw(pattern_color_[0], pattern_color_[1], pattern_color_[2]);
+    } else if (!draw_vbo || !pattern_renderer.draw(pattern, pattern_color_[0], pattern_color_[1], pattern_color_[2])) {
+        pattern.draw();
+    }
     glPopMatrix();
 
+    if (draw_sources && draw_vbo && !vectorial) {
+        if (markers_dirty) {
+            setMarkers();
+        }
+        if (markers.draw(marker_size_)) {
+            return;
+        }
+    }
     if (draw_sources) {
-        sphere_source.setColor(0.8f, 0.2f, 1.0f);
+        sphere_source.setColor(source_color_[0], source_color_[1], source_color_[2]);
         for (auto &it : sourcesPos) {
             VEC2 c = it;
             glPushMatrix();
@@ -288,7 +577,7 @@ void WaterSurface::draw() {
             sphere_source.draw();
             glPopMatrix();
         }
-        sphere_source.setColor(0.0f, 1.0f, 0.0f);
+        sphere_source.setColor(constraint_color_[0], constraint_color_[1], constraint_color_[2]);
         for(auto &it : constraintsPos){
             VEC3 c = it;
             glPushMatrix();
@@ -300,7 +589,104 @@ void WaterSurface::draw() {
 }
 
 
+#endif
+
+/* Camera-adaptive mode: the surface is only evaluated on a nr x nc grid
+   projected from the screen (see ProjectedGrid::project), so the cost
+   depends on the screen resolution instead of the size of the world */
+void WaterSurface::setProjGrid(int nr, int nc) {
+    projected_ = true;
+    proj_grid = ProjectedGrid(nr, nc);
+    proj_dirty = true;
+}
+
+bool WaterSurface::isProjected() const {
+    return projected_;
+}
+
+/* Camera used by the projected grid (column major modelview projection
+   matrix); the grid is only projected again when the camera has moved */
+void WaterSurface::setCamera(const double mvp[16], FLOAT max_dist) {
+    if (!projected_ || std::equal(mvp, mvp + 16, camera_mvp)) {
+      return;
+    }
+    std::copy(mvp, mvp + 16, camera_mvp);
+    proj_grid.project(camera_mvp, max_dist);
+    proj_dirty = true;
+}
+
+VEC3 WaterSurface::getPosProjGrid(int i, int j) const {
+    VEC2 p = proj_grid.getPosWorld(i, j);
+    return VEC3(p(0), p(1), proj_grid(i, j)(2));
+}
+
+#ifndef WD_HEADLESS
+/* Level of detail of the surface (buffer object rendering): chunks out of
+   the camera frustum are skipped, the others decimated so that their cells
+   cover about lod_pixels_ pixels, see GridLod */
+void WaterSurface::setView(const double planes[6][4], const double eye[3], double pixel_ratio, bool perspective) {
+    renderer.setView(planes, eye, pixel_ratio, perspective, lod_pixels_);
+}
+#endif
+
+/* Heights of the projected grid at time t, evaluated from the sources.
+   A wave length is faded out where the grid is too coarse to sample it
+   (less than 4 nodes per wave length) and skipped below 2 nodes. */
+void WaterSurface::updateProjGrid(FLOAT t) {
+    PROFILE_ZONE("WaterSurface::updateProjGrid");
+    int n = proj_grid.getNbNodes();
+    std::vector<FLOAT> h(n, 0);
+    for (int w = 0; w < nb_wl; ++w) {
+      std::vector<const EquivalentSource*> sources(waves[w].begin(), waves[w].end());
+      int n_sources = sources.size();
+      FLOAT wl = wave_lenghts[w];
+      COMPLEX rot = exp(-angular_vel(2*M_PI/wl)*t*i_);
+#pragma omp parallel for schedule(dynamic, 64)
+      for (int i = 0; i < n; ++i) {
+        FLOAT fade = std::min(wl/(2*proj_grid.size(i)) - 1, (FLOAT)1);
+        if (fade <= 0) {
+          continue;
+        }
+        VEC2 p = proj_grid.getPosWorld(i);
+        COMPLEX a(0, 0);
+        for (int s = 0; s < n_sources; ++s) {
+          a += sources[s]->heightc(p(0), p(1), t);
+        }
+        h[i] += fade*real(a*rot);
+      }
+    }
+    for (int i = 0; i < n; ++i) {
+      proj_grid.setHeight(i, h[i]);
+    }
+    proj_dirty = false;
+}
+
+#ifndef WD_HEADLESS
+/* Instances drawn by the marker renderer, with the colors of the immediate
+   mode path of draw */
+void WaterSurface::setMarkers() {
+    markers.clear();
+    for (auto &it : sourcesPos) {
+        markers.addMarker(VEC3(it[0], it[1], 1.0f), source_color_[0], source_color_[1], source_color_[2]);
+    }
+    for (auto &it : constraintsPos) {
+        markers.addMarker(it, constraint_color_[0], constraint_color_[1], constraint_color_[2]);
+    }
+    markers_dirty = false;
+}
+
+/* GL resources of the renderers, the GL context must be current */
+void WaterSurface::releaseGL() {
+    renderer.release();
+    pattern_renderer.release();
+    markers.release();
+}
+#endif
+
+
 void WaterSurface::exportAmplitude(std::string file) const {
+  ERROR(!stream_, "The amplitudes are not kept in streaming mode", file);
+  ERROR(!projected_, "The amplitudes are not computed in projected grid mode", file);
   std::ofstream out_file;
   out_file.open(file);
 
@@ -317,6 +703,8 @@ void WaterSurface::exportAmplitude(std::string file) const {
 }
 
 void WaterSurface::exportAmplitudeRe(std::string file) const {
+  ERROR(!stream_, "The amplitudes are not kept in streaming mode", file);
+  ERROR(!projected_, "The amplitudes are not computed in projected grid mode", file);
   std::ofstream  out_file;
   out_file.open(file);
 
@@ -331,6 +719,8 @@ void WaterSurface::exportAmplitudeRe(std::string file) const {
 }
 
 void WaterSurface::exportAmplitudeIm(std::string file) const {
+  ERROR(!stream_, "The amplitudes are not kept in streaming mode", file);
+  ERROR(!projected_, "The amplitudes are not computed in projected grid mode", file);
   std::ofstream  out_file;
   out_file.open(file);
 
@@ -345,6 +735,8 @@ void WaterSurface::exportAmplitudeIm(std::string file) const {
 }
 
 void WaterSurface::exportPhase(std::string file) const {
+  ERROR(!stream_, "The amplitudes are not kept in streaming mode", file);
+  ERROR(!projected_, "The amplitudes are not computed in projected grid mode", file);
   std::ofstream  out_file;
   out_file.open(file);
 
@@ -358,8 +750,42 @@ void WaterSurface::exportPhase(std::string file) const {
   out_file.close();
 }
 
+/* Magnitude, phase, real and imaginary parts of every wave length in one
+   file, .npy or chunked container compressed at zlib level (see
+   AmplitudeExporter) */
+void WaterSurface::exportAmplitudes(std::string file, int level) const {
+  ERROR(!stream_, "The amplitudes are not kept in streaming mode", file);
+  ERROR(!projected_, "The amplitudes are not computed in projected grid mode", file);
+  AmplitudeExporter exporter(ampli_re, ampli_im, wave_lenghts);
+  exporter.setLevel(level);
+  exporter.write(file);
+}
+
+
+/* Surface mesh, the format is given by the extension (.obj, .ply, or raw
+   indexed triangles otherwise, see MeshExporter) */
+void WaterSurface::exportMesh(std::string file) const {
+  ERROR(!stream_, "The surface is not kept in streaming mode", file);
+  ERROR(!projected_, "The surface is not evaluated on the grid in projected grid mode", file);
+  u.exportMesh(file);
+}
+
+/* Surface mesh in the Mitsuba serialized format, same vertices, normals
+   and triangles as exportMesh, compressed at zlib level (0 to store);
+   the indices are only compressed for the first frame of a sequence */
+void WaterSurface::exportMitsuba(std::string file, int level) const {
+  ERROR(!stream_, "The surface is not kept in streaming mode", file);
+  ERROR(!projected_, "The surface is not evaluated on the grid in projected grid mode", file);
+  std::vector<VEC3> vertices = u.meshVertices();
+  std::vector<VEC3> normals = u.meshNormals();
+  mitsuba.setLevel(level);
+  mitsuba.setGrid(u.getNbRows(), u.getNbCols(), u.getNbRows() - 2, u.getNbCols() - 2);
+  mitsuba.write(file, "surface", vertices.data(), normals.data());
+}
 
 void WaterSurface::exportSurfaceTime(std::string file) const {
+  ERROR(!stream_, "The surface is not kept in streaming mode", file);
+  ERROR(!projected_, "The surface is not evaluated on the grid in projected grid mode", file);
   VERBOSE(1, "Exporting surface grid: "<<file);
   std::ofstream os(file.c_str());
   ERROR(os.good(), "Cannot open file "<<file, "");
@@ -375,165 +801,136 @@ void WaterSurface::importSurfaceTime(std::string file) {
   is.close();
 }
 
+/* Configuration file, or binary scene (see SceneFile) whose sources are
+   created straight from the mapped arrays */
 void WaterSurface::importConfig(std::string file) {
-  std::ifstream is(file);
-  ERROR(is.good(), "Cannot open file "<<file, "");
-  std::string line;
-  while (getline(is, line)) {
-    if (line.substr(0,1) == "#") {
-      //comment
-    } else if (line.substr(0,9) == "<gravity>") {
-      std::istringstream s(line.substr(9)); //Gravity value
-      s >> gravity_ ;
-    } else if (line.substr(0,9) == "<damping>") {
-      std::istringstream s(line.substr(9)); //Amortissement
-      s >> damping_ ;
-    } else if (line.substr(0,7) == "<ampli>") {
-      std::istringstream s(line.substr(7));
-      s >> height_ampli_ ;
-    } else if (line.substr(0,6) == "<grid>") { //GRID DEF 
-      getline(is, line);
-      while (line.substr(0,7) != "</grid>") {
-	if (line.substr(0,6) == "<size>") {
-	  std::istringstream s(line.substr(6));
-	  s >> n_rows_ >> n_cols_;
-	} else if (line.substr(0,11) == "<cell_size>") {
-	  std::istringstream s(line.substr(11));
-	  s >> cell_size_;
-	} else {
-      ERROR(false, "Invalid configuration file (grid)\""<<file, line);
-	}
-	scale_ = cell_size_ * n_rows_;
-	getline(is, line);
-      }
-    } else if (line.substr(0,14) == "<wave_lenghts>") { //WAVE LENGHT RANGE 
-      getline(is, line);
-      while (line.substr(0,15) != "</wave_lenghts>") {
-	if (line.substr(0,5) == "<min>") {
-	  std::istringstream s(line.substr(5));
-	  s >> min_wl;
-      init_wl_ = min_wl;
-	} else if (line.substr(0,5) == "<max>") {
-	  std::istringstream s(line.substr(5));
-	  s >> max_wl;
-	} else if (line.substr(0,8) == "<number>") {
-	  std::istringstream s(line.substr(8));
-	  s >> nb_wl;
-	  step_wl = (max_wl - min_wl)/(FLOAT)(nb_wl);
-	} else if (line.substr(0,6) == "<step>") {
-	  std::istringstream s(line.substr(6));
-	  s >> step_wl;
-      nb_wl = std::max((FLOAT)1, (max_wl - min_wl)/(FLOAT)(step_wl));
-	} else {
-      ERROR(false, "Invalid configuration file (wave lenghts)\""<<file, line);
-	}
-	getline(is, line);
-      }
-      setLists();
-	 	 
-    } else if (line.substr(0,6) == "<wave>") { //def of a wave
-      getline(is, line);
-      FLOAT wl = 0;
-      int ind = 0;
-      FLOAT ampli = height_ampli_;
-      while (line.substr(0,7) != "</wave>") {
-	if (line.substr(0,13) == "<wave_lenght>") {
-	  std::istringstream s(line.substr(11));
-	  s >> wl;
-	} else if (line.substr(0,11) == "<amplitude>") {
-	  std::istringstream s(line.substr(11));
-	  s >> ampli;
-	} else if (line.substr(0,7) == "<ampli>") {
-	  std::istringstream s(line.substr(7));
-	  s >> ampli;
-	     
-	} else if (line.substr(0,8) == "<source>") {
-	  getline(is, line);
-	  VEC2 pos;
-	  while (line.substr(0,9) != "</source>") {
-	    if  (line.substr(0,5) == "<pos>") {
-	      std::istringstream s(line.substr(6));
-	      s >> pos(0) >> pos(1);
-	    } else {
-          ERROR(false, "Invalid configuration file (source wave)\""<<file, line);
-	    }
-	    getline(is, line);
-	  }
-	  addEqSource(pos(0), pos(1), wl, ampli);
-	} else if (line.substr(0,12) == "<source_all>") {
-	  getline(is, line);
-	  VEC2 pos;
-	  while (line.substr(0,13) != "</source_all>") {
-	    if  (line.substr(0,5) == "<pos>") {
-	      std::istringstream s(line.substr(6));
-	      s >> pos(0) >> pos(1);
-	    } else {
-          ERROR(false, "Invalid configuration file (spurce all wave)\""<<file, line);
-	    }
-	    getline(is, line);
-	  }
-	  for (int i = 0; i < nb_wl; ++i) {
-	    EquivalentSource *w = new EquivalentSource(wave_lenghts[i]);
-	    w->setPos(pos);
-	    w->setAmplitude(ampli);
-	    waves[i].push_back(w);
-	  }
-	} else {
-      ERROR(false, "Invalid configuration file (wave)\""<<file, line);
-	}
-	getline(is, line);
-      }
+  PROFILE_ZONE("WaterSurface::importConfig");
+  if (!SceneFile::isBinary(file)) {
+    Scene scene = getScene();
+    SceneFile::readText(file, scene);
+    setScene(scene);
+    return;
+  }
+  SceneMap map(file);
+  setSceneSettings(map.settings(), map.waveLengths(), map.nbWaveLengths());
+  for (int w = 0; w < nb_wl; ++w) {
+    setSources(w, map.sources(w));
+  }
+  setSourceMarkers(map.markers(), map.nbMarkers());
+}
 
-     } else  if (line.substr(0,9) == "<pattern>") { //define patterns
-       getline(is, line);
-       std::string name;
-       int nc = 200;
-       int nr = 200;
-       FLOAT cs = 0.15;
-       FLOAT x = 15, y = 15;
-       FLOAT radius = 15;
-       FLOAT iv = 1;
-       FLOAT ampli = 0;
-       uint m = 0;
-       while (line.substr(0,10) != "</pattern>") {
-     	if  (line.substr(0,6) == "<file>") {
-     	  file = line.substr(7);
-     	} else if (line.substr(0,6) == "<size>") {
-     	  std::istringstream s(line.substr(6));
-     	  s >> nr >> nc;
-     	} else if (line.substr(0,11) == "<cell_size>") {
-     	  std::istringstream s(line.substr(11));
-     	  s >> cs;
-	} else if  (line.substr(0,5) == "<pos>") {
-	  std::istringstream s(line.substr(5));
-	  s >> x >> y;
-	} else if (line.substr(0,8) == "<radius>") {
-	  std::istringstream s(line.substr(8));
-	  s >> radius;
-	} else if (line.substr(0,7) == "<ampli>") {
-	  std::istringstream s(line.substr(7));
-	  s >> ampli;
-	} else if (line.substr(0,6) == "<init>") {
-	  std::istringstream s(line.substr(6));
-	  s >> iv;
-	} else if (line.substr(0,8) == "<method>") {
-	  std::istringstream s(line.substr(8));
-	  s >> m;
-	  INFO("Metode  "<<m);
-	} else {
-          ERROR(false, "Invalid configuration file (pattern)\""<<file, line);
-     	}
-     	getline(is, line);
-       }
-    }
-    else if (line.substr(0,14) == "<load_texture>") {
-        settings::doLoadTexture = !settings::doLoadTexture;
+/* Sources of a CSV or float32 file (see SourceImport) added to the
+   current lists */
+void WaterSurface::importSources(std::string file) {
+  PROFILE_ZONE("WaterSurface::importSources");
+  std::vector<float> table(wave_lenghts.begin(), wave_lenghts.end());
+  SourceSet set = SourceImport::read(file, table);
+  for (int w = 0; w < nb_wl; ++w) {
+    setSources(w, set.lists[w].arrays());
+  }
+  for (size_t k = 0; k + 1 < set.markers.size(); k += 2) {
+    sourcesPos.push_back(VEC2(set.markers[k], set.markers[k + 1]));
+  }
+  markers_dirty = true;
+  VERBOSE(1, "Imported "<<set.n_records<<" sources from "<<file<<" ("<<set.n_merged<<" merged)");
+}
+
+/* Binary scene if the extension is .wds, configuration file otherwise */
+void WaterSurface::exportScene(std::string file) const {
+  VERBOSE(1, "Exporting scene: "<<file);
+  SceneFile::write(file, getScene());
+}
+
+Scene WaterSurface::getScene() const {
+  Scene scene;
+  SceneSettings &st = scene.settings;
+  st.gravity = gravity_;
+  st.damping = damping_;
+  st.height_ampli = height_ampli_;
+  st.n_rows = n_rows_;
+  st.n_cols = n_cols_;
+  st.cell_size = cell_size_;
+  st.init_wl = init_wl_;
+  st.min_wl = min_wl;
+  st.max_wl = max_wl;
+  st.step_wl = step_wl;
+  st.load_texture = doLoadTexture;
+  st.reserved = 0;
+  scene.wave_lengths.assign(wave_lenghts.begin(), wave_lenghts.end());
+  scene.lists.resize(waves.size());
+  for (size_t w = 0; w < waves.size(); ++w) {
+    for (EquivalentSource *s : waves[w]) {
+      VEC2 p = s->getPos();
+      COMPLEX a = s->getAmpli();
+      scene.lists[w].push(p(0), p(1), s->getWL(), real(a), imag(a));
     }
-    else {
-        ERROR(false, "Invalid configuration file \""<<file, line);
+  }
+  for (const VEC2 &p : sourcesPos) {
+    scene.markers.push_back(p(0));
+    scene.markers.push_back(p(1));
+  }
+  return scene;
+}
+
+/* Replaces the settings and all the sources */
+void WaterSurface::setScene(const Scene &scene) {
+  setSceneSettings(scene.settings, scene.wave_lengths.data(), scene.wave_lengths.size());
+  for (int w = 0; w < nb_wl; ++w) {
+    setSources(w, scene.lists[w].arrays());
+  }
+  setSourceMarkers(scene.markers.data(), scene.markers.size()/2);
+}
+
+void WaterSurface::setSceneSettings(const SceneSettings &st, const float *table, int n) {
+  gravity_ = st.gravity;
+  damping_ = st.damping;
+  height_ampli_ = st.height_ampli;
+  n_rows_ = st.n_rows;
+  n_cols_ = st.n_cols;
+  cell_size_ = st.cell_size;
+  scale_ = cell_size_*n_rows_;
+  init_wl_ = st.init_wl;
+  min_wl = st.min_wl;
+  max_wl = st.max_wl;
+  step_wl = st.step_wl;
+  doLoadTexture = st.load_texture;
+
+  clear();
+  wave_lenghts.assign(table, table + n);
+  nb_wl = n;
+  allocLists();
+}
+
+/* Appends the sources to the list w in one new block; the sources of the
+   same wave length are copied from one built once */
+void WaterSurface::setSources(int w, const SceneArrays &sources) {
+  if (sources.n == 0) {
+    return;
+  }
+  source_blocks.push_back(std::vector<EquivalentSource>());
+  std::vector<EquivalentSource> &block = source_blocks.back();
+  block.reserve(sources.n);
+  EquivalentSource model(sources.wl[0]);
+  for (size_t k = 0; k < sources.n; ++k) {
+    if (sources.wl[k] != model.getWL()) {
+      model = EquivalentSource(sources.wl[k]);
     }
+    block.push_back(model);
+    block.back().setPos(sources.x[k], sources.y[k]);
+    block.back().setAmplitude(COMPLEX(sources.re[k], sources.im[k]));
   }
-  is.close();
+  waves[w].reserve(waves[w].size() + sources.n);
+  for (EquivalentSource &s : block) {
+    waves[w].push_back(&s);
+  }
+}
+
+void WaterSurface::setSourceMarkers(const float *xy, int n) {
+  sourcesPos.clear();
+  for (int k = 0; k < n; ++k) {
+    sourcesPos.push_back(VEC2(xy[2*k], xy[2*k + 1]));
+  }
+  markers_dirty = true;
 }
 
 
@@ -553,31 +950,24 @@ void WaterSurface::setImportConf(std::string file) {
   conf_file = file;
 }
 
+void WaterSurface::setImportSources(std::string file) {
+  load_sources = true;
+  sources_file = file;
+}
+
+void WaterSurface::setStream(std::string file) {
+  stream_ = true;
+  stream_file = file;
+}
+
 void WaterSurface::setStopTime(int end) {
   stop_time = end;
 }
 
 void WaterSurface::drawHeighField(std::string file) {
-  std::ofstream  out_file;
-  out_file.open(file);
-  INFO("Exporting "<<file);
-  out_file<<0<<" "<<0<<" "<<0.25*height_ampli_<<"\n";
-  for (int i = 0; i < n_rows_; ++i) {
-    for (int j = 0; j < n_cols_; ++j) {
-      FLOAT a = u(i, j);
-      if (a < -0.25*height_ampli_) {
-	a = -0.25*height_ampli_;
-      }
-      if (a > 0.25*height_ampli_) {
-	a = 0.25*height_ampli_;
-      }
-      if (i != 0 && j != 0) {
-	out_file<<i<<" "<<j<<" "<<a<<"\n";
-      }
-    }
-    out_file<<"\n";
-  }
-  out_file.close();
+  ERROR(!stream_, "The surface is not kept in streaming mode", file);
+  ERROR(!projected_, "The surface is not evaluated on the grid in projected grid mode", file);
+  Plotter::writeHeightField(file, u.data(), n_rows_, n_cols_, 0.25*height_ampli_);
 }
 
 VEC3 WaterSurface::getPosGrid(int i, int j) const {
@@ -597,12 +987,29 @@ FLOAT WaterSurface::maxWL() const {
     return wave_lenghts[nb_wl-1];
 }
 
-std::list<EquivalentSource*> WaterSurface::getSourceList() {
+const Grid &WaterSurface::getGrid() const {
+    return u;
+}
+
+const Grid &WaterSurface::getAmpliRe(int w) const {
+    return ampli_re[w];
+}
+
+const Grid &WaterSurface::getAmpliIm(int w) const {
+    return ampli_im[w];
+}
+
+const std::vector<FLOAT> &WaterSurface::getWaveLengths() const {
+    return wave_lenghts;
+}
+
+std::vector<EquivalentSource*> WaterSurface::getSourceList() {
     return waves[0];
 }
 
 void WaterSurface::addConstPoint(VEC3 pos){
     constraintsPos.push_back(pos);
+    markers_dirty = true;
 }
 
 std::vector<VEC3> WaterSurface::getConstrPoints(){
@@ -20,20 +20,29 @@
 #ifndef WATERSURFACE_HPP
 #define WATERSURFACE_HPP
 
+#include <atomic>
 #include <list>
 #include <thread>
+#include <vector>
 
 #include "definitions.hpp"
 #include "Wave.hpp"
 #include "Grid.hpp"
 #include "ProjectedGrid.hpp"
-#include "Sphere.hpp"
 #include "EquivalentSource.hpp"
+#include "SceneFile.hpp"
+#include "MitsubaExporter.hpp"
+#ifndef WD_HEADLESS
+#include "GridRenderer.hpp"
+#include "MarkerRenderer.hpp"
+#include "Sphere.hpp"
+#endif
 
 
 class WaterSurface {
 public:
   bool draw_sources;
+  bool draw_vbo;
 
   WaterSurface();
   ~WaterSurface();
@@ -51,36 +60,59 @@ public:
   void addEqSource(EquivalentSource* eq);
 
   void update();
+  void startSolver();
+  void stopSolver();
+  bool isSolving() const;
+  bool acquireFrame();
+  int getFrameTime() const;
+  unsigned long droppedFrames() const;
+  unsigned long repeatedFrames() const;
   friend void updateSourcesAmplis(WaterSurface *ws);
   void updateHeight();
   void refreshHeight();
 
+#ifndef WD_HEADLESS
   void draw();
+  void releaseGL();
+#endif
 
   void exportAmplitude(std::string file) const;
   void exportAmplitudeIm(std::string file) const;
   void exportAmplitudeRe(std::string file) const;
   void exportPhase(std::string file) const;
+  void exportAmplitudes(std::string file, int level = 1) const;
 
-  void exportMitsuba(std::string file) const;
+  void streamAmplitude(std::string file, int nr, int nc, FLOAT cs) const;
+  void streamHeight(std::string file, int nr, int nc, FLOAT cs) const;
+
+  void exportMesh(std::string file) const;
+  void exportMitsuba(std::string file, int level = 1) const;
   void exportSurfaceTime(std::string file) const;
   void importSurfaceTime(std::string file);
   void importConfig(std::string file);
+  void importSources(std::string file);
+  void exportScene(std::string file) const;
+
+  Scene getScene() const;
+  void setScene(const Scene &scene);
 
   void setImport(std::string file);
   void setExport(std::string file);
   void setImportConf(std::string file);
+  void setImportSources(std::string file);
+  void setStream(std::string file);
   void setStopTime(int end);
   void drawHeighField(std::string file);
 
 
-// #ifdef PROJECTED_GRID
-//   void setProjGrid(int i, int j, FLOAT x, FLOAT y);
-//   VEC3 getPosProjGrid(int i, int j) const;
-//   VEC3 getPosProjGrid(int i) const;
+  void setProjGrid(int nr, int nc);
+  bool isProjected() const;
+  void setCamera(const double mvp[16], FLOAT max_dist);
+#ifndef WD_HEADLESS
+  void setView(const double planes[6][4], const double eye[3], double pixel_ratio, bool perspective);
+#endif
+  VEC3 getPosProjGrid(int i, int j) const;
 
-//   void setTargetLookAt(VEC2 target);
-// #endif
   VEC3 getPosGrid(int i, int j) const;
   VEC3 getPosGrid(int i) const;
   int getTime();
@@ -88,8 +120,12 @@ public:
   FLOAT minWL() const;
   FLOAT maxWL() const;
 
-  std::vector<std::list<EquivalentSource*>> waves;
-  std::list<EquivalentSource*> getSourceList();
+  std::vector<std::vector<EquivalentSource*>> waves;
+  std::vector<EquivalentSource*> getSourceList();
+  const Grid &getGrid() const;
+  const Grid &getAmpliRe(int w) const;
+  const Grid &getAmpliIm(int w) const;
+  const std::vector<FLOAT> &getWaveLengths() const;
 
   void addConstPoint(VEC3 pos);
   std::vector<VEC3> getConstrPoints();
@@ -99,8 +135,20 @@ private:
   FLOAT min_wl, max_wl;
   int nb_wl;
 
+  void allocLists();
+  void setSceneSettings(const SceneSettings &st, const float *table, int n);
+  void setSources(int w, const SceneArrays &sources);
+  bool inBlock(const EquivalentSource *s) const;
+
+  // sources created at once by setSources, contiguous: the lists of waves
+  // point into them and clear() only deletes the other sources
+  std::vector<std::vector<EquivalentSource>> source_blocks;
+  void setSourceMarkers(const float *xy, int n);
+
   Grid u;
   Grid pattern;
+  // keeps the compressed indices of the surface mesh between the exports
+  mutable MitsubaExporter mitsuba;
 
   std::vector<Grid> ampli_re; //réel
   std::vector<Grid> ampli_im; //imaginaire
@@ -112,27 +160,61 @@ private:
   bool import_;
   bool export_;
   bool load_conf;
+  bool load_sources;
+  bool stream_;
 
   
   std::string import_file;
   std::string export_file;
   std::string conf_file;
+  std::string sources_file;
   std::string data_file;
+  std::string stream_file;
 
   int stop_time;
   
-  //  ProjectedGrid proj_grid;
+  // camera-adaptive mode: the heights are only evaluated at the nodes of
+  // proj_grid, projected from the screen on the water plane
+  bool projected_;
+  bool proj_dirty;
+  ProjectedGrid proj_grid;
+  double camera_mvp[16];
+  void updateProjGrid(FLOAT t);
   std::thread t_solve;
 
+  // triple buffered frames of the solver thread: the solver computes in u,
+  // swaps it with frames[back] and publishes it in ready_frame (index in the
+  // two low bits, fresh flag in the third); the renderer owns frames[front]
+  Grid frames[3];
+  int frame_time[3];
+  int back, front;
+  std::atomic<int> ready_frame;
+  std::atomic<bool> solving;
+  std::atomic<unsigned long> dropped;
+  unsigned long repeated;
+  void step();
+  void solve();
+
   VEC2 target_lookat;
 
+  bool markers_dirty;
+#ifndef WD_HEADLESS
+  GridRenderer renderer;
+  GridRenderer pattern_renderer;
+  MarkerRenderer markers;
+  void setMarkers();
+
   Sphere sphere_source;
   Sphere sphere_bp;
   Sphere sphere_pp;
   Sphere sphere_pp2;
+#endif
 
-  std::list<VEC2> sourcesPos;
+  std::vector<VEC2> sourcesPos;
   std::vector<VEC3> constraintsPos;
+
+  void evalBand(int r0, int nr, int nc, FLOAT cs, FLOAT t, bool height,
+		float *out, std::vector<COMPLEX> &work) const;
 };
 
 
@@ -21,7 +21,11 @@
 #define DEFINITIONS_HPP
 
 #include <Eigen/Core>
+#ifdef _WIN32
 #include <minwindef.h>
+#else
+typedef float FLOAT;
+#endif
 using namespace Eigen;
 
 //#define DOUBLE_PRECISION
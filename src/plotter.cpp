@@ -4,17 +4,115 @@
 #include <iostream>
 #include <sstream>
 #include <vector>
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
 
 #include "plotter.hpp"
+#include "Profiler.hpp"
 #include "error.hpp"
+#include "settings.hpp"
+#include "Deflate.hpp"
 #include "WaterSurface.hpp"
-#include "C:/msys64/mingw64/include/png.h"
+
+namespace {
+
+    /* Blue - green - red colormap of the heights normalized in [min, max],
+       written in a contiguous RGB buffer; pixel (x, y) is node (x, y).
+       The rows are shared between the threads of the enclosing parallel
+       region. */
+    template <typename F>
+    void colorMap(unsigned char *rgb, int width, int height,
+                  double minHeight, double maxHeight, F value) {
+        double range = maxHeight - minHeight;
+#pragma omp for
+        for (int y = 0; y < height; ++y) {
+            unsigned char *row = &rgb[(size_t)3*width*y];
+            for (int x = 0; x < width; ++x) {
+                double normalizedHeight = range > 0 ? (value(x, y) - minHeight) / range : 0;
+                if (normalizedHeight <= 0.5) {
+                    double factor = normalizedHeight / 0.5;
+                    row[3 * x] = 0;
+                    row[3 * x + 1] = static_cast<int>(255 * factor);
+                    row[3 * x + 2] = static_cast<int>(255* (1-factor));
+                } else {
+                    double factor = (normalizedHeight - 0.5) / 0.5;
+                    row[3 * x] = static_cast<int>(255 * factor);
+                    row[3 * x + 1] = static_cast<int>(255* (1-factor));
+                    row[3 * x + 2] = 0;
+                }
+            }
+        }
+    }
+
+    inline unsigned char paeth(int a, int b, int c) {
+        int p = a + b - c;
+        int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+        if (pa <= pb && pa <= pc) {
+            return a;
+        }
+        return pb <= pc ? b : c;
+    }
+
+    /* PNG filtering of one row (bpp bytes per pixel, prev is NULL for the
+       first row): every filter type is tried and the one with the smallest
+       sum of absolute values is kept, out receives the type and the row */
+    void filterRow(const unsigned char *row, const unsigned char *prev, size_t n, int bpp,
+                   unsigned char *out, std::vector<unsigned char> &work) {
+        work.resize(5*n);
+        long best_sum = -1;
+        int best = 0;
+        for (int f = 0; f < 5; ++f) {
+            unsigned char *w = &work[f*n];
+            long sum = 0;
+            for (size_t k = 0; k < n; ++k) {
+                int a = k >= (size_t)bpp ? row[k - bpp] : 0;
+                int b = prev != NULL ? prev[k] : 0;
+                int c = (prev != NULL && k >= (size_t)bpp) ? prev[k - bpp] : 0;
+                int pred = 0;
+                switch (f) {
+                case 1: pred = a; break;
+                case 2: pred = b; break;
+                case 3: pred = (a + b) / 2; break;
+                case 4: pred = paeth(a, b, c); break;
+                }
+                w[k] = row[k] - pred;
+                sum += w[k] < 128 ? w[k] : 256 - w[k];
+            }
+            if (best_sum < 0 || sum < best_sum) {
+                best_sum = sum;
+                best = f;
+            }
+        }
+        out[0] = best;
+        std::copy(&work[best*n], &work[best*n] + n, out + 1);
+    }
+
+    void writeChunk(std::ofstream &os, const char *type, const unsigned char *data, uint32_t size) {
+        unsigned char header[8] = {(unsigned char)(size >> 24), (unsigned char)(size >> 16),
+                                   (unsigned char)(size >> 8), (unsigned char)size,
+                                   (unsigned char)type[0], (unsigned char)type[1],
+                                   (unsigned char)type[2], (unsigned char)type[3]};
+        uLong crc = crc32(0L, Z_NULL, 0);
+        crc = crc32(crc, header + 4, 4);
+        if (size > 0) {
+            crc = crc32(crc, data, size);
+        }
+        unsigned char end[4] = {(unsigned char)(crc >> 24), (unsigned char)(crc >> 16),
+                                (unsigned char)(crc >> 8), (unsigned char)crc};
+        os.write((const char*)header, 8);
+        os.write((const char*)data, size);
+        os.write((const char*)end, 4);
+    }
+
+}
 
 void Plotter::createHeightMap(std::string inputFilename, std::string outputFilename, int nrow, int ncol){
     INFO("Creating Heightmap from "<< inputFilename);
     //Lecture des données, lecture de la hauteur max et min
     std::ifstream file(inputFilename, std::ifstream::in);
-    std::vector<std::vector<double>> heightMapVector(nrow, std::vector<double>(ncol, 0.0));
+    std::vector<double> heightMap((size_t)nrow*ncol, 0.0);
     INFO("Taille : "<<nrow <<"*"<<ncol<<std::endl);
     double maxHeight = std::numeric_limits<float>::lowest(), minHeight = std::numeric_limits<float>::max();
     std::string line;
@@ -23,7 +121,7 @@ void Plotter::createHeightMap(std::string inputFilename, std::string outputFilen
         int x, y;
         double height;
         if (iss >> x >> y >> height){
-            heightMapVector[x][y] = height;
+            heightMap[(size_t)x*ncol + y] = height;
             if (height > maxHeight){
                 maxHeight = height;
             }
@@ -33,60 +131,139 @@ void Plotter::createHeightMap(std::string inputFilename, std::string outputFilen
         }
     }
     file.close();
-    ///////
-
-    FILE *fp = fopen(outputFilename.c_str(), "wb");
-    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
-
-    png_init_io(png, fp);
-    png_infop info = png_create_info_struct(png);
-    // Écriture des en-têtes PNG
-    png_set_IHDR(
-        png,
-        info,
-        ncol, nrow, //width, height
-        8, //bit depth of the image
-        PNG_COLOR_TYPE_RGB,
-        PNG_INTERLACE_NONE,
-        PNG_COMPRESSION_TYPE_DEFAULT,
-        PNG_FILTER_TYPE_DEFAULT
-        );
-    png_write_info(png, info);
-
-    std::vector<std::vector<png_byte>> imageData(nrow, std::vector<png_byte>(3 * ncol, 0));
-
-    for (int x = 0; x<ncol; x++) {
-        for (int y = 0; y<nrow; y++){
-            float normalizedHeight = (heightMapVector[x][y] - minHeight) / (maxHeight - minHeight);
-            if (normalizedHeight <= 0.5) {
-                double factor = normalizedHeight / 0.5;
-                imageData[y][3 * x] = 0;
-                imageData[y][3 * x + 1] = static_cast<int>(255 * factor);
-                imageData[y][3 * x + 2] = static_cast<int>(255* (1-factor));
-            } else {
-                double factor = (normalizedHeight - 0.5) / 0.5;
-                imageData[y][3 * x] = static_cast<int>(255 * factor);
-                imageData[y][3 * x + 1] = static_cast<int>(255* (1-factor));
-                imageData[y][3 * x + 2] = 0;
+
+    std::vector<unsigned char> rgb((size_t)3*nrow*ncol);
+#pragma omp parallel
+    colorMap(rgb.data(), nrow, ncol, minHeight, maxHeight,
+             [&](int x, int y) {return heightMap[(size_t)x*ncol + y];});
+    writePng(outputFilename, rgb.data(), nrow, ncol);
+}
+
+void Plotter::exportHeightMap(std::string outputFile, WaterSurface* surface, int nrows, int ncols){
+    ERROR(!surface->getGrid().isEmpty(), "The surface is not kept in streaming mode", outputFile);
+    ERROR(!surface->isProjected(), "The surface is not evaluated on the grid in projected grid mode", outputFile);
+    exportHeightMap(outputFile, surface->getGrid(), 0.25*settings::height_ampli_);
+}
+
+void Plotter::exportHeightMap(std::string outputFile, const Grid &grid, FLOAT clamp){
+    exportHeightMap(outputFile, grid.data(), grid.getNbRows(), grid.getNbCols(), clamp);
+}
+
+/* Height map of a nrows x ncols field (row major) without going through
+   drawHeighField and createHeightMap, with the same values: heights clamped
+   to [-clamp, clamp], first row and column left out (0, not counted in the
+   min and max) except the first node which is set to clamp. The min and max
+   are reduced and the colormap applied in one parallel region. */
+void Plotter::exportHeightMap(std::string outputFile, const FLOAT *heights, int nrows, int ncols, FLOAT clamp){
+    PROFILE_ZONE("Plotter::exportHeightMap");
+    INFO("Creating Heightmap "<<outputFile);
+    auto value = [=](int i, int j) -> double {
+        if (i == 0 && j == 0) {
+            return clamp;
+        }
+        if (i == 0 || j == 0) {
+            return 0;
+        }
+        return std::min(std::max(heights[(size_t)i*ncols + j], -clamp), clamp);
+    };
+    double minHeight = clamp, maxHeight = clamp;
+    std::vector<unsigned char> rgb((size_t)3*nrows*ncols);
+#pragma omp parallel
+    {
+#pragma omp for reduction(min:minHeight) reduction(max:maxHeight)
+        for (int i = 1; i < nrows; ++i) {
+            for (int j = 1; j < ncols; ++j) {
+                double a = value(i, j);
+                minHeight = std::min(minHeight, a);
+                maxHeight = std::max(maxHeight, a);
             }
         }
+        // the reduction is complete after the implicit barrier
+        colorMap(rgb.data(), nrows, ncols, minHeight, maxHeight, value);
     }
+    writePng(outputFile, rgb.data(), nrows, ncols);
+}
 
-    // Écriture des pixels
-    for (int y = 0; y < nrow; ++y) {
-        png_write_row(png, imageData[y].data());
+/* 8 bits RGB PNG of a contiguous buffer: the rows are filtered in parallel
+   and the image data compressed by strips in parallel (see Deflate), then
+   the chunks are written directly. */
+void Plotter::writePng(std::string outputFile, const unsigned char *rgb, int width, int height){
+    PROFILE_ZONE("Plotter::writePng");
+    size_t row_size = (size_t)3*width;
+    std::vector<unsigned char> filtered((row_size + 1)*height);
+#pragma omp parallel
+    {
+        std::vector<unsigned char> work;
+#pragma omp for
+        for (int y = 0; y < height; ++y) {
+            filterRow(rgb + row_size*y, y > 0 ? rgb + row_size*(y-1) : NULL, row_size, 3,
+                      &filtered[(row_size + 1)*y], work);
+        }
     }
+    std::vector<unsigned char> idat;
+    Deflate::zlib(filtered.data(), filtered.size(), idat, 6);
 
-    // Fin de l'écriture
-    png_write_end(png, nullptr);
-
-    fclose(fp);
+    std::ofstream os(outputFile.c_str(), std::ios::binary);
+    ERROR(os.good(), "Cannot open file "<<outputFile, "");
+    const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    os.write((const char*)signature, 8);
+    unsigned char ihdr[13] = {(unsigned char)(width >> 24), (unsigned char)(width >> 16),
+                              (unsigned char)(width >> 8), (unsigned char)width,
+                              (unsigned char)(height >> 24), (unsigned char)(height >> 16),
+                              (unsigned char)(height >> 8), (unsigned char)height,
+                              8, 2, 0, 0, 0}; // 8 bits, RGB, deflate, adaptive filtering, no interlace
+    writeChunk(os, "IHDR", ihdr, 13);
+    const size_t max_chunk = (size_t)1 << 30;
+    for (size_t k = 0; k < idat.size(); k += max_chunk) {
+        writeChunk(os, "IDAT", idat.data() + k, std::min(max_chunk, idat.size() - k));
+    }
+    writeChunk(os, "IEND", NULL, 0);
+    ERROR(os.good(), "Error while writing "<<outputFile, "");
+}
 
-    png_destroy_write_struct(&png, &info);
+/* Gnuplot height field, same text as WaterSurface::drawHeighField: first
+   line "0 0 clamp", then "i j height" with the heights clamped to
+   [-clamp, clamp] (first row and column left out), blank line between rows */
+void Plotter::writeHeightField(std::string outputFile, const FLOAT *heights, int nrows, int ncols, FLOAT clamp){
+    PROFILE_ZONE("Plotter::writeHeightField");
+    INFO("Exporting "<<outputFile);
+    std::ofstream os(outputFile.c_str(), std::ios::binary);
+    ERROR(os.good(), "Cannot open file "<<outputFile, "");
+    os<<0<<" "<<0<<" "<<clamp<<"\n";
+    std::vector<char> buffer(48*(size_t)ncols + 1);
+    for (int i = 0; i < nrows; ++i) {
+        char *p = buffer.data(), *end = buffer.data() + buffer.size();
+        for (int j = 0; j < ncols; ++j) {
+            if (i == 0 || j == 0) {
+                continue;
+            }
+            FLOAT a = std::min(std::max(heights[(size_t)i*ncols + j], -clamp), clamp);
+            p = std::to_chars(p, end, i).ptr;
+            *p++ = ' ';
+            p = std::to_chars(p, end, j).ptr;
+            *p++ = ' ';
+            p = std::to_chars(p, end, a, std::chars_format::general, 6).ptr;
+            *p++ = '\n';
+        }
+        *p++ = '\n';
+        os.write(buffer.data(), p - buffer.data());
+    }
+    ERROR(os.good(), "Error while writing "<<outputFile, "");
 }
 
-void Plotter::exportHeightMap(std::string outputFile, WaterSurface* surface, int nrows, int ncols){
-    (*surface).drawHeighField("./heightfield.dat");
-    INFO("HeightField drawn !");
-    Plotter::createHeightMap("./heightfield.dat", outputFile, nrows, ncols);
+/* Raw float32 heights, same layout as a single band BandStream file:
+   "WDBAND01", int32 n_rows, n_cols, n_channels (1), band_rows (n_rows) */
+void Plotter::writeBinary(std::string outputFile, const FLOAT *heights, int nrows, int ncols){
+    PROFILE_ZONE("Plotter::writeBinary");
+    std::ofstream os(outputFile.c_str(), std::ios::binary);
+    ERROR(os.good(), "Cannot open file "<<outputFile, "");
+    int32_t header[4] = {nrows, ncols, 1, nrows};
+    os.write("WDBAND01", 8);
+    os.write((const char*)header, sizeof(header));
+    std::vector<float> row(ncols);
+    for (int i = 0; i < nrows; ++i) {
+        std::copy(heights + (size_t)i*ncols, heights + (size_t)(i+1)*ncols, row.begin());
+        os.write((const char*)row.data(), ncols*sizeof(float));
+    }
+    ERROR(os.good(), "Error while writing "<<outputFile, "");
 }
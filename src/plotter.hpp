@@ -2,6 +2,7 @@
 #define PLOTTER_H
 
 #include<string>
+#include<vector>
 #include"WaterSurface.hpp"
 
 class Plotter
@@ -9,6 +10,13 @@ class Plotter
 public:
     static void createHeightMap(std::string inputFilename, std::string outputFilename, int nrow, int ncol);
     static void exportHeightMap(std::string outputFile, WaterSurface* surface, int nrows, int ncols);
+    static void exportHeightMap(std::string outputFile, const Grid &grid, FLOAT clamp);
+    static void exportHeightMap(std::string outputFile, const FLOAT *heights, int nrows, int ncols, FLOAT clamp);
+
+    static void writePng(std::string outputFile, const unsigned char *rgb, int width, int height);
+
+    static void writeHeightField(std::string outputFile, const FLOAT *heights, int nrows, int ncols, FLOAT clamp);
+    static void writeBinary(std::string outputFile, const FLOAT *heights, int nrows, int ncols);
 };
 
 #endif // PLOTTER_H
@@ -43,7 +43,21 @@ namespace settings {
 
     FLOAT scale_ = 30;
 
+    size_t band_budget_ = 256 << 20;
+
+    FLOAT vector_tolerance_ = 0;
+
+    FLOAT lod_pixels_ = 0;
+
+    float surface_color_[3] = {29.0f/256.0f, 162.0f/256.0f, 216.0f/256.0f};
+    float pattern_color_[3] = {0.5f, 0.5f, 0.5f};
+    float source_color_[3] = {0.8f, 0.2f, 1.0f};
+    float constraint_color_[3] = {0.0f, 1.0f, 0.0f};
+    float point_color_[3] = {0.9f, 0.2f, 0.1f};
+    float marker_size_ = 0.1f;
+
     std::vector<COMPLEX> hankel_tab;
+    bool hankel_tab_ = false;
     //profil buffer
     int nb_profil = 100000;
     FLOAT step_profil = 0.025;
@@ -133,15 +147,18 @@ namespace settings {
     }
 
 
+    /* Green function of a source at distance x0 (in wave numbers). With
+       hankel_tab_, interpolated in hankel_tab out of the first cell (where
+       it is singular) and up to the end of the table, computed otherwise. */
     COMPLEX addWaves(FLOAT x0) {
-        // int ind = floor(x0/0.025);
-        // FLOAT coef = x0/0.025 - ind;
-        // if (ind >= 999999) {
-        //   ind = 0;
-        //   coef = 0;
-        // }
-        // COMPLEX out = (1-coef)*hankel_tab[ind] + coef*hankel_tab[ind+1];
-
+        if (hankel_tab_) {
+            FLOAT s = x0/step_profil;
+            int ind = (int)s;
+            if (ind >= 1 && ind < nb_profil - 1) {
+                FLOAT coef = s - ind;
+                return ((FLOAT)1 - coef)*hankel_tab[ind] + coef*hankel_tab[ind+1];
+            }
+        }
         COMPLEX out = (-i_)/(FLOAT)4.0f*Hankel(x0);
         return out;
     }
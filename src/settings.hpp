@@ -56,6 +56,25 @@ namespace settings {
   extern FLOAT init_wl_;
   extern FLOAT height_ampli_;
 
+  // memory budget (bytes) of the band pipeline used in streaming mode
+  extern size_t band_budget_;
+
+  // height tolerance of the simplified surface sent to the vector exporters,
+  // 0 (default) to send the full grid
+  extern FLOAT vector_tolerance_;
+
+  // screen size (pixels) of the decimated cells of the surface, 0 for the full grid
+  extern FLOAT lod_pixels_;
+
+  // colors (rgb) of the surface, the texture pattern, the source and
+  // constraint markers and the viewer points, radius of the markers
+  extern float surface_color_[3];
+  extern float pattern_color_[3];
+  extern float source_color_[3];
+  extern float constraint_color_[3];
+  extern float point_color_[3];
+  extern float marker_size_;
+
 
   VEC2 grid2viewer(int i, int j);
   VEC2 gridObs2viewer(int i, int j);
@@ -84,6 +103,8 @@ COMPLEX Hankel(FLOAT x);
 
   
   extern std::vector<COMPLEX> hankel_tab;
+  // sources evaluated by linear interpolation in hankel_tab (see addWaves)
+  extern bool hankel_tab_;
   //profil buffer
   extern int nb_profil;
   extern FLOAT step_profil;
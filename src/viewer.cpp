@@ -24,6 +24,7 @@
 #include <QMap>
 #include <QMenu>
 #include <QMouseEvent>
+#include <iomanip>
 
 #include "Grid.hpp"
 #include "viewer.hpp"
@@ -32,10 +33,24 @@
 #include "settings.hpp"
 #include "plotter.hpp"
 #include "wavedraw.hpp"
+#include "Profiler.hpp"
+#include <omp.h>
 
 using namespace std;
 
 Viewer::~Viewer() {
+  makeCurrent();
+  _surface.releaseGL();
+  if (capture_) {
+    capture_->flush();
+    capture_->release();
+  }
+  doneCurrent();
+
+  // writes the pending frames
+  export_queue.reset();
+  writeProfile();
+
   if (plot_ && stream_plot.is_open()) {
       stream_plot<<"set term pop; set out;";
       stream_plot.close();
@@ -47,15 +62,43 @@ Viewer::~Viewer() {
 void help_parse() {
   std::cout<<"\n     *** WAVE: Help ***\n"<<std::endl;
   std::cout<<"Synopsis: \n     .\\main <options>\n\nOptions:"<<std::endl;
-  std::cout<<"     -l, -load <file>: load configuration file"<<std::endl;
+  std::cout<<"     -l, -load <file>: load configuration file or binary scene (.wds)"<<std::endl;
+  std::cout<<"     -sources <file>: add the sources of a CSV (x, y, wave length, re, im) or float32 file"<<std::endl;
   std::cout<<"     -stop <t>: stop animation and exit at time t"<<std::endl;
+  std::cout<<"     -stream <file>: stream surface and amplitudes to <file>*.band by row bands"<<std::endl;
+  std::cout<<"     -band_budget <MB>: memory budget of the band pipeline (streaming mode)"<<std::endl;
+  std::cout<<"     -async: run the simulation in a background thread"<<std::endl;
+  std::cout<<"     -plot_format <dat|bin|png>: format of the plotted frames (default dat, with gnuplot script)"<<std::endl;
+  std::cout<<"     -export_threads <n>: number of writer threads of the plot mode (default 2)"<<std::endl;
+  std::cout<<"     -export_queue <n>: number of frames waiting to be written (default 8)"<<std::endl;
+  std::cout<<"     -export_drop: drop frames when the export queue is full instead of waiting"<<std::endl;
+  std::cout<<"     -record <prefix>: save every drawn frame to <prefix>NNNN.png in the background (toggled by CTRL+R)"<<std::endl;
+  std::cout<<"     -record_buffers <n>: number of frames read back at the same time while recording (default 3)"<<std::endl;
+  std::cout<<"     -profile <file>: profile the run, writes a Chrome trace in <file>.json and a summary at exit"<<std::endl;
+  std::cout<<"     -perf: hardware counters of the profiled zones (Linux)"<<std::endl;
+  std::cout<<"     -overlay: show the performance overlay (toggled by O)"<<std::endl;
+  std::cout<<"     -vector_tolerance <h>: height tolerance of the surface in vector snapshots (EPS, SVG, FIG), 0 for the full grid (default)"<<std::endl;
+  std::cout<<"     -lod <pixels>: decimate the surface so that its cells cover about <pixels> pixels, skip the parts out of view"<<std::endl;
+  std::cout<<"     -projected <rows> <cols>: only evaluate the surface on a rows x cols grid projected from the screen"<<std::endl;
   std::cout<<"     -h, -help: print help\n"<<std::endl;
   exit(0);
 }
 
 void Viewer::treatArguments(int argc, char **argv) {
   running_ = false;
+  async_ = false;
   plot_ = false;
+  plot_format_ = "dat";
+  export_threads_ = 2;
+  export_capacity_ = 8;
+  export_policy_ = ExportQueue::BLOCK_;
+  record_file_ = "record_";
+  recording_ = false;
+  record_count_ = 0;
+  record_buffers_ = 3;
+  profile_file_ = "";
+  // the phase timers (WaterSurface, Grid, GridRenderer) count for overlay_
+  PerfOverlay::setCurrent(&overlay_);
   for (int i = 1;  i < argc; ++i) {
     std::string s(argv[i]); //transforme argv[i] en string standard
     if (s == "-l" || s == "-load") {
@@ -66,6 +109,13 @@ void Viewer::treatArguments(int argc, char **argv) {
       std::cout<<"Loading configuration file:"<<" "<<argv[i+1]<<std::endl;
       _surface.setImportConf(argv[i+1]);
       ++i;
+    } else if (s == "-sources") {
+      if (argc < i + 2) {
+        std::cerr<<"\nERROR: wrong number of arguments\n"<<std::endl;
+        help_parse();
+      }
+      _surface.setImportSources(argv[i+1]);
+      ++i;
     } else if (s == "-p" || s == "-plot") {
       if (argc < i + 2) {
         std::cerr<<"\nERROR: wrong number of arguments\n"<<std::endl;
@@ -84,8 +134,103 @@ void Viewer::treatArguments(int argc, char **argv) {
       // _surface.setStopTime(atoi(argv[i+1]));
       stop_time = atoi(argv[i+1]);
       ++i;
+    } else if (s == "-stream") {
+      if (argc < i + 2) {
+        std::cerr<<"\nERROR: wrong number of arguments\n"<<std::endl;
+        help_parse();
+      }
+      std::cout<<"Streaming in "<<argv[i+1]<<std::endl;
+      _surface.setStream(argv[i+1]);
+      ++i;
+    } else if (s == "-band_budget") {
+      if (argc < i + 2) {
+        std::cerr<<"\nERROR: wrong number of arguments\n"<<std::endl;
+        help_parse();
+      }
+      settings::band_budget_ = (size_t)atoi(argv[i+1]) << 20;
+      ++i;
     } else if (s == "-r" || s == "-run") {
       running_ = true;
+    } else if (s == "-async") {
+      async_ = true;
+    } else if (s == "-plot_format") {
+      if (argc < i + 2) {
+        std::cerr<<"\nERROR: wrong number of arguments\n"<<std::endl;
+        help_parse();
+      }
+      plot_format_ = argv[i+1];
+      if (plot_format_ != "dat" && plot_format_ != "bin" && plot_format_ != "png") {
+        std::cerr<<"\nERROR: unknown plot format "<<plot_format_<<"\n"<<std::endl;
+        help_parse();
+      }
+      ++i;
+    } else if (s == "-export_threads") {
+      if (argc < i + 2) {
+        std::cerr<<"\nERROR: wrong number of arguments\n"<<std::endl;
+        help_parse();
+      }
+      export_threads_ = atoi(argv[i+1]);
+      ++i;
+    } else if (s == "-export_queue") {
+      if (argc < i + 2) {
+        std::cerr<<"\nERROR: wrong number of arguments\n"<<std::endl;
+        help_parse();
+      }
+      export_capacity_ = atoi(argv[i+1]);
+      ++i;
+    } else if (s == "-export_drop") {
+      export_policy_ = ExportQueue::DROP_;
+    } else if (s == "-record") {
+      if (argc < i + 2) {
+        std::cerr<<"\nERROR: wrong number of arguments\n"<<std::endl;
+        help_parse();
+      }
+      std::cout<<"Recording in "<<argv[i+1]<<std::endl;
+      record_file_ = argv[i+1];
+      recording_ = true;
+      ++i;
+    } else if (s == "-record_buffers") {
+      if (argc < i + 2) {
+        std::cerr<<"\nERROR: wrong number of arguments\n"<<std::endl;
+        help_parse();
+      }
+      record_buffers_ = atoi(argv[i+1]);
+      ++i;
+    } else if (s == "-profile") {
+      if (argc < i + 2) {
+        std::cerr<<"\nERROR: wrong number of arguments\n"<<std::endl;
+        help_parse();
+      }
+      profile_file_ = argv[i+1];
+      Profiler::setThreadName("main");
+      Profiler::enable(true);
+      ++i;
+    } else if (s == "-perf") {
+      Profiler::enableCounters(true);
+    } else if (s == "-overlay") {
+      overlay_.setVisible(true);
+    } else if (s == "-vector_tolerance") {
+      if (argc < i + 2) {
+        std::cerr<<"\nERROR: wrong number of arguments\n"<<std::endl;
+        help_parse();
+      }
+      settings::vector_tolerance_ = atof(argv[i+1]);
+      ++i;
+    } else if (s == "-lod") {
+      if (argc < i + 2) {
+        std::cerr<<"\nERROR: wrong number of arguments\n"<<std::endl;
+        help_parse();
+      }
+      settings::lod_pixels_ = atof(argv[i+1]);
+      ++i;
+    } else if (s == "-projected") {
+      if (argc < i + 3) {
+        std::cerr<<"\nERROR: wrong number of arguments\n"<<std::endl;
+        help_parse();
+      }
+      std::cout<<"Projected grid: "<<argv[i+1]<<" x "<<argv[i+2]<<std::endl;
+      _surface.setProjGrid(atoi(argv[i+1]), atoi(argv[i+2]));
+      i += 2;
     } else if (s == "-h" || s == "-help") {
       std::cout<<"help"<<std::endl;
       help_parse();
@@ -102,12 +247,46 @@ void Viewer::treatArguments(int argc, char **argv) {
 void Viewer::animate() {
   try {
     if (time_ > stop_time) {
+      // joins the solver thread, which must not outlive the exit
+      _surface.stopSolver();
+      if (export_queue) {
+        export_queue->flush();
+        INFO("Frames written: "<<export_queue->done()<<", dropped: "<<export_queue->dropped());
+      }
+      if (capture_) {
+        makeCurrent();
+        capture_->flush();
+        INFO("Frames recorded: "<<capture_->capturedFrames()<<", dropped: "<<capture_->droppedFrames());
+      }
+      writeProfile();
       std::exit(0);
     }
+  Profiler::nextFrame();
+  PROFILE_ZONE("Viewer::animate");
+  PerfOverlay::Timer overlay_timer(PerfOverlay::SIMULATION_);
+  if (async_) {
+    // the solver thread runs at its own rate, only show its newest frame
+    _surface.acquireFrame();
+    time_ = _surface.getFrameTime();
+    return;
+  }
   _surface.update();
 
   if (plot_) {
-  uint n = time_;
+    exportFrame(time_);
+  }
+  ++time_;
+   } catch (std::exception& e) {
+    std::cerr << "Exception catched : " << e.what() << std::endl;
+    _surface.clear();
+    throw;
+  }
+}
+  
+/* Hands a copy of the surface to the export queue, the gnuplot commands
+   are only written if the frame is not dropped */
+void Viewer::exportFrame(uint n) {
+  PerfOverlay::Timer overlay_timer(PerfOverlay::EXPORT_);
   std::string s0 = "";
   if (n < 10) {
     s0 = "000";
@@ -116,23 +295,108 @@ void Viewer::animate() {
   } else if (n < 1000) {
     s0 = "0";
   }
-  
-  std::stringstream ss_dat;
-  ss_dat <<export_file_data<<s0<<n<<".dat";
-  std::string str_dat(ss_dat.str());
-  _surface.drawHeighField(str_dat);
-  stream_plot<<"set output \""<<export_file_data<<"_2d_"<<s0<<n<<".png\"\n";
-  stream_plot<<"splot '"<<str_dat<<"' with pm3d\n";
+  std::stringstream ss;
+  ss <<export_file_data<<s0<<n;
+  std::string file(ss.str());
+
+  const Grid &g = _surface.getGrid();
+  int nr = g.getNbRows(), nc = g.getNbCols();
+  auto frame = std::make_shared<std::vector<FLOAT> >(g.data(), g.data() + (size_t)nr*nc);
+  FLOAT clamp = 0.25*settings::height_ampli_;
+  bool queued = false;
+  if (plot_format_ == "bin") {
+    queued = export_queue->push([=] {Plotter::writeBinary(file + ".band", frame->data(), nr, nc);});
+  } else if (plot_format_ == "png") {
+    queued = export_queue->push([=] {Plotter::exportHeightMap(file + ".png", frame->data(), nr, nc, clamp);});
+  } else {
+    queued = export_queue->push([=] {Plotter::writeHeightField(file + ".dat", frame->data(), nr, nc, clamp);});
+    if (queued) {
+      stream_plot<<"set output \""<<export_file_data<<"_2d_"<<s0<<n<<".png\"\n";
+      stream_plot<<"splot '"<<file<<".dat' with pm3d\n";
+    }
   }
-  ++time_;
-   } catch (std::exception& e) {
-    std::cerr << "Exception catched : " << e.what() << std::endl;
-    _surface.clear();
-    throw;
+}
+
+/* Saves the frame after the visual hints are drawn, the recording status
+   is drawn afterwards so it does not appear in the files */
+void Viewer::postDraw() {
+  QGLViewer::postDraw();
+  if (capture_ && !recording_) {
+    capture_->poll();
+  } else if (capture_) {
+    std::stringstream ss;
+    ss<<record_file_<<std::setw(4)<<std::setfill('0')<<record_count_++<<".png";
+    capture_->capture(ss.str(), width()*devicePixelRatio(), height()*devicePixelRatio());
+    drawText(10, height() - 10, QString("REC  queued: %1  dropped: %2")
+             .arg(capture_->queueDepth()).arg(capture_->droppedFrames()));
+  }
+  // after the capture, the overlay is not recorded
+  if (overlay_.isVisible()) {
+    overlay_.endFrame();
+    drawOverlay();
   }
 }
-  
+
+/* Frame graph and statistics in the top left corner, with the size of
+   the simulation */
+void Viewer::drawOverlay() {
+  const int x = 10, y = 10, w = 240, h = 80, line = 15;
+  overlay_.drawGraph(x, y, w, h, width(), height());
+  std::vector<std::string> lines = overlay_.text();
+  std::stringstream ss;
+  ss<<"grid "<<settings::n_rows_<<" x "<<settings::n_cols_<<"  sources "
+    <<(_surface.waves.empty() ? 0 : _surface.waves[0].size())<<"  wave lengths "<<_surface.waves.size()
+    <<"  threads "<<omp_get_max_threads()<<(async_ ? " + solver" : "");
+  lines.push_back(ss.str());
+  glColor3f(1, 1, 1);
+  for (size_t k = 0; k < lines.size(); ++k) {
+    drawText(x, y + h + line*(k + 1), QString::fromStdString(lines[k]));
+  }
+}
+
+void Viewer::setRecording(bool on) {
+  recording_ = on;
+  if (recording_ && !capture_) {
+    capture_.reset(new SnapshotCapture(record_buffers_, export_threads_, export_capacity_));
+  }
+  if (capture_) {
+    std::cout<<(recording_ ? "Recording in " : "Recording stopped, ")<<record_file_
+             <<" (frames: "<<capture_->capturedFrames()<<", dropped: "<<capture_->droppedFrames()
+             <<", queued: "<<capture_->queueDepth()<<")"<<std::endl;
+  }
+}
+
+/* Writes the trace and the summary of the profiled run, only once */
+void Viewer::writeProfile() {
+  if (profile_file_.empty()) {
+    return;
+  }
+  Profiler::enable(false);
+  Profiler::writeTrace(profile_file_ + ".json");
+  Profiler::summary(std::cout);
+  INFO("Profile written in "<<profile_file_<<".json");
+  profile_file_ = "";
+}
+
+void Viewer::startAnimation() {
+  if (async_) {
+    _surface.startSolver();
+  }
+  QGLViewer::startAnimation();
+}
+
+void Viewer::stopAnimation() {
+  QGLViewer::stopAnimation();
+  if (_surface.isSolving()) {
+    _surface.stopSolver();
+    std::cout<<"Dropped frames: "<<_surface.droppedFrames()
+             <<", repeated frames: "<<_surface.repeatedFrames()<<std::endl;
+  }
+}
+
 void Viewer::draw() {
+  PROFILE_ZONE("Viewer::draw");
+  PerfOverlay::Timer overlay_timer(PerfOverlay::RENDER_);
  
 float pos[4] = {1.0, 1.0, 1.0, 0.0};
   // Directionnal light
@@ -145,7 +409,27 @@ float pos[4] = {1.0, 1.0, 1.0, 0.0};
    pos[2] = float(pos2.z);
    glLightfv(GL_LIGHT2, GL_POSITION, pos);
    drawLight(GL_LIGHT2);
-  
+
+  if (_surface.isProjected()) {
+    GLdouble mvp[16];
+    camera()->getModelViewProjectionMatrix(mvp);
+    _surface.setCamera(mvp, camera()->zFar());
+  } else if (settings::lod_pixels_ > 0) {
+    GLdouble planes[6][4];
+    camera()->getFrustumPlanesCoefficients(planes);
+    qglviewer::Vec p = camera()->position();
+    double eye[3] = {p.x, p.y, p.z};
+    bool perspective = camera()->type() == qglviewer::Camera::PERSPECTIVE;
+    double ratio;
+    if (perspective) {
+      ratio = 2.0*tan(camera()->fieldOfView()/2.0)/camera()->screenHeight();
+    } else {
+      GLdouble hw, hh;
+      camera()->getOrthoWidthHeight(hw, hh);
+      ratio = 2.0*hh/camera()->screenHeight();
+    }
+    _surface.setView(planes, eye, ratio, perspective);
+  }
   _surface.draw();
 }
 
@@ -177,8 +461,8 @@ void Viewer::init() {
     setSceneRadius(30);
     srand(time(NULL));
     sphere.create_array();
-    sphere.setSize(0.1);
-    sphere.setColor(0.9f, 0.2f, 0.1f);
+    sphere.setSize(settings::marker_size_);
+    sphere.setColor(settings::point_color_[0], settings::point_color_[1], settings::point_color_[2]);
 
     // Opens help window
     // help();
@@ -199,6 +483,14 @@ void Viewer::init() {
         stream_plot<<"unset border\n";
         stream_plot<<"unset colorbox\n";
         stream_plot<<"set terminal png size 600, 600\n";
+        export_queue.reset(new ExportQueue(export_threads_, export_capacity_, export_policy_));
+    }
+    if (recording_) {
+        setRecording(true);
+    }
+    if (async_ && plot_) {
+        WARNING(false, "Plot mode needs every frame, background simulation disabled", "");
+        async_ = false;
     }
     if (running_) {
         startAnimation();
@@ -215,6 +507,12 @@ void Viewer::keyPressEvent(QKeyEvent *e) {
   // from 'CTRL+F'. That's why we use imbricated if...else and a "handled"
   // boolean.
   bool handled = false;
+  // the sources and the surface can't be modified while the solver runs
+  const bool restart = _surface.isSolving() &&
+    (modifiers == Qt::CTRL || e->key() == Qt::Key_Backspace);
+  if (restart) {
+    _surface.stopSolver();
+  }
   if ((e->key() == Qt::Key_W) && (modifiers == Qt::NoButton)) {
     wireframe_ = !wireframe_;
     if (wireframe_) {
@@ -228,6 +526,15 @@ void Viewer::keyPressEvent(QKeyEvent *e) {
     _surface.reset();
     handled = true;
     update();
+  } else if ((e->key() == Qt::Key_V) && (modifiers == Qt::NoButton)) {
+    _surface.draw_vbo = !_surface.draw_vbo;
+    std::cout<<(_surface.draw_vbo ? "Buffer object rendering" : "Immediate mode rendering")<<std::endl;
+    handled = true;
+    update();
+  } else if ((e->key() == Qt::Key_O) && (modifiers == Qt::NoButton)) {
+    overlay_.setVisible(!overlay_.isVisible());
+    handled = true;
+    update();
   } else if ((e->key() == Qt::Key_S) && (modifiers == Qt::NoButton)) {
     _surface.draw_sources = !_surface.draw_sources;
     handled = true;
@@ -292,6 +599,10 @@ void Viewer::keyPressEvent(QKeyEvent *e) {
 
       std::cout<<"-------------------"<<std::endl;
       handled = true;
+  } else if ((e->key() == Qt::Key_R) && (modifiers == Qt::CTRL)){
+      setRecording(!recording_);
+      handled = true;
+      update();
   } else if ((e->key() == Qt::Key_T)&&(modifiers == Qt::CTRL)){
       WaveDraw::test(&_surface);
       VEC2 center = VEC2(settings::n_rows_ * settings::cell_size_ /2, settings::n_cols_ * settings::cell_size_ /2);
@@ -299,6 +610,9 @@ void Viewer::keyPressEvent(QKeyEvent *e) {
       std::cout<<"surface height (viewer-side): "<<_surface.height(testPoint.x() / settings::cell_size_, testPoint.y() / settings::cell_size_)<<std::endl;
 
   }
+  if (restart) {
+    _surface.startSolver();
+  }
   if (!handled)
     QGLViewer::keyPressEvent(e);
 }
@@ -320,6 +634,9 @@ QString Viewer::helpString() const {
       "Press <b>F</b> to display the frame rate, <b>A</b> for the world axis, ";
   text += "<b>Alt+Return</b> for full screen mode and <b>Control+S</b> to save "
           "a snapshot. ";
+  text += "<b>Control+R</b> starts or stops recording every frame in the "
+          "background. ";
+  text += "<b>O</b> shows the frame times and their breakdown. ";
   text += "See the <b>Keyboard</b> tab in this window for a complete shortcut "
           "list.<br><br>";
   text += "Double clicks automates single click actions: A left button double "
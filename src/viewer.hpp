@@ -23,12 +23,19 @@
 #include <QGLViewer/qglviewer.h>
 #include <QGLViewer/manipulatedFrame.h>
 #include <fstream>
+#include <memory>
 #include "WaterSurface.hpp"
+#include "ExportQueue.hpp"
+#include "SnapshotCapture.hpp"
+#include "PerfOverlay.hpp"
 
 class Viewer : public QGLViewer {
 protected:
   virtual void draw();
+  virtual void postDraw();
   virtual void animate();
+  virtual void startAnimation();
+  virtual void stopAnimation();
   virtual void init();
   virtual QString helpString() const;
   void keyPressEvent(QKeyEvent *e);
@@ -43,12 +50,37 @@ private:
   uint time_ = 0;
   uint stop_time = 1e4; // program stopped after <stop_time> frame
   bool running_;
+  bool async_; // simulation in a background thread
   
   bool plot_;
   std::string export_file_data;
   std::string str_plot;
   std::ofstream stream_plot;
 
+  // plot mode: frames are written by the writer threads of export_queue
+  std::string plot_format_; // dat (gnuplot), bin or png
+  int export_threads_;
+  int export_capacity_;
+  ExportQueue::policy_t export_policy_;
+  std::unique_ptr<ExportQueue> export_queue;
+  void exportFrame(uint n);
+
+  // recording: every drawn frame is saved to <record_file_>NNNN.png by capture_
+  std::string record_file_;
+  bool recording_;
+  uint record_count_;
+  int record_buffers_;
+  std::unique_ptr<SnapshotCapture> capture_;
+  void setRecording(bool on);
+
+  // profiling: the zones are written to <profile_file_>.json at exit
+  std::string profile_file_;
+  void writeProfile();
+
+  // performance overlay, toggled by O
+  PerfOverlay overlay_;
+  void drawOverlay();
+
   // rendering option
   bool wireframe_;
 
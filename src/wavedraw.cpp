@@ -1,4 +1,5 @@
 #include "wavedraw.hpp"
+#include "Profiler.hpp"
 #include "settings.hpp"
 #include "error.hpp"
 
@@ -37,6 +38,7 @@ std::vector<VEC2> WaveDraw::positionSources(int nb_sources){
 //}
 
 void WaveDraw::setSinglePointtoHeight(VEC3 constr, VEC2 sourcePos, WaterSurface* ws){
+    PROFILE_ZONE("WaveDraw::setSinglePointtoHeight");
     EquivalentSource eq = new EquivalentSource(settings::init_wl_);
     eq.setPos(sourcePos);
     VEC2 pos = VEC2(constr.x(), constr.y());
@@ -66,6 +68,7 @@ void WaveDraw::setSinglePointtoHeight(VEC3 constr, VEC2 sourcePos, WaterSurface*
 
 
 void WaveDraw::setAmplisFromConstr(WaterSurface *ws){
+    PROFILE_ZONE("WaveDraw::setAmplisFromConstr");
     std::vector<VEC3> constraints = ws->getConstrPoints();
     ws->refreshHeight();
 
@@ -95,7 +98,11 @@ void WaveDraw::setAmplisFromConstr(WaterSurface *ws){
         constrHeights(i) = constraints[i].z();
     }
 
-    Eigen::Vector2cf x = srcHeights.lu().solve(constrHeights);
+    Eigen::Vector2cf x;
+    {
+        PROFILE_ZONE("WaveDraw::solve");
+        x = srcHeights.lu().solve(constrHeights);
+    }
 
     COMPLEX DebugHeights[2] = {COMPLEX(0,0), COMPLEX(0,0)};
 
@@ -126,6 +133,7 @@ void WaveDraw::setAmplisFromConstr(WaterSurface *ws){
 }
 
 FLOAT WaveDraw::evaluateSolution(WaterSurface* ws){
+    PROFILE_ZONE("WaveDraw::evaluateSolution");
     FLOAT error = 0;
     std::vector<VEC3> constraints = (*ws).getConstrPoints();
     for(VEC3 pos : constraints){
@@ -0,0 +1,548 @@
+/*
+ * File: main.cpp
+ *
+ * Accuracy versus speed of the evaluation modes: every scene of a corpus
+ * (variants of configuration files) is evaluated by a direct sum in double
+ * precision with the exact Hankel function, and by each mode of the
+ * library. The errors of the surface and of the amplitude grids are
+ * reported with the run time, in Pareto tables (see help_parse).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/math/special_functions/bessel.hpp>
+
+#include "WaterSurface.hpp"
+#include "settings.hpp"
+#include "error.hpp"
+
+namespace {
+
+  typedef std::complex<double> complexd;
+
+  struct Variant {
+    std::string name;
+    std::string conf;
+  };
+
+  // surface and amplitudes (nb_wl grids, row major) of one evaluation,
+  // the reference also flags the nodes left out of the errors
+  struct Field {
+    int n_rows, n_cols;
+    std::vector<double> u;
+    std::vector<complexd> ampli;
+    std::vector<char> excluded;
+  };
+
+  struct Result {
+    std::string scene, mode;
+    double time;
+    double max_u, rms_u;   // errors of the surface
+    double max_a, rms_a;   // errors of the amplitudes (real and imaginary parts)
+    double ref_u, ref_a;   // largest magnitudes of the reference
+    bool pareto;
+  };
+
+  std::vector<std::string> modes = {"direct", "direct_tab", "stream", "stream_tab"};
+  int max_grid = 200;
+  int reps = 3;
+  // radius (in largest wave lengths) around the sources left out of the errors
+  double near_field = 0.5;
+
+  // swallows the output of the library
+  class NullBuffer: public std::streambuf {
+  protected:
+    int overflow(int c) {return c;}
+  };
+
+  void help_parse() {
+    std::cout<<"\nUsage: wd_validate [options] [conf files]\n"<<std::endl;
+    std::cout<<"The corpus is made of variants of the configuration files (default ./conf/*.conf):"<<std::endl;
+    std::cout<<"the scene itself, with three wave lengths, and with eight more sources."<<std::endl;
+    std::cout<<"Options:"<<std::endl;
+    std::cout<<"     -modes <m,...>: evaluated modes among direct, direct_tab, stream, stream_tab (default all)"<<std::endl;
+    std::cout<<"     -max_grid <n>: grids larger than n x n are resampled on the same domain (default 200)"<<std::endl;
+    std::cout<<"     -near <r>: leave out of the errors the nodes closer than r wave lengths to a source (default 0.5)"<<std::endl;
+    std::cout<<"     -reps <n>: the time of a mode is the shortest of n runs (default 3)"<<std::endl;
+    std::cout<<"     -o <file>: write every result in file (CSV)"<<std::endl;
+    std::cout<<"     -v, -verbose: keep the output of the simulation"<<std::endl;
+    std::cout<<"     -h, -help: print help\n"<<std::endl;
+    exit(0);
+  }
+
+  void check_args(int argc, int i, int n) {
+    if (argc < i + n + 1) {
+      std::cerr<<"\nERROR: wrong number of arguments\n"<<std::endl;
+      help_parse();
+    }
+  }
+
+  double seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  /* Writes the variants of the configuration file <file> in the current
+     directory: grid limited to max_grid, three wave lengths, more sources */
+  void makeVariants(const std::string &file, std::vector<Variant> &corpus) {
+    std::ifstream is(file);
+    ERROR(is.good(), "Cannot open file "<<file, "");
+    std::vector<std::string> lines;
+    std::string line;
+    int n_rows = 0, n_cols = 0;
+    FLOAT cs = settings::cell_size_, min_wl = 1;
+    while (getline(is, line)) {
+      if (!line.empty() && line.back() == '\r') {
+	line.pop_back();
+      }
+      if (line.substr(0,6) == "<size>") {
+	std::istringstream s(line.substr(6));
+	s >> n_rows >> n_cols;
+      } else if (line.substr(0,11) == "<cell_size>") {
+	std::istringstream s(line.substr(11));
+	s >> cs;
+      } else if (line.substr(0,5) == "<min>") {
+	std::istringstream s(line.substr(5));
+	s >> min_wl;
+      }
+      // the texture does not change the evaluation
+      if (line.substr(0,14) != "<load_texture>") {
+	lines.push_back(line);
+      }
+    }
+    ERROR(n_rows > 0 && n_cols > 0, "No grid in "<<file, "");
+
+    FLOAT scale = std::max(1.0f, (FLOAT)std::max(n_rows, n_cols)/max_grid);
+    int nr = n_rows/scale, nc = n_cols/scale;
+    FLOAT ncs = cs*scale;
+    std::string name = std::filesystem::path(file).stem().string();
+
+    for (int v = 0; v < 3; ++v) {
+      std::string variant = name + (v == 0 ? "" : v == 1 ? "/wl3" : "/src8");
+      std::string out = name + "_" + std::to_string(v) + ".conf";
+      std::ofstream os(out);
+      ERROR(os.good(), "Cannot open file "<<out, "");
+      bool wl_block = false;
+      for (const std::string &l : lines) {
+	if (l.substr(0,6) == "<size>") {
+	  os<<"<size> "<<nr<<" "<<nc<<"\n";
+	} else if (l.substr(0,11) == "<cell_size>") {
+	  os<<"<cell_size> "<<ncs<<"\n";
+	} else if (v == 1 && l.substr(0,14) == "<wave_lenghts>") {
+	  os<<l<<"\n<min> "<<min_wl<<"\n<max> "<<2.2*min_wl<<"\n<step> 1.5\n";
+	  wl_block = true;
+	} else if (wl_block && l.substr(0,15) != "</wave_lenghts>") {
+	  // replaced
+	} else {
+	  wl_block = false;
+	  os<<l<<"\n";
+	}
+      }
+      if (v == 2) {
+	std::mt19937 gen(1);
+	std::uniform_real_distribution<FLOAT> x(0.1*nr*ncs, 0.9*nr*ncs), y(0.1*nc*ncs, 0.9*nc*ncs);
+	os<<"<wave>\n";
+	for (int s = 0; s < 8; ++s) {
+	  os<<"<source_all>\n<pos> "<<x(gen)<<" "<<y(gen)<<"\n</source_all>\n";
+	}
+	os<<"</wave>\n";
+      }
+      corpus.push_back(Variant{variant, out});
+    }
+  }
+
+  /* (-i/4) H0(x) with the Bessel functions, settings::Hankel is its
+     asymptotic expansion */
+  complexd green(double x) {
+    return complexd(0, -0.25)*complexd(boost::math::cyl_bessel_j(0, x), boost::math::cyl_neumann(0, x));
+  }
+
+  /* Direct sum in double precision over the nodes evaluated by setAmpli
+     (the last row and column are left to zero) */
+  Field reference(const WaterSurface &surface, double t) {
+    Field f;
+    f.n_rows = settings::n_rows_;
+    f.n_cols = settings::n_cols_;
+    size_t n = (size_t)f.n_rows*f.n_cols;
+    const std::vector<FLOAT> &wls = surface.getWaveLengths();
+    f.u.assign(n, 0);
+    f.ampli.assign(n*wls.size(), 0);
+    f.excluded.assign(n, 0);
+    double cs = settings::cell_size_;
+    // the asymptotic expansion of the modes diverges at the sources
+    double radius = near_field*wls.back();
+    for (const std::vector<EquivalentSource*> &l : surface.waves) {
+      for (const EquivalentSource *s : l) {
+	for (int i = 0; i < f.n_rows; ++i) {
+	  for (int j = 0; j < f.n_cols; ++j) {
+	    if (std::hypot(cs*i - s->getPos()(0), cs*j - s->getPos()(1)) <= radius) {
+	      f.excluded[(size_t)f.n_cols*i + j] = 1;
+	    }
+	  }
+	}
+      }
+    }
+    for (size_t w = 0; w < wls.size(); ++w) {
+      double k = 2*M_PI/wls[w];
+      double omega = std::sqrt(settings::gravity_*k + 0.074/1000*std::pow(k, 3));
+      complexd rot = std::exp(complexd(0, -omega*t));
+      std::vector<const EquivalentSource*> sources(surface.waves[w].begin(), surface.waves[w].end());
+      complexd *a = f.ampli.data() + w*n;
+#pragma omp parallel for schedule(dynamic)
+      for (int i = 0; i < f.n_rows - 1; ++i) {
+	for (int j = 0; j < f.n_cols - 1; ++j) {
+	  complexd sum(0, 0);
+	  for (const EquivalentSource *s : sources) {
+	    double r = std::hypot(cs*i - s->getPos()(0), cs*j - s->getPos()(1));
+	    double damp = std::exp(-settings::damping_*k*k*r);
+	    if (damp > 0.02 && r != 0) {
+	      sum += damp*green(k*r)*complexd(s->getAmpli());
+	    }
+	  }
+	  size_t ind = (size_t)f.n_cols*i + j;
+	  a[ind] = sum;
+	  f.u[ind] += real(sum*rot);
+	}
+      }
+    }
+    return f;
+  }
+
+  Field fromSurface(const WaterSurface &surface) {
+    Field f;
+    const Grid &u = surface.getGrid();
+    f.n_rows = u.getNbRows();
+    f.n_cols = u.getNbCols();
+    size_t n = (size_t)f.n_rows*f.n_cols;
+    f.u.assign(u.data(), u.data() + n);
+    size_t n_wl = surface.getWaveLengths().size();
+    f.ampli.resize(n*n_wl);
+    for (size_t w = 0; w < n_wl; ++w) {
+      const FLOAT *re = surface.getAmpliRe(w).data(), *im = surface.getAmpliIm(w).data();
+      for (size_t ind = 0; ind < n; ++ind) {
+	f.ampli[w*n + ind] = complexd(re[ind], im[ind]);
+      }
+    }
+    return f;
+  }
+
+  /* Reads a file written by BandStream */
+  std::vector<float> readBand(const std::string &file, int &nr, int &nc, int &nch) {
+    std::FILE *is = std::fopen(file.c_str(), "rb");
+    ERROR(is != NULL, "Cannot open file "<<file, "");
+    char magic[8];
+    int32_t header[4];
+    bool ok = std::fread(magic, 1, 8, is) == 8 && std::memcmp(magic, "WDBAND01", 8) == 0
+      && std::fread(header, sizeof(int32_t), 4, is) == 4;
+    nr = header[0];
+    nc = header[1];
+    nch = header[2];
+    std::vector<float> data;
+    if (ok) {
+      data.resize((size_t)nr*nc*nch);
+      ok = std::fread(data.data(), sizeof(float), data.size(), is) == data.size();
+    }
+    std::fclose(is);
+    ERROR(ok, "Invalid band file "<<file, "");
+    return data;
+  }
+
+  Field fromBands(const std::string &height_file, const std::string &ampli_file) {
+    Field f;
+    int nch;
+    std::vector<float> u = readBand(height_file, f.n_rows, f.n_cols, nch);
+    f.u.assign(u.begin(), u.end());
+    int nr, nc;
+    std::vector<float> a = readBand(ampli_file, nr, nc, nch);
+    size_t n = (size_t)nr*nc;
+    int n_wl = nch/2;
+    f.ampli.resize(n*n_wl);
+    for (int w = 0; w < n_wl; ++w) {
+      for (size_t ind = 0; ind < n; ++ind) {
+	f.ampli[w*n + ind] = complexd(a[ind*nch + 2*w], a[ind*nch + 2*w + 1]);
+      }
+    }
+    return f;
+  }
+
+  /* Errors of f against the reference over the nodes evaluated by setAmpli */
+  void compare(const Field &ref, const Field &f, Result &r) {
+    ERROR(f.n_rows == ref.n_rows && f.n_cols == ref.n_cols && f.ampli.size() == ref.ampli.size(),
+	  "Fields of different sizes", r.mode);
+    size_t n = (size_t)ref.n_rows*ref.n_cols;
+    size_t n_wl = ref.ampli.size()/n;
+    double sum_u = 0, sum_a = 0;
+    size_t count = 0;
+    r.max_u = r.max_a = r.ref_u = r.ref_a = 0;
+    for (int i = 0; i < ref.n_rows - 1; ++i) {
+      for (int j = 0; j < ref.n_cols - 1; ++j) {
+	size_t ind = (size_t)ref.n_cols*i + j;
+	if (ref.excluded[ind]) {
+	  continue;
+	}
+	double e = std::abs(f.u[ind] - ref.u[ind]);
+	r.max_u = std::max(r.max_u, e);
+	r.ref_u = std::max(r.ref_u, std::abs(ref.u[ind]));
+	sum_u += e*e;
+	for (size_t w = 0; w < n_wl; ++w) {
+	  complexd d = f.ampli[w*n + ind] - ref.ampli[w*n + ind];
+	  r.max_a = std::max(r.max_a, std::max(std::abs(d.real()), std::abs(d.imag())));
+	  r.ref_a = std::max(r.ref_a, std::abs(ref.ampli[w*n + ind]));
+	  sum_a += norm(d);
+	}
+	++count;
+      }
+    }
+    r.rms_u = count ? std::sqrt(sum_u/count) : 0;
+    r.rms_a = count ? std::sqrt(sum_a/(2*count*n_wl)) : 0;
+  }
+
+  /* Evaluates the loaded scene with <mode> and times the computation of
+     the surface */
+  Result evaluate(WaterSurface &surface, const std::string &mode, const Field &ref) {
+    Result r;
+    r.mode = mode;
+    settings::hankel_tab_ = mode == "direct_tab" || mode == "stream_tab";
+    Field f;
+    bool stream = mode == "stream" || mode == "stream_tab";
+    ERROR(stream || mode == "direct" || mode == "direct_tab", "Unknown mode "<<mode, "");
+    r.time = 0;
+    for (int k = 0; k < reps; ++k) {
+      auto start = std::chrono::steady_clock::now();
+      if (stream) {
+	surface.streamHeight("validate_u.band", settings::n_rows_, settings::n_cols_, settings::cell_size_);
+      } else {
+	surface.updateHeight();
+      }
+      double t = seconds(start);
+      r.time = k == 0 ? t : std::min(r.time, t);
+    }
+    if (!stream) {
+      f = fromSurface(surface);
+    } else {
+      surface.streamAmplitude("validate_a.band", settings::n_rows_, settings::n_cols_, settings::cell_size_);
+      f = fromBands("validate_u.band", "validate_a.band");
+    }
+    settings::hankel_tab_ = false;
+    compare(ref, f, r);
+    return r;
+  }
+
+  /* Marks the results not dominated in (time, max error of the surface) */
+  void pareto(std::vector<Result> &results) {
+    for (Result &r : results) {
+      r.pareto = true;
+      for (const Result &o : results) {
+	if (&o != &r && o.time <= r.time && o.max_u <= r.max_u && (o.time < r.time || o.max_u < r.max_u)) {
+	  r.pareto = false;
+	}
+      }
+    }
+  }
+
+  void printTable(std::ostream &os, const std::string &title, const std::vector<Result> &results, double ref_time) {
+    os<<"\n"<<title<<"\n";
+    os<<std::left<<std::setw(12)<<"mode"<<std::right<<std::setw(12)<<"time ms"<<std::setw(9)<<"speedup"
+      <<std::setw(12)<<"max err u"<<std::setw(12)<<"rms err u"<<std::setw(12)<<"rel err u"
+      <<std::setw(12)<<"max err a"<<std::setw(12)<<"rms err a"<<std::setw(12)<<"rel err a"<<"  pareto\n";
+    for (const Result &r : results) {
+      os<<std::left<<std::setw(12)<<r.mode<<std::right<<std::fixed<<std::setprecision(3)
+	<<std::setw(12)<<1e3*r.time<<std::setprecision(1)<<std::setw(9)<<(r.time > 0 ? ref_time/r.time : 0)
+	<<std::scientific<<std::setprecision(2)
+	<<std::setw(12)<<r.max_u<<std::setw(12)<<r.rms_u<<std::setw(12)<<(r.ref_u > 0 ? r.max_u/r.ref_u : 0)
+	<<std::setw(12)<<r.max_a<<std::setw(12)<<r.rms_a<<std::setw(12)<<(r.ref_a > 0 ? r.max_a/r.ref_a : 0)
+	<<(r.pareto ? "  *" : "")<<std::defaultfloat<<"\n";
+    }
+  }
+
+}
+
+int main(int argc, char **argv) {
+  std::vector<std::string> files;
+  std::string out_file;
+  bool verbose = false;
+
+  for (int i = 1;  i < argc; ++i) {
+    std::string s(argv[i]);
+    if (s == "-modes") {
+      check_args(argc, i, 1);
+      modes.clear();
+      std::stringstream ss(argv[i+1]);
+      std::string m;
+      while (getline(ss, m, ',')) {
+	if (m != "direct" && m != "direct_tab" && m != "stream" && m != "stream_tab") {
+	  std::cerr<<"\nERROR: unknown mode "<<m<<"\n"<<std::endl;
+	  help_parse();
+	}
+	modes.push_back(m);
+      }
+      ++i;
+    } else if (s == "-max_grid") {
+      check_args(argc, i, 1);
+      max_grid = std::max(2, atoi(argv[i+1]));
+      ++i;
+    } else if (s == "-near") {
+      check_args(argc, i, 1);
+      near_field = atof(argv[i+1]);
+      ++i;
+    } else if (s == "-reps") {
+      check_args(argc, i, 1);
+      reps = std::max(1, atoi(argv[i+1]));
+      ++i;
+    } else if (s == "-o") {
+      check_args(argc, i, 1);
+      out_file = argv[i+1];
+      ++i;
+    } else if (s == "-v" || s == "-verbose") {
+      verbose = true;
+    } else if (s == "-h" || s == "-help") {
+      help_parse();
+    } else if (!s.empty() && s[0] == '-') {
+      std::cerr<<"\nERROR: Unknown option "<<s<<"\n"<<std::endl;
+      help_parse();
+    } else {
+      files.push_back(s);
+    }
+  }
+
+  namespace fs = std::filesystem;
+  if (files.empty() && fs::is_directory("conf")) {
+    for (const fs::directory_entry &e : fs::directory_iterator("conf")) {
+      if (e.path().extension() == ".conf") {
+	files.push_back(e.path().string());
+      }
+    }
+    std::sort(files.begin(), files.end());
+  }
+  if (files.empty()) {
+    std::cerr<<"\nERROR: no configuration file\n"<<std::endl;
+    help_parse();
+  }
+  for (std::string &f : files) {
+    f = fs::absolute(f).string();
+  }
+  std::ofstream csv;
+  if (!out_file.empty()) {
+    csv.open(fs::absolute(out_file));
+    if (!csv.good()) {
+      std::cerr<<"\nERROR: cannot open "<<out_file<<"\n"<<std::endl;
+      return 1;
+    }
+    csv<<"scene,mode,time_ms,speedup,max_err_u,rms_err_u,max_u,max_err_ampli,rms_err_ampli,max_ampli,pareto"<<std::endl;
+  }
+
+  // the scenes and band files are written in a temporary directory
+  fs::path work = fs::temp_directory_path()/("wd_validate_" + std::to_string(std::random_device()()));
+  fs::path cwd = fs::current_path();
+  fs::create_directories(work);
+  fs::current_path(work);
+
+  std::ostream results(std::cout.rdbuf());
+  NullBuffer null_buffer;
+  std::streambuf *cout_buffer = std::cout.rdbuf();
+  if (!verbose) {
+    std::cout.rdbuf(&null_buffer);
+  }
+
+  int ret = 0;
+  try {
+    settings::doLoadTexture = false;
+    std::vector<Variant> corpus;
+    for (const std::string &f : files) {
+      makeVariants(f, corpus);
+    }
+
+    // all the scenes: total time, worst max errors and mean squared errors
+    std::vector<Result> total(modes.size() + 1);
+    double total_ref = 0;
+    for (size_t m = 0; m < total.size(); ++m) {
+      total[m] = Result{"corpus", m == 0 ? "reference" : modes[m-1], 0, 0, 0, 0, 0, 0, 0, false};
+    }
+
+    results<<"Errors against the direct sum in double precision, out of "<<near_field
+	   <<" wave length of the sources; time: shortest of "<<reps<<" runs"<<std::endl;
+    WaterSurface surface;
+    surface.setStopTime(1 << 30);
+    for (const Variant &scene : corpus) {
+      surface.setImportConf(scene.conf);
+      surface.reset();
+      double t = surface.getTime()*settings::dt_;
+      double ref_time = 0;
+      Field ref;
+      for (int k = 0; k < reps; ++k) {
+	auto start = std::chrono::steady_clock::now();
+	ref = reference(surface, t);
+	ref_time = k == 0 ? seconds(start) : std::min(ref_time, seconds(start));
+      }
+
+      std::vector<Result> res;
+      res.push_back(Result{scene.name, "reference", ref_time, 0, 0, 0, 0, 0, 0, false});
+      for (const std::string &m : modes) {
+	res.push_back(evaluate(surface, m, ref));
+	res.back().scene = scene.name;
+      }
+      res[0].ref_u = res.size() > 1 ? res[1].ref_u : 0;
+      res[0].ref_a = res.size() > 1 ? res[1].ref_a : 0;
+      pareto(res);
+      printTable(results, scene.name + " (" + std::to_string(settings::n_rows_) + " x " + std::to_string(settings::n_cols_)
+		 + ", " + std::to_string(surface.getWaveLengths().size()) + " wave lengths)", res, ref_time);
+
+      total_ref += ref_time;
+      for (size_t m = 0; m < res.size(); ++m) {
+	Result &r = res[m], &tot = total[m];
+	tot.time += r.time;
+	tot.max_u = std::max(tot.max_u, r.max_u);
+	tot.max_a = std::max(tot.max_a, r.max_a);
+	tot.rms_u += r.rms_u*r.rms_u/corpus.size();
+	tot.rms_a += r.rms_a*r.rms_a/corpus.size();
+	tot.ref_u = std::max(tot.ref_u, r.ref_u);
+	tot.ref_a = std::max(tot.ref_a, r.ref_a);
+	if (csv.is_open()) {
+	  csv<<r.scene<<","<<r.mode<<","<<1e3*r.time<<","<<(r.time > 0 ? ref_time/r.time : 0)<<","
+	     <<r.max_u<<","<<r.rms_u<<","<<r.ref_u<<","<<r.max_a<<","<<r.rms_a<<","<<r.ref_a<<","<<r.pareto<<std::endl;
+	}
+      }
+    }
+    for (Result &tot : total) {
+      tot.rms_u = std::sqrt(tot.rms_u);
+      tot.rms_a = std::sqrt(tot.rms_a);
+    }
+    pareto(total);
+    printTable(results, "Corpus (" + std::to_string(corpus.size()) + " scenes)", total, total_ref);
+  } catch (std::exception& e) {
+    std::cerr << "Exception catched : " << e.what() << std::endl;
+    ret = 1;
+  }
+
+  std::cout.rdbuf(cout_buffer);
+  fs::current_path(cwd);
+  fs::remove_all(work);
+  return ret;
+}
@@ -0,0 +1,46 @@
+# Accuracy versus speed of the evaluation modes, headless (see main.cpp)
+# qmake validate.pro && make
+
+TEMPLATE = app
+TARGET   = wd_validate
+CONFIG  -= qt
+CONFIG  += console c++17 release
+
+EIGEN=/mingw64/include/eigen3
+unix {
+	EIGEN=/usr/include/eigen3
+}
+
+SRC_DIR = ../src/
+INCLUDEPATH += $${SRC_DIR} $${EIGEN}
+OBJECTS_DIR = obj/
+DEFINES += WD_HEADLESS
+
+SOURCES  = main.cpp
+SOURCES += $${SRC_DIR}AmplitudeExporter.cpp \
+           $${SRC_DIR}BandStream.cpp \
+           $${SRC_DIR}DataFile.cpp \
+           $${SRC_DIR}Deflate.cpp \
+           $${SRC_DIR}FrameSeries.cpp \
+           $${SRC_DIR}EquivalentSource.cpp \
+           $${SRC_DIR}Grid.cpp \
+           $${SRC_DIR}MeshExporter.cpp \
+           $${SRC_DIR}MitsubaExporter.cpp \
+           $${SRC_DIR}Object.cpp \
+           $${SRC_DIR}PerfCounters.cpp \
+           $${SRC_DIR}Profiler.cpp \
+           $${SRC_DIR}ProjectedGrid.cpp \
+           $${SRC_DIR}SceneFile.cpp \
+           $${SRC_DIR}SourceImport.cpp \
+           $${SRC_DIR}Texture.cpp \
+           $${SRC_DIR}Times.cpp \
+           $${SRC_DIR}WaterSurface.cpp \
+           $${SRC_DIR}Wave.cpp \
+           $${SRC_DIR}definitions.cpp \
+           $${SRC_DIR}error.cpp \
+           $${SRC_DIR}plotter.cpp \
+           $${SRC_DIR}settings.cpp \
+           $${SRC_DIR}ui_parameters.cpp
+
+QMAKE_CXXFLAGS += -fopenmp -O3 -D__MODE_DEBUG=3 -Wno-unused-parameter -Wno-unused-variable -Wno-unused-but-set-variable
+LIBS += -fopenmp -lpthread -lpng16 -lz